@@ -2,6 +2,7 @@
 #include <cassert>
 #include <cinttypes>
 #include <climits>
+#include <cstring>
 #include <iostream>
 
 #include "deals.hpp"
@@ -12,6 +13,85 @@ namespace deals {
 //                   Deals search base class
 //      ***************************************************
 
+/* ----------------------------------------------------------
+**  i::deal_info_columns()   DealsInfo page columns layout
+** ----------------------------------------------------------*/
+std::vector<shared_mem::ColumnInfo> i::deal_info_columns() {
+  // must follow i::DealInfoColumn order
+  return {
+      SHARED_MEM_COLUMN(i::DealInfo, timestamp),
+      SHARED_MEM_COLUMN(i::DealInfo, origin),
+      SHARED_MEM_COLUMN(i::DealInfo, destination),
+      SHARED_MEM_COLUMN(i::DealInfo, price),
+      SHARED_MEM_COLUMN(i::DealInfo, departure_date),
+      SHARED_MEM_COLUMN(i::DealInfo, return_date),
+      SHARED_MEM_COLUMN(i::DealInfo, stay_days),
+      SHARED_MEM_COLUMN(i::DealInfo, flags),
+      SHARED_MEM_COLUMN(i::DealInfo, data)};
+}
+
+/* ----------------------------------------------------------
+**  i::deal_info_zones()   DealsInfo page zone maps
+** ----------------------------------------------------------*/
+std::vector<shared_mem::ColumnInfo> i::deal_info_zones() {
+  // must follow i::DealInfoZone order
+  return {
+      SHARED_MEM_COLUMN(i::DealInfo, timestamp),
+      SHARED_MEM_COLUMN(i::DealInfo, departure_date),
+      SHARED_MEM_COLUMN(i::DealInfo, return_date),
+      SHARED_MEM_COLUMN(i::DealInfo, price)};
+}
+
+/* ----------------------------------------------------------
+**  i::deal_info_keys()   DealsInfo page membership filters
+** ----------------------------------------------------------*/
+std::vector<shared_mem::ColumnInfo> i::deal_info_keys() {
+  // must follow i::DealInfoKey order
+  return {
+      SHARED_MEM_COLUMN(i::DealInfo, origin),
+      SHARED_MEM_COLUMN(i::DealInfo, destination)};
+}
+
+/* ----------------------------------------------------------
+**  i::deal_info_upsert_key()   DealsInfo record key
+** ----------------------------------------------------------*/
+std::vector<shared_mem::ColumnInfo> i::deal_info_upsert_key() {
+  return {
+      SHARED_MEM_COLUMN(i::DealInfo, origin),
+      SHARED_MEM_COLUMN(i::DealInfo, destination),
+      SHARED_MEM_COLUMN(i::DealInfo, departure_date),
+      SHARED_MEM_COLUMN(i::DealInfo, return_date),
+      SHARED_MEM_COLUMN(i::DealInfo, flags)};
+}
+
+/* ----------------------------------------------------------
+**  slot_classes()   128, 192, 256, 384, ... up to max_size
+** ----------------------------------------------------------*/
+static std::vector<uint32_t> slot_classes(uint32_t max_size) {
+  // slot is at most 1.5 times bigger than payload
+  std::vector<uint32_t> classes;
+  for (uint32_t size = 128; size < max_size; size *= 2) {
+    classes.push_back(size);
+    classes.push_back(size + size / 2);
+  }
+  classes.push_back(max_size);
+  return classes;
+}
+
+/* ----------------------------------------------------------
+**  i::deal_data_size_classes()   DealsData payload slots
+** ----------------------------------------------------------*/
+std::vector<uint32_t> i::deal_data_size_classes() {
+  return slot_classes(DEALDATA_MAX_SIZE);
+}
+
+/* ----------------------------------------------------------
+**  i::deal_info_extent_classes()   DealsInfo inline payload slots
+** ----------------------------------------------------------*/
+std::vector<uint32_t> i::deal_info_extent_classes() {
+  return slot_classes(DEALINFO_PAGE_EXTENT);
+}
+
 /* ----------------------------------------------------------
 **  DealsSearchQuery execute()    execute search process
 ** ----------------------------------------------------------*/
@@ -42,6 +122,101 @@ void DealsSearchQuery::execute() {
   post_search();
 };
 
+//----------------------------------------------------------------
+// DealsSearchQuery process_page()
+// called by TableProcessor for every not expired page in table.
+// on columnar pages cheap filters stream only their own columns
+// and the rest of deal is loaded only for candidates
+//----------------------------------------------------------------
+void DealsSearchQuery::process_page(const shared_mem::PageView<i::DealInfo> &page) {
+  if (!page.is_columnar()) {
+    TableProcessor<i::DealInfo>::process_page(page);
+    return;
+  }
+
+  const uint32_t *timestamps = page.column<uint32_t>(i::TIMESTAMP);
+  const uint16_t *origins = page.column<uint16_t>(i::ORIGIN);
+  const uint32_t *prices = page.column<uint32_t>(i::PRICE);
+  const uint32_t timestamp_from = min_timestamp();
+
+  i::DealInfo deal;
+  for (uint32_t idx = 0; idx < page.size; ++idx) {
+    if (timestamps[idx] < timestamp_from || !page.is_live(idx)) {
+      continue;
+    }
+    if (filter_origin && origins[idx] != origin_value) {
+      continue;
+    }
+    if (filter_price && (prices[idx] < price_from_value || prices[idx] > price_to_value)) {
+      continue;
+    }
+
+    page.get(idx, deal);
+    process_element(deal);
+  }
+}
+
+//----------------------------------------------------------------
+// DealsSearchQuery process_page_zones()
+// called by TableProcessor before page is mapped,
+// page is skipped if its min/max ranges miss any query filter
+//----------------------------------------------------------------
+bool DealsSearchQuery::process_page_zones(const shared_mem::ZoneMap &zones) {
+  if (!zones.overlaps(i::ZONE_TIMESTAMP, min_timestamp(), UINT32_MAX)) {
+    return false;
+  }
+
+  if (filter_departure_date &&
+      !zones.overlaps(i::ZONE_DEPARTURE_DATE, departure_date_values.from,
+                      departure_date_values.to)) {
+    return false;
+  }
+
+  if (filter_return_date &&
+      !zones.overlaps(i::ZONE_RETURN_DATE, return_date_values.from, return_date_values.to)) {
+    return false;
+  }
+
+  if (filter_price && !zones.overlaps(i::ZONE_PRICE, price_from_value, price_to_value)) {
+    return false;
+  }
+
+  return true;
+}
+
+//----------------------------------------------------------------
+// DealsSearchQuery process_page_keys()
+// called by TableProcessor before page is mapped,
+// page is skipped if it has no deals from origin or to destinations
+//----------------------------------------------------------------
+bool DealsSearchQuery::process_page_keys(const shared_mem::KeyFilter &keys) {
+  if (filter_origin && !keys.may_contain(i::KEY_ORIGIN, origin_value)) {
+    return false;
+  }
+
+  if (filter_destination) {
+    for (uint16_t destination : destination_values_set) {
+      if (keys.may_contain(i::KEY_DESTINATION, destination)) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  return true;
+}
+
+//----------------------------------------------------------------
+// DealsSearchQuery min_timestamp()
+//----------------------------------------------------------------
+uint32_t DealsSearchQuery::min_timestamp() const {
+  uint32_t result = current_time - DEALS_EXPIRES;
+  if (filter_timestamp && timestamp_value > result) {
+    result = timestamp_value;
+  }
+  return result;
+}
+
 //----------------------------------------------------------------
 // DealsSearchQuery process_element()
 // function that will be called by TableProcessor
@@ -69,6 +244,13 @@ void DealsSearchQuery::process_element(const i::DealInfo &deal) {
     return;
   }
 
+  // filter_price
+  //--------------------------------
+  if (filter_price && (deal.price < price_from_value || deal.price > price_to_value)) {
+    // std::cout << "filter_price" << std::endl;
+    return;
+  }
+
   // filter_flight_by_roundtrip
   // --------------------------------
   if (filter_flight_by_roundtrip) {
@@ -164,21 +346,62 @@ void DealsSearchQuery::process_element(const i::DealInfo &deal) {
 //                   Deals Database class
 //      ***************************************************
 DealsDatabase::DealsDatabase() {
+  shared_mem::TableOptions index_options;
+  index_options.page_format = DEALINFO_PAGE_FORMAT;
+  index_options.columns = i::deal_info_columns();
+  index_options.zones = i::deal_info_zones();
+  index_options.keys = i::deal_info_keys();
+  index_options.storage = DEALINFO_STORAGE;
+  index_options.spare_pages = DEALINFO_SPARE_PAGES;
+  index_options.tail_shards = DEALINFO_TAIL_SHARDS;
+  index_options.maintenance_thread = DEALINFO_MAINTENANCE_THREAD;
+  if (DEALINFO_INLINE_DATA) {
+    index_options.page_extent_size = DEALINFO_PAGE_EXTENT;
+    index_options.huge_pages = DEALINFO_HUGE_PAGES;
+    index_options.payload_ref = SHARED_MEM_COLUMN(i::DealInfo, payload);
+    index_options.extent_classes = i::deal_info_extent_classes();
+    index_options.dedup_buckets = DEALINFO_DEDUP_BUCKETS;
+  }
+  index_options.upsert_buckets = DEALINFO_UPSERT_BUCKETS;
+  index_options.upsert_key = i::deal_info_upsert_key();
+
+  shared_mem::TableOptions data_options;
+  data_options.storage = DEALDATA_STORAGE;
+  data_options.huge_pages = DEALDATA_HUGE_PAGES;
+  data_options.spare_pages = DEALDATA_SPARE_PAGES;
+  data_options.tail_shards = DEALDATA_TAIL_SHARDS;
+  data_options.maintenance_thread = DEALDATA_MAINTENANCE_THREAD;
+  if (DEALDATA_SIZE_CLASSES) {
+    data_options.size_classes = i::deal_data_size_classes();
+  }
+  data_options.dedup_buckets = DEALDATA_DEDUP_BUCKETS;
+
   // 1k pages x 10k elements per page, 10m records total, expire 60 seconds
   db_index = new shared_mem::Table<i::DealInfo>(DEALINFO_TABLENAME, DEALINFO_PAGES /* pages */,
                                                 DEALINFO_ELEMENTS /* elements in page */,
-                                                DEALS_EXPIRES /* page expire */);
+                                                DEALS_EXPIRES /* page expire */, index_options);
+
+  if (DEALS_PAYLOAD_COMPRESSION) {
+    payload_codec = new codec::DictionaryCodec(DEALS_DICTIONARY_NAME, DEALS_EXPIRES,
+                                               DEALS_DICTIONARY_TRAIN_INTERVAL);
+  }
+
+  if (DEALINFO_INLINE_DATA) {
+    return;
+  }
 
   // 10k pages x 3.2m per page = 32g bytes, expire 60 seconds
   db_data = new shared_mem::Table<i::DealData>(DEALDATA_TABLENAME, DEALDATA_PAGES /* pages */,
                                                DEALDATA_ELEMENTS /* elements in page */,
-                                               DEALS_EXPIRES /* page expire */);
+                                               DEALS_EXPIRES /* page expire */, data_options);
 }
 
 //---------------------------------------------------------
 // DealsDatabase destructor
 //---------------------------------------------------------
 DealsDatabase::~DealsDatabase() {
+  delete insert_log;
+  delete payload_codec;
   delete db_data;
   delete db_index;
 }
@@ -187,37 +410,304 @@ DealsDatabase::~DealsDatabase() {
 //  DealsDatabase  truncate
 //---------------------------------------------------------
 void DealsDatabase::truncate() {
-  db_data->cleanup();
+  if (db_data != nullptr) {
+    db_data->cleanup();
+  }
   db_index->cleanup();
+  if (insert_log != nullptr) {
+    insert_log->truncate();
+    log_version = {};
+  }
 }
 
 //---------------------------------------------------------
-//  DealsDatabase  addDeal
+//  DealsDatabase  isEmpty
 //---------------------------------------------------------
-bool DealsDatabase::addDeal(std::string origin, std::string destination, std::string departure_date,
-                            std::string return_date, bool direct_flight, uint32_t price,
-                            std::string data) {
-  if (origin.length() != 3) {
-    std::cout << "wrong origin length:" << origin << std::endl;
+bool DealsDatabase::isEmpty() {
+  return db_index->isEmpty();
+}
+
+//---------------------------------------------------------
+//  DealsDatabase  lockStats
+//---------------------------------------------------------
+std::string DealsDatabase::lockStats() {
+  std::string stats = db_index->lockStats();
+  if (db_data != nullptr) {
+    stats += db_data->lockStats();
+  }
+  return stats;
+}
+
+//---------------------------------------------------------
+//  DealsDatabase  saveSnapshot
+//---------------------------------------------------------
+// index is saved first: data pages it refers to are still alive and saved after it
+bool DealsDatabase::saveSnapshot(const std::string &directory) {
+  bool good = db_index->saveSnapshot(directory + "/" DEALINFO_TABLENAME ".snapshot");
+  if (db_data != nullptr) {
+    good = db_data->saveSnapshot(directory + "/" DEALDATA_TABLENAME ".snapshot") && good;
+  }
+  if (payload_codec != nullptr) {
+    good = payload_codec->saveSnapshot(directory + "/" DEALS_DICTIONARY_NAME ".snapshot") && good;
+  }
+
+  // logged deals were added before snapshot, they are in it
+  if (good && insert_log != nullptr) {
+    insert_log->truncate();
+    log_version = {};
+  }
+  return good;
+}
+
+//---------------------------------------------------------
+//  DealsDatabase  loadSnapshot
+//---------------------------------------------------------
+bool DealsDatabase::loadSnapshot(const std::string &directory) {
+  if (payload_codec != nullptr) {
+    payload_codec->loadSnapshot(directory + "/" DEALS_DICTIONARY_NAME ".snapshot");
+  }
+  if (db_data != nullptr && !db_data->loadSnapshot(directory + "/" DEALDATA_TABLENAME ".snapshot")) {
     return false;
   }
+  return db_index->loadSnapshot(directory + "/" DEALINFO_TABLENAME ".snapshot");
+}
 
-  if (destination.length() != 3) {
-    std::cout << "wrong destination length:" << destination << std::endl;
+//---------------------------------------------------------
+//  DealsDatabase  openLog
+//---------------------------------------------------------
+// log is scanned twice: latest cleanups of every shared memory instance first,
+// deals logged before them were cleared
+bool DealsDatabase::openLog(const std::string &file_name) {
+  delete insert_log;
+  insert_log = new wal::WriteAheadLog(file_name);
+  if (!insert_log->isOpen()) {
+    delete insert_log;
+    insert_log = nullptr;
     return false;
   }
+  log_version = {};
+
+  std::unordered_map<uint64_t, uint32_t> cleanups;
+  shared_mem::TableVersion version;
+  insert_log->replay([&](const std::string &record) {
+    if (parse_version_record(record, version)) {
+      uint32_t &latest = cleanups[version.instance];
+      latest = std::max(latest, version.cleanups);
+    }
+  });
 
-  uint32_t departure_date_int = query::date_to_int(departure_date);
-  if (departure_date_int == 0) {
-    std::cout << "wrong departure date:" << departure_date << std::endl;
+  // deals are added by batches, expired ones and ones older than snapshot are skipped
+  shared_mem::TableVersion current = db_index->version();
+  uint32_t min_timestamp =
+      std::max<uint32_t>(timing::getTimestampSec() - DEALS_EXPIRES, current.snapshot_time);
+  bool lost = false;  // deals follow version of other shared memory, not cleared since
+  uint64_t replayed = 0;
+  uint64_t skipped = 0;
+  std::vector<DealInfo> batch;
+  std::vector<bool> added;
+  auto flush = [&]() {
+    if (!batch.empty()) {
+      insert_deals(batch, true, added);
+      uint64_t good = std::count(added.begin(), added.end(), true);
+      replayed += good;
+      skipped += batch.size() - good;
+    }
+    batch.clear();
+  };
+
+  insert_log->replay([&](const std::string &record) {
+    if (parse_version_record(record, version)) {
+      lost = version.instance != current.instance &&
+             version.cleanups == cleanups[version.instance];
+      return;
+    }
+    DealInfo deal;
+    if (!lost || !parse_log_record(record, deal) || deal.timestamp < min_timestamp) {
+      ++skipped;
+      return;
+    }
+    batch.push_back(deal);
+    if (batch.size() >= DEALS_LOG_REPLAY_BATCH) {
+      flush();
+    }
+  });
+  flush();
+
+  std::cout << "DealsDatabase::openLog replayed deals:" << replayed << " skipped:" << skipped
+            << std::endl;
+  return true;
+}
+
+//---------------------------------------------------------
+//  DealsDatabase  syncLog
+//---------------------------------------------------------
+void DealsDatabase::syncLog(bool force) {
+  if (insert_log == nullptr) {
+    return;
+  }
+  // deals logged before cleanup by other process must not be replayed
+  log_version_change();
+  if (force) {
+    insert_log->commit();
+  } else {
+    insert_log->tick();
+  }
+}
+
+//---------------------------------------------------------
+//  DealsDatabase  trainPayloadCodec
+//---------------------------------------------------------
+void DealsDatabase::trainPayloadCodec() {
+  if (payload_codec != nullptr) {
+    payload_codec->trainIfDue();
+  }
+}
+
+//---------------------------------------------------------
+//  DealsDatabase  log_version_change
+//---------------------------------------------------------
+void DealsDatabase::log_version_change() {
+  shared_mem::TableVersion version = db_index->version();
+  if (version.instance != log_version.instance || version.cleanups != log_version.cleanups) {
+    insert_log->append(version_record(version));
+    log_version = version;
+  }
+}
+
+//---------------------------------------------------------
+//  DealsDatabase  log_deal
+//---------------------------------------------------------
+void DealsDatabase::log_deal(const DealInfo &deal) {
+  log_version_change();
+  insert_log->append(log_record(deal));
+}
+
+//---------------------------------------------------------
+//  DealsDatabase  log_record
+//---------------------------------------------------------
+// [DEALS_LOG_DEAL][timestamp:4][price:4][direct:1][len:1]origin[len:1]destination
+// [len:1]departure_date[len:1]return_date[data...]
+std::string DealsDatabase::log_record(const DealInfo &deal) {
+  std::string record;
+  record.reserve(32 + deal.data.size());
+  record.push_back(DEALS_LOG_DEAL);
+  record.append((const char *)&deal.timestamp, sizeof(deal.timestamp));
+  record.append((const char *)&deal.price, sizeof(deal.price));
+  record.push_back(deal.flags.direct ? 1 : 0);
+  for (const std::string *field :
+       {&deal.origin, &deal.destination, &deal.departure_date, &deal.return_date}) {
+    uint8_t length = std::min<size_t>(field->size(), UINT8_MAX);
+    record.push_back((char)length);
+    record.append(*field, 0, length);
+  }
+  record.append(deal.data);
+  return record;
+}
+
+//---------------------------------------------------------
+//  DealsDatabase  parse_log_record
+//---------------------------------------------------------
+bool DealsDatabase::parse_log_record(const std::string &record, DealInfo &deal) {
+  size_t offset = 1 + sizeof(deal.timestamp) + sizeof(deal.price) + 1;
+  if (record.size() < offset || record[0] != DEALS_LOG_DEAL) {
     return false;
   }
+  std::memcpy(&deal.timestamp, record.data() + 1, sizeof(deal.timestamp));
+  std::memcpy(&deal.price, record.data() + 1 + sizeof(deal.timestamp), sizeof(deal.price));
+  deal.flags = {};
+  deal.flags.direct = record[offset - 1] != 0;
+  deal.stay_days = 0;
+
+  for (std::string *field :
+       {&deal.origin, &deal.destination, &deal.departure_date, &deal.return_date}) {
+    if (offset >= record.size()) {
+      return false;
+    }
+    uint8_t length = record[offset++];
+    if (offset + length > record.size()) {
+      return false;
+    }
+    field->assign(record, offset, length);
+    offset += length;
+  }
+  deal.data.assign(record, offset, std::string::npos);
+  return true;
+}
 
-  uint32_t return_date_int = query::date_to_int(return_date);
+//---------------------------------------------------------
+//  DealsDatabase  version_record
+//---------------------------------------------------------
+// [DEALS_LOG_VERSION][instance:8][cleanups:4]
+std::string DealsDatabase::version_record(const shared_mem::TableVersion &version) {
+  std::string record(1, DEALS_LOG_VERSION);
+  record.append((const char *)&version.instance, sizeof(version.instance));
+  record.append((const char *)&version.cleanups, sizeof(version.cleanups));
+  return record;
+}
+
+//---------------------------------------------------------
+//  DealsDatabase  parse_version_record
+//---------------------------------------------------------
+bool DealsDatabase::parse_version_record(const std::string &record,
+                                         shared_mem::TableVersion &version) {
+  if (record.size() != 1 + sizeof(version.instance) + sizeof(version.cleanups) ||
+      record[0] != DEALS_LOG_VERSION) {
+    return false;
+  }
+  std::memcpy(&version.instance, record.data() + 1, sizeof(version.instance));
+  std::memcpy(&version.cleanups, record.data() + 1 + sizeof(version.instance),
+              sizeof(version.cleanups));
+  version.snapshot_time = 0;
+  return true;
+}
+
+//---------------------------------------------------------
+//  DealsDatabase  addDeal
+//---------------------------------------------------------
+bool DealsDatabase::addDeal(std::string origin, std::string destination, std::string departure_date,
+                            std::string return_date, bool direct_flight, uint32_t price,
+                            std::string data) {
+  i::DealInfo info;
+  if (!make_deal_info(origin, destination, departure_date, return_date, direct_flight, price,
+                      info)) {
+    return false;
+  }
+
+  // insert log keeps original payload, it's compressed again on replay
+  std::string original;
+  if (insert_log != nullptr) {
+    original = data;
+  }
+  auto log_added = [&]() {
+    DealInfo deal = {info.timestamp, origin, destination, departure_date, return_date, 0, {},
+                     price, original};
+    deal.flags.direct = direct_flight;
+    log_deal(deal);
+  };
+  if (payload_codec != nullptr) {
+    data = payload_codec->compress(data);
+  }
 
   // convert string to i::DealData (byte array)
   deals::i::DealData *data_pointer = (deals::i::DealData *)data.c_str();
   uint32_t data_size = data.length();
+  if (data_size > DEALDATA_MAX_SIZE) {
+    std::cout << "too big data size:" << data_size << std::endl;
+    return false;
+  }
+
+  // deal with data in one DealsInfo page
+  if (db_data == nullptr) {
+    auto di_result = db_index->addInlineRecord(&info, data_pointer, data_size);
+    if (di_result.error != shared_mem::ErrorCode::NO_ERROR) {
+      std::cout << "ERROR DealsDatabase::addDeal inline:" << (int)di_result.error << std::endl;
+      return false;
+    }
+    if (insert_log != nullptr) {
+      log_added();
+    }
+    return true;
+  }
 
   // 1) Add data and get data offset in db page
   auto result = db_data->addRecord(data_pointer, data_size);
@@ -226,32 +716,14 @@ bool DealsDatabase::addDeal(std::string origin, std::string destination, std::st
     return false;
   }
 
-  // std::cout << "{" << result.page_name << "}" << std::endl;
+  // std::cout << "{" << result.page_id << "}" << std::endl;
   // std::cout << "{" << result.index << "}" << std::endl;
   // std::cout << "{" << result.size << "}" << std::endl;
   // std::cout << "{" << result.error << "}" << std::endl;
 
-  i::DealInfo info;
-  info.timestamp = timing::getTimestampSec();
-  info.origin = query::origin_to_code(origin);
-  info.destination = query::origin_to_code(destination);
-  info.departure_date = departure_date_int;
-  info.return_date = return_date_int;
-  info.flags.overriden = false;
-  info.flags.direct = direct_flight;
-  info.flags.departure_day_of_week = ::utils::day_of_week_from_date(departure_date);
-  info.flags.return_day_of_week = ::utils::day_of_week_from_date(return_date);
-  info.price = price;
-  strncpy(info.page_name, result.page_name.c_str(), MEMPAGE_NAME_MAX_LEN);
-  info.index = result.index;
-  info.size = result.size;
-
-  if (return_date_int) {
-    uint32_t days = ::utils::days_between_dates(departure_date, return_date);
-    info.stay_days = days > UINT8_MAX ? UINT8_MAX : days;
-  } else {
-    info.stay_days = UINT8_MAX;
-  }
+  info.data.page_id = result.page_id;
+  info.data.index = result.index;
+  info.data.size = result.size;
 
   // 2) Add deal to index, with data position information
   auto di_result = db_index->addRecord(&info);
@@ -260,7 +732,11 @@ bool DealsDatabase::addDeal(std::string origin, std::string destination, std::st
     return false;
   }
 
-  // std::cout << "{" << result.page_name << "}" << std::endl;
+  if (insert_log != nullptr) {
+    log_added();
+  }
+
+  // std::cout << "{" << result.page_id << "}" << std::endl;
   // std::cout << "{" << result.index << "}" << std::endl;
   // std::cout << "{" << result.size << "}" << std::endl;
   // std::cout << "{" << result.error << "}" << std::endl;
@@ -268,24 +744,205 @@ bool DealsDatabase::addDeal(std::string origin, std::string destination, std::st
   return true;
 }
 
+//---------------------------------------------------------
+//  DealsDatabase  addDeals
+//---------------------------------------------------------
+// batch version of addDeal: data and index records of all deals are
+// reserved with one lock acquisition per table.
+// every stored deal is logged, even if others failed
+bool DealsDatabase::addDeals(const std::vector<DealInfo> &deals, std::vector<bool> *added) {
+  std::vector<bool> stored;
+  bool good = insert_deals(deals, false, stored);
+
+  if (insert_log != nullptr) {
+    uint32_t current_time = timing::getTimestampSec();
+    for (size_t idx = 0; idx < deals.size(); ++idx) {
+      if (stored[idx]) {
+        DealInfo deal = deals[idx];
+        deal.timestamp = current_time;
+        log_deal(deal);
+      }
+    }
+  }
+
+  if (added != nullptr) {
+    added->swap(stored);
+  }
+  return good;
+}
+
+//---------------------------------------------------------
+//  DealsDatabase  insert_deals
+//---------------------------------------------------------
+bool DealsDatabase::insert_deals(const std::vector<DealInfo> &deals, bool keep_timestamps,
+                                 std::vector<bool> &added) {
+  added.assign(deals.size(), false);
+  std::vector<i::DealInfo> infos(deals.size());
+  std::vector<std::string> payloads(deals.size());
+  std::vector<shared_mem::RecordsBatchItem<i::DealData>> data_batch;
+  data_batch.reserve(deals.size());
+
+  for (size_t idx = 0; idx < deals.size(); ++idx) {
+    const DealInfo &deal = deals[idx];
+    if (!make_deal_info(deal.origin, deal.destination, deal.departure_date, deal.return_date,
+                        deal.flags.direct, deal.price, infos[idx])) {
+      return false;
+    }
+    if (keep_timestamps) {
+      infos[idx].timestamp = deal.timestamp;
+    }
+    payloads[idx] = payload_codec != nullptr ? payload_codec->compress(deal.data) : deal.data;
+    if (payloads[idx].length() > DEALDATA_MAX_SIZE) {
+      std::cout << "too big data size:" << payloads[idx].length() << std::endl;
+      return false;
+    }
+    data_batch.push_back({(i::DealData *)payloads[idx].c_str(), (uint32_t)payloads[idx].length()});
+  }
+
+  // deals with data in DealsInfo pages
+  if (db_data == nullptr) {
+    std::vector<shared_mem::RecordsBatchItem<i::DealInfo>> inline_batch;
+    inline_batch.reserve(deals.size());
+    for (size_t idx = 0; idx < deals.size(); ++idx) {
+      inline_batch.push_back({&infos[idx], 1, data_batch[idx].records, data_batch[idx].count});
+    }
+
+    bool good = true;
+    auto di_results = db_index->addRecords(inline_batch);
+    for (size_t idx = 0; idx < deals.size(); ++idx) {
+      if (di_results[idx].error != shared_mem::ErrorCode::NO_ERROR) {
+        std::cout << "ERROR DealsDatabase::insert_deals inline:" << (int)di_results[idx].error
+                  << std::endl;
+        good = false;
+        continue;
+      }
+      added[idx] = true;
+    }
+    return good;
+  }
+
+  // 1) Add data of all deals
+  auto data_result = db_data->addRecords(data_batch);
+
+  // 2) Add deals with data position information to index
+  std::vector<shared_mem::RecordsBatchItem<i::DealInfo>> index_batch;
+  std::vector<size_t> index_deals;  // deal of index_batch entry
+  index_batch.reserve(deals.size());
+  index_deals.reserve(deals.size());
+
+  bool good = true;
+  for (size_t idx = 0; idx < deals.size(); ++idx) {
+    if (data_result[idx].error != shared_mem::ErrorCode::NO_ERROR) {
+      std::cout << "ERROR DealsDatabase::insert_deals 1:" << (int)data_result[idx].error
+                << std::endl;
+      good = false;
+      continue;
+    }
+    infos[idx].data.page_id = data_result[idx].page_id;
+    infos[idx].data.index = data_result[idx].index;
+    infos[idx].data.size = data_result[idx].size;
+    index_batch.push_back({&infos[idx], 1});
+    index_deals.push_back(idx);
+  }
+
+  auto di_results = db_index->addRecords(index_batch);
+  for (size_t idx = 0; idx < index_batch.size(); ++idx) {
+    if (di_results[idx].error != shared_mem::ErrorCode::NO_ERROR) {
+      std::cout << "ERROR DealsDatabase::insert_deals 2:" << (int)di_results[idx].error
+                << std::endl;
+      good = false;
+      continue;
+    }
+    added[index_deals[idx]] = true;
+  }
+
+  return good;
+}
+
+//---------------------------------------------------------
+//  DealsDatabase  make_deal_info
+//---------------------------------------------------------
+// index record without data position
+bool DealsDatabase::make_deal_info(const std::string &origin, const std::string &destination,
+                                   const std::string &departure_date,
+                                   const std::string &return_date, bool direct_flight,
+                                   uint32_t price, i::DealInfo &info) {
+  // key fields are compared as bytes (DEALINFO_UPSERT_BUCKETS), flags have padding bits
+  std::memset(&info, 0, sizeof(info));
+
+  uint16_t origin_code = query::origin_to_code(origin);
+  if (origin_code == 0) {
+    std::cout << "wrong origin:" << origin << std::endl;
+    return false;
+  }
+
+  uint16_t destination_code = query::origin_to_code(destination);
+  if (destination_code == 0) {
+    std::cout << "wrong destination:" << destination << std::endl;
+    return false;
+  }
+
+  uint16_t departure_days = query::date_to_days(departure_date);
+  if (departure_days == 0) {
+    std::cout << "wrong departure date:" << departure_date << std::endl;
+    return false;
+  }
+
+  uint16_t return_days = query::date_to_days(return_date);
+
+  info.timestamp = timing::getTimestampSec();
+  info.origin = origin_code;
+  info.destination = destination_code;
+  info.departure_date = departure_days;
+  info.return_date = return_days;
+  info.flags.overriden = false;
+  info.flags.direct = direct_flight;
+  info.flags.departure_day_of_week = query::day_of_week(departure_days);
+  info.flags.return_day_of_week = return_days ? query::day_of_week(return_days) : 7;
+  info.price = price;
+
+  if (return_days && return_days >= departure_days) {
+    uint32_t days = return_days - departure_days;
+    info.stay_days = days > UINT8_MAX ? UINT8_MAX : days;
+  } else {
+    info.stay_days = UINT8_MAX;
+  }
+
+  return true;
+}
+
 /*---------------------------------------------------------
 * DealsDatabase  fill_deals_with_data
 *---------------------------------------------------------*/
 std::vector<DealInfo> DealsDatabase::fill_deals_with_data(std::vector<i::DealInfo> i_deals) {
-  // internal <i::DealInfo> contain shared memory page name and
+  // internal <i::DealInfo> contain shared memory page id and
   // information offsets. It's not useful anywhere outside
   // Let's transform internal format to external <DealInfo>
   std::vector<DealInfo> result;
 
   for (const auto &deal : i_deals) {
-    auto deal_data =
-        shared_mem::ElementPointer<i::DealData>{*db_data, deal.page_name, deal.index, deal.size};
-    auto data_pointer = deal_data.get_data();
-    std::string data = {(char *)data_pointer, deal.size};
+    std::string data;
+    if (db_data == nullptr) {
+      // DEALINFO_INLINE_DATA: payload is in the same DealsInfo page
+      uint32_t data_size = 0;
+      const uint8_t *data_pointer = db_index->getPayload(deal.payload, data_size);
+      if (data_pointer != nullptr) {
+        data.assign((const char *)data_pointer, data_size);
+      }
+    } else {
+      auto deal_data = shared_mem::ElementPointer<i::DealData>{
+          *db_data, (uint16_t)deal.data.page_id, (uint32_t)deal.data.index,
+          (uint32_t)deal.data.size};
+      auto data_pointer = deal_data.get_data();
+      data = {(char *)data_pointer, deal_data.size};
+    }
+    if (payload_codec != nullptr) {
+      data = payload_codec->decompress(data);
+    }
 
     result.push_back((DealInfo){
         deal.timestamp, query::code_to_origin(deal.origin), query::code_to_origin(deal.destination),
-        query::int_to_date(deal.departure_date), query::int_to_date(deal.return_date),
+        query::days_to_date(deal.departure_date), query::days_to_date(deal.return_date),
         deal.stay_days, deal.flags, deal.price, data});
   }
 
@@ -315,6 +972,9 @@ std::vector<DealInfo> DealsDatabase::searchForCheapest(
                       stay_from, stay_to, direct_flights, price_from, price_to, limit,
                       max_lifetime_sec, roundtrip_flights);
 
+  // found deals refer to pages, they must stay until data is copied
+  shared_mem::TableReadGuard<i::DealInfo> index_guard(db_index);
+  shared_mem::TableReadGuard<i::DealData> data_guard(db_data);
   query.execute();
 
   // load deals data from data pages (DealData shared memory pagers)
@@ -402,6 +1062,9 @@ std::vector<DealInfo> DealsDatabase::searchForCheapestDayByDay(
                       stay_from, stay_to, direct_flights, price_from, price_to, limit,
                       max_lifetime_sec, roundtrip_flights);
 
+  // found deals refer to pages, they must stay until data is copied
+  shared_mem::TableReadGuard<i::DealInfo> index_guard(db_index);
+  shared_mem::TableReadGuard<i::DealData> data_guard(db_data);
   query.execute();
 
   std::vector<DealInfo> result = fill_deals_with_data(query.exec_result);
@@ -438,9 +1101,12 @@ void DealsCheapestDayByDay::pre_search() {
 //---------------------------------------------------------
 void DealsCheapestDayByDay::process_deal(const i::DealInfo &deal) {
   auto &dst_dates = grouped_destinations_and_dates[deal.destination];
-  auto &dst_deal = dst_dates[deal.departure_date];
+  if (dst_dates.empty()) {
+    dst_dates.resize(departure_date_values.duration);
+  }
+  auto &dst_deal = dst_dates[deal.departure_date - departure_date_values.from];
 
-  if (dst_deal.price == 0 || dst_deal.price >= deal.price) {
+  if (dst_deal.timestamp == 0 || dst_deal.price >= deal.price) {
     dst_deal = deal;
   }
   // if  not cheaper but same dates, replace with newer results
@@ -458,7 +1124,11 @@ void DealsCheapestDayByDay::post_search() {
   // process results
   for (const auto &dates : grouped_destinations_and_dates) {
     for (const auto &deal : dates.second) {
-      exec_result.push_back(deal.second);
+      // empty day slot
+      if (deal.timestamp == 0) {
+        continue;
+      }
+      exec_result.push_back(deal);
     }
   }
 
@@ -468,15 +1138,58 @@ void DealsCheapestDayByDay::post_search() {
   });
 }
 
+//----------------------------------------------------------------
+// parse_size_info_blocks
+//----------------------------------------------------------------
+// 14;80;121;75;45;{params}{data}{params}{data}
+// ↑  size_info block length, then length of every block
+std::vector<std::string> parse_size_info_blocks(const std::string &body) {
+  auto is_number = [](const std::string &text) {
+    return !text.empty() && text.size() < 10 &&
+           text.find_first_not_of("0123456789") == std::string::npos;
+  };
+
+  size_t size_info_len = body.find(';') + 1;
+  if (size_info_len == 0 || !is_number(body.substr(0, size_info_len - 1))) {
+    throw RequestError("Bad size_info");
+  }
+  size_info_len = std::stoul(body);
+  if (size_info_len == 0 || size_info_len > body.length() || body[size_info_len - 1] != ';') {
+    throw RequestError("Bad size_info");
+  }
+
+  // first value is size_info length itself
+  std::vector<std::string> sizes = ::utils::split_string(body.substr(0, size_info_len - 1), ";");
+  std::vector<std::string> blocks;
+  size_t offset = size_info_len;
+
+  for (size_t idx = 1; idx < sizes.size(); ++idx) {
+    if (!is_number(sizes[idx])) {
+      throw RequestError("Bad size_info");
+    }
+    size_t block_len = std::stoul(sizes[idx]);
+    if (block_len > body.length() - offset) {
+      throw RequestError("Bad block size");
+    }
+    blocks.push_back(body.substr(offset, block_len));
+    offset += block_len;
+  }
+
+  if (offset != body.length()) {
+    throw RequestError("Bad block size");
+  }
+  return blocks;
+}
+
 //***********************************************************
 //                   UTILS
 //***********************************************************
 namespace utils {
 void print(const i::DealInfo &deal) {
-  std::cout << "i::DEAL: (" << query::int_to_date(deal.departure_date) << ")"
+  std::cout << "i::DEAL: (" << query::days_to_date(deal.departure_date) << ")"
             << query::code_to_origin(deal.origin) << "-" << query::code_to_origin(deal.destination)
-            << "(" << query::int_to_date(deal.return_date) << ") : " << deal.price << " "
-            << deal.page_name << ":" << deal.index << std::endl;
+            << "(" << query::days_to_date(deal.return_date) << ") : " << deal.price << " "
+            << deal.data.page_id << ":" << deal.data.index << std::endl;
 }
 void print(const DealInfo &deal) {
   std::cout << "DEAL: (" << deal.departure_date << ")" << deal.origin << "-" << deal.destination
@@ -493,6 +1206,13 @@ std::string sprint(const DealInfo &deal) {
 //------------------------------------------------------------------------
 // TESTING:
 //------------------------------------------------------------------------
+// reboot: shared memory of table is lost
+void drop_shared_memory(const std::string &table) {
+  for (const char *suffix : {"", ":header", ":dedup", ":upsert", ":keys", ":arena"}) {
+    shm_unlink((table + suffix).c_str());
+  }
+}
+
 std::string getRandomOrigin() {
   static const std::string origins[] = {"MOW", "MAD", "BER", "LON", "PAR",
                                         "LAX", "LED", "FRA", "BAR"};
@@ -514,7 +1234,8 @@ std::string getRandomDate(uint32_t year = 2016) {
   uint32_t month = (rand() & 0x00000003) + (rand() & 0x00000003) + (rand() & 0x00000003) + 1;
   uint32_t day = (rand() & 0x00000007) + (rand() & 0x00000007) + (rand() & 0x00000007) + 1;
 
-  return query::int_to_date(year * 10000 + month * 100 + day);
+  return std::to_string(year) + "-" + (month < 10 ? "0" : "") + std::to_string(month) + "-" +
+         (day < 10 ? "0" : "") + std::to_string(day);
 }
 
 void convertertionsTest() {
@@ -522,10 +1243,15 @@ void convertertionsTest() {
   std::string origins[10] = {"MOW", "MAD", "BER", "PAR", "LON", "FRA", "VKO", "JFK", "LAX", "MEX"};
 
   for (int i = 0; i < 10; ++i) {
-    uint32_t code = query::origin_to_code(origins[i]);
+    uint16_t code = query::origin_to_code(origins[i]);
     std::string decode = query::code_to_origin(code);
     assert(origins[i] == decode);
   }
+  assert(query::origin_to_code("000") == 1);
+  assert(query::origin_to_code("ZZZ") == 36 * 36 * 36);
+  assert(query::origin_to_code("M0W") != 0);
+  assert(query::origin_to_code("M-W") == 0);
+  assert(query::origin_to_code("MOWW") == 0);
 
   std::cout << "Locale encoder/decoder" << std::endl;
   std::string locales[] = {"ru", "de", "uk", "ua", "us"};
@@ -537,11 +1263,19 @@ void convertertionsTest() {
   }
 
   std::cout << "Date encoder/decoder\n";
-  uint32_t code = query::date_to_int("2017-01-01");
-  std::string date = query::int_to_date(code);
+  uint16_t code = query::date_to_days("2017-01-01");
+  std::string date = query::days_to_date(code);
 
-  assert(code == 20170101);
+  assert(code == 17167);
   assert(date == "2017-01-01");
+  assert(query::days_to_date(query::date_to_days("2016-02-29")) == "2016-02-29");
+  assert(query::date_to_days("2016-03-01") - query::date_to_days("2016-02-28") == 2);
+  assert(query::date_to_days("2016-13-01") == 0);
+  assert(query::date_to_days("2016-1a-01") == 0);
+  assert(query::date_to_days("") == 0);
+  assert(query::day_of_week(query::date_to_days("2016-06-25")) == 5);
+  assert(query::day_of_week(query::date_to_days("2016-04-13")) == 2);
+  assert(query::day_of_week(query::date_to_days("2017-01-02")) == 0);
 }
 
 #define TEST_ELEMENTS_COUNT 50000
@@ -678,10 +1412,10 @@ void unit_test() {
   int city_count2[3] = {0, 0, 0};
 
   for (int i = 0; i < result.size(); ++i) {
-    assert(query::date_to_int(result[i].departure_date) >= query::date_to_int("2016-06-01"));
-    assert(query::date_to_int(result[i].departure_date) <= query::date_to_int("2016-06-23"));
-    assert(query::date_to_int(result[i].return_date) >= query::date_to_int("2016-06-10"));
-    assert(query::date_to_int(result[i].return_date) <= query::date_to_int("2016-06-22"));
+    assert(query::date_to_days(result[i].departure_date) >= query::date_to_days("2016-06-01"));
+    assert(query::date_to_days(result[i].departure_date) <= query::date_to_days("2016-06-23"));
+    assert(query::date_to_days(result[i].return_date) >= query::date_to_days("2016-06-10"));
+    assert(query::date_to_days(result[i].return_date) <= query::date_to_days("2016-06-22"));
 
     if (result[i].destination == "MAD") {
       city_count2[0]++;
@@ -747,6 +1481,117 @@ void unit_test() {
     assert(rw == "sat" || rw == "sun" || rw == "mon");
   }
 
+  // 4th test: batch insert -------------------------------
+  // *********************************************************
+  std::vector<DealInfo> batch;
+  Flags direct_flags = {true, false, 0, 0};
+  batch.push_back({0, "SVX", "ROM", "2016-08-01", "2016-08-10", 0, direct_flags, 4000, "r1"});
+  batch.push_back({0, "SVX", "ROM", "2016-08-02", "", 0, direct_flags, 3000, "r2"});
+  batch.push_back({0, "SVX", "OSL", "2016-08-03", "2016-08-05", 0, direct_flags, 2000, "o1"});
+  assert(db.addDeals(batch));
+
+  // wrong origin rejects whole batch
+  batch.push_back({0, "S", "OSL", "2016-08-03", "", 0, direct_flags, 2000, "bad"});
+  assert(db.addDeals(batch) == false);
+
+  result = db.searchForCheapest("SVX", "", "", "", "", "", "", "", 0, 0,
+                                ::utils::Threelean::Undefined, 0, 0, 0, 10,
+                                ::utils::Threelean::Undefined);
+  assert(result.size() == 2);
+  for (auto &deal : result) {
+    if (deal.destination == "ROM") {
+      assert(deal.price == 3000 && deal.data == "r2" && deal.return_date == "");
+    } else {
+      assert(deal.destination == "OSL" && deal.price == 2000 && deal.data == "o1");
+      assert(deal.stay_days == 2);
+    }
+  }
+
+  // framing of batch request body
+  std::vector<std::string> blocks = parse_size_info_blocks("8;3;0;2;abcde");
+  assert(blocks.size() == 3 && blocks[0] == "abc" && blocks[1] == "" && blocks[2] == "de");
+  assert(parse_size_info_blocks("2;").empty());
+  // bad numbers, truncated or too long body, lengths past the end
+  for (const char *bad : {"", ";", "0;", "x;1;a", "3;1;a", "9;1;2;", "7;1;-1;a", "7;1; 1;ab",
+                          "6;1;2;a", "6;2;1;abcd", "15;1;999999999;ab", "17;1;99999999999;ab"}) {
+    bool thrown = false;
+    try {
+      parse_size_info_blocks(bad);
+    } catch (const RequestError &error) {
+      thrown = true;
+    }
+    assert(thrown);
+  }
+
+  // 5th test: insert log replay -------------------------------
+  // *********************************************************
+  std::string log_file = "/tmp/deals_test.wal";
+  unlink(log_file.c_str());
+  assert(db.openLog(log_file));
+  batch.pop_back();
+  assert(db.addDeals(batch));
+  assert(db.addDeal("MOW", "PAR", "2016-09-01", "2016-09-04", true, 5000, "paris"));
+  db.syncLog(true);
+
+  // shared memory is lost (reboot): new database gets new one
+  db.db_index->cleanup();
+  if (db.db_data != nullptr) {
+    db.db_data->cleanup();
+  }
+  drop_shared_memory(DEALINFO_TABLENAME);
+  drop_shared_memory(DEALDATA_TABLENAME);
+  delete db.insert_log;
+  db.insert_log = nullptr;
+  DealsDatabase rebooted;
+  assert(rebooted.isEmpty());
+  assert(rebooted.openLog(log_file));
+
+  auto search_all = [](DealsDatabase &database) {
+    return database.searchForCheapest("", "", "", "", "", "", "", "", 0, 0,
+                                      ::utils::Threelean::Undefined, 0, 0, 0, 10,
+                                      ::utils::Threelean::Undefined);
+  };
+  result = search_all(rebooted);
+  assert(result.size() == 3);
+  for (auto &deal : result) {
+    if (deal.destination == "PAR") {
+      assert(deal.origin == "MOW" && deal.data == "paris" && deal.flags.direct);
+      assert(deal.stay_days == 3 && deal.return_date == "2016-09-04");
+    } else if (deal.destination == "ROM") {
+      assert(deal.price == 3000 && deal.data == "r2");
+    }
+  }
+
+  // deals cleared by other process are not replayed after next reboot,
+  // replayed ones are (they are not in any snapshot)
+  assert(rebooted.addDeal("MOW", "BER", "2016-09-02", "", true, 7000, "berlin"));
+  rebooted.syncLog(true);
+  {
+    DealsDatabase other;
+    other.truncate();
+  }
+  rebooted.syncLog(true);
+  delete rebooted.insert_log;
+  rebooted.insert_log = nullptr;
+  drop_shared_memory(DEALINFO_TABLENAME);
+  drop_shared_memory(DEALDATA_TABLENAME);
+
+  DealsDatabase rebooted_again;
+  assert(rebooted_again.openLog(log_file));
+  result = search_all(rebooted_again);
+  assert(result.size() == 3);
+  for (auto &deal : result) {
+    assert(deal.destination != "BER");
+  }
+
+  // log is cleared with database
+  rebooted_again.truncate();
+  assert(rebooted_again.openLog(log_file));
+  assert(rebooted_again.isEmpty());
+  delete rebooted_again.insert_log;
+  rebooted_again.insert_log = nullptr;
+  unlink(log_file.c_str());
+
   std::cout << "OK" << std::endl;
 }
 
@@ -2,9 +2,11 @@
 #define SRC_DEALS_HPP
 
 #include <unordered_map>
+#include "payload_codec.hpp"
 #include "search_query.hpp"
 #include "shared_memory.hpp"
 #include "utils.hpp"
+#include "write_ahead_log.hpp"
 
 namespace deals {
 
@@ -13,10 +15,53 @@ namespace deals {
 #define DEALINFO_TABLENAME "DealsInfo"
 #define DEALINFO_PAGES 5000
 #define DEALINFO_ELEMENTS 10000
-
+#define DEALINFO_PAGE_FORMAT shared_mem::PageFormat::COLUMNS
+#define DEALINFO_STORAGE shared_mem::StorageMode::ARENA
+#define DEALINFO_SPARE_PAGES 1
+// worker processes insert into own tail pages (TableOptions::tail_shards),
+// script/deals.sh starts 8 of them
+#define DEALINFO_TAIL_SHARDS 8
+// page expiry in background thread, not in search & insert requests
+#define DEALINFO_MAINTENANCE_THREAD true
+// deal payload is stored in DealsInfo page extent instead of DealsData table,
+// deal and its payload are added with one insert and expire together.
+// pages are split by payload size (i::deal_info_extent_classes)
+#define DEALINFO_INLINE_DATA true
+#define DEALINFO_PAGE_EXTENT (32 << 20)
+// pages with extent are backed by huge pages (TableOptions::huge_pages)
+#define DEALINFO_HUGE_PAGES true
+// identical payloads are stored once (TableOptions::dedup_buckets), 0 - disabled
+#define DEALINFO_DEDUP_BUCKETS (1 << 20)
+// latest deal replaces previous ones with the same route, dates and direct flag
+// (i::deal_info_upsert_key), 0 - disabled: all deals are kept and
+// DealsCheapestByDatesSimple picks the latest one ("overriden" flag).
+// 8m buckets (64mb), for up to ~4m live routes & dates
+#define DEALINFO_UPSERT_BUCKETS (1 << 23)
+
+// DealsData table keeps payloads only if DEALINFO_INLINE_DATA is false,
+// DEALINFO_* extent options apply otherwise
 #define DEALDATA_TABLENAME "DealsData"
 #define DEALDATA_PAGES 10000
 #define DEALDATA_ELEMENTS 50000000
+#define DEALDATA_STORAGE shared_mem::StorageMode::ARENA
+#define DEALDATA_HUGE_PAGES true
+#define DEALDATA_SPARE_PAGES 1
+#define DEALDATA_TAIL_SHARDS 8
+#define DEALDATA_MAINTENANCE_THREAD true
+// payloads are placed into fixed size slots (see i::deal_data_size_classes)
+#define DEALDATA_SIZE_CLASSES true
+#define DEALDATA_DEDUP_BUCKETS (1 << 20)
+
+// deal payloads are compressed with shared dictionary (codec::DictionaryCodec)
+#define DEALS_PAYLOAD_COMPRESSION true
+#define DEALS_DICTIONARY_NAME "DealsDict"
+// dictionary slot is reused after CODEC_DICT_SLOTS trainings, it must outlive deals
+#define DEALS_DICTIONARY_TRAIN_INTERVAL (DEALS_EXPIRES / (CODEC_DICT_SLOTS - 2))
+// deals from insert log are added by batches of this size (DealsDatabase::openLog)
+#define DEALS_LOG_REPLAY_BATCH 1000
+// insert log records: added deal, or shared_mem::TableVersion of deals logged after it
+#define DEALS_LOG_DEAL 'D'
+#define DEALS_LOG_VERSION 'V'
 
 void unit_test();
 
@@ -28,21 +73,73 @@ struct Flags {
 };
 
 namespace i {
+// deal payload position in DealsData table
+struct DataRef {
+  uint64_t page_id : 14;
+  uint64_t index : 26;
+  uint64_t size : 24;
+};
+static_assert(DEALDATA_PAGES <= (1 << 14), "DataRef::page_id TOO SMALL FOR DEALDATA_PAGES");
+static_assert(DEALDATA_ELEMENTS <= (1 << 26), "DataRef::index TOO SMALL FOR DEALDATA_ELEMENTS");
+#define DEALDATA_MAX_SIZE ((1 << 24) - 1)
+
+// record format v2: 32 bytes, two records per cache line
+// dates are days since 1970-01-01, see query::date_to_days
 struct DealInfo {
   uint32_t timestamp;
-  uint32_t origin;
-  uint32_t destination;
-  uint32_t departure_date;
-  uint32_t return_date;
+  uint16_t departure_date;
+  uint16_t return_date;
+  uint32_t price;
+  uint16_t origin;
+  uint16_t destination;
   uint8_t stay_days;
   Flags flags;
-  uint32_t price;
-  char page_name[MEMPAGE_NAME_MAX_LEN];
-  uint32_t index;
-  uint32_t size;
+  union {
+    DataRef data;                  // DealsData table
+    shared_mem::PayloadRef payload;  // DEALINFO_INLINE_DATA
+  };
+};
+static_assert(sizeof(DealInfo) == 32, "DealInfo v2 MUST BE 32 BYTES");
+
+// DealsInfo page columns (PageFormat::COLUMNS)
+// order matters: fields checked first by DealsSearchQuery::process_page go first
+enum DealInfoColumn : uint16_t {
+  TIMESTAMP = 0,
+  ORIGIN,
+  DESTINATION,
+  PRICE,
+  DEPARTURE_DATE,
+  RETURN_DATE,
+  STAY_DAYS,
+  FLAGS,
+  DATA
 };
+std::vector<shared_mem::ColumnInfo> deal_info_columns();
+
+// DealsInfo page zone maps, used by DealsSearchQuery to skip pages
+enum DealInfoZone : uint16_t {
+  ZONE_TIMESTAMP = 0,
+  ZONE_DEPARTURE_DATE,
+  ZONE_RETURN_DATE,
+  ZONE_PRICE
+};
+std::vector<shared_mem::ColumnInfo> deal_info_zones();
+
+// DealsInfo page membership filters
+enum DealInfoKey : uint16_t { KEY_ORIGIN = 0, KEY_DESTINATION };
+std::vector<shared_mem::ColumnInfo> deal_info_keys();
+
+// DealsInfo record key for DEALINFO_UPSERT_BUCKETS
+// flags hold direct bit, day of week bits follow dates
+std::vector<shared_mem::ColumnInfo> deal_info_upsert_key();
 
 using DealData = uint8_t;  // aka char
+
+// DealsData slot sizes: 128, 192, 256, 384, ... x1.5 steps up to DEALDATA_MAX_SIZE
+std::vector<uint32_t> deal_data_size_classes();
+// DealsInfo page extent slot sizes (TableOptions::extent_classes), the same steps
+// up to DEALINFO_PAGE_EXTENT
+std::vector<uint32_t> deal_info_extent_classes();
 }  // namespace deals::i
 
 struct DealInfo {
@@ -73,6 +170,10 @@ class DealsDatabase {
 
   bool addDeal(std::string origin, std::string destination, std::string departure_date,
                std::string return_date, bool direct_flight, uint32_t price, std::string data);
+  // add many deals at once (timestamp and stay_days of deals are ignored).
+  // false if any deal was not added: bad deal rejects whole batch, storage errors
+  // fail only some deals, added - which ones were added (and logged)
+  bool addDeals(const std::vector<DealInfo>& deals, std::vector<bool>* added = nullptr);
 
   // find cheapest by selected filters
   std::vector<DealInfo> searchForCheapest(
@@ -92,14 +193,52 @@ class DealsDatabase {
       uint32_t price_to, uint16_t limit, uint32_t max_lifetime_sec,
       ::utils::Threelean roundtrip_flights);
 
-  // clear database
+  // clear database (and insert log)
   void truncate();
+  // nothing was inserted since truncate
+  bool isEmpty();
+  // see shared_mem::Table::lockStats
+  std::string lockStats();
+
+  // tables and dictionaries to files in directory, see shared_mem::Table::saveSnapshot
+  bool saveSnapshot(const std::string& directory);
+  // warm restart, only into empty database
+  bool loadSnapshot(const std::string& directory);
+
+  // added deals are written to log file (wal::WriteAheadLog). deals of existing log are
+  // added again (call it after loadSnapshot) if shared memory they were added to is lost
+  // and they are newer than loaded snapshot, expired or cleared ones are skipped.
+  // log is truncated by saveSnapshot and truncate
+  bool openLog(const std::string& file_name);
+  // group commit of logged deals, call it from event loop.
+  // force - commit now (before exit)
+  void syncLog(bool force = false);
+  // periodic payload dictionary training, call it from event loop
+  void trainPayloadCodec();
 
  private:
   std::vector<DealInfo> fill_deals_with_data(std::vector<i::DealInfo> i_deals);
+  bool make_deal_info(const std::string& origin, const std::string& destination,
+                      const std::string& departure_date, const std::string& return_date,
+                      bool direct_flight, uint32_t price, i::DealInfo& info);
+  // keep_timestamps: deals from log keep time they were added at.
+  // added - which deals were stored, all false if batch was rejected
+  bool insert_deals(const std::vector<DealInfo>& deals, bool keep_timestamps,
+                    std::vector<bool>& added);
+  // version record if table was cleaned up or recreated since the last one
+  void log_version_change();
+  void log_deal(const DealInfo& deal);
+  // deal (table version) as insert log record and back
+  static std::string log_record(const DealInfo& deal);
+  static bool parse_log_record(const std::string& record, DealInfo& deal);
+  static std::string version_record(const shared_mem::TableVersion& version);
+  static bool parse_version_record(const std::string& record, shared_mem::TableVersion& version);
 
   shared_mem::Table<i::DealInfo>* db_index;
-  shared_mem::Table<i::DealData>* db_data;
+  shared_mem::Table<i::DealData>* db_data = nullptr;  // not used with DEALINFO_INLINE_DATA
+  codec::DictionaryCodec* payload_codec = nullptr;      // DEALS_PAYLOAD_COMPRESSION
+  wal::WriteAheadLog* insert_log = nullptr;             // openLog
+  shared_mem::TableVersion log_version = {};            // of last version record in log
 
   friend void unit_test();
 };
@@ -123,6 +262,14 @@ class DealsSearchQuery : public shared_mem::TableProcessor<i::DealInfo>, public
   // function that will be called by TableProcessor
   // for iterating over all not expired pages in table
   void process_element(const i::DealInfo& element) final override;
+  // reads only filtered columns, loads whole element if it passed
+  void process_page(const shared_mem::PageView<i::DealInfo>& page) final override;
+  // skips pages which min/max can't match query
+  bool process_page_zones(const shared_mem::ZoneMap& zones) final override;
+  // skips pages without requested origin or destinations
+  bool process_page_keys(const shared_mem::KeyFilter& keys) final override;
+  // not expired and not older than timelimit
+  uint32_t min_timestamp() const;
 
   // VIRTUAL FUNCTIONS SECTION:
   virtual void process_deal(const i::DealInfo& deal) = 0;
@@ -150,7 +297,7 @@ class DealsCheapestByDatesSimple : public DealsSearchQuery {
   void pre_search() final override;
   void post_search() final override;
 
-  std::unordered_map<uint32_t, i::DealInfo> grouped_destinations;
+  std::unordered_map<uint16_t, i::DealInfo> grouped_destinations;
   std::vector<i::DealInfo> exec_result;
   uint32_t grouped_max_price = 0;
 };
@@ -168,8 +315,8 @@ class DealsCheapestDayByDay : public DealsSearchQuery {
   void pre_search() final override;
   void post_search() final override;
 
-  std::unordered_map<uint32_t, std::unordered_map<uint32_t, i::DealInfo>>
-      grouped_destinations_and_dates;
+  // deals indexed by departure day offset from departure_date_values.from
+  std::unordered_map<uint16_t, std::vector<i::DealInfo>> grouped_destinations_and_dates;
   std::vector<i::DealInfo> exec_result;
 };
 
@@ -185,6 +332,10 @@ class RequestError {
   const uint16_t code;
 };
 
+// blocks of body framed as /deals/top response: "<size_info length>;<block length>;...;"
+// followed by blocks. throws RequestError on bad lengths or truncated body
+std::vector<std::string> parse_size_info_blocks(const std::string& body);
+
 }  // namespace deals
 
 #endif
\ No newline at end of file
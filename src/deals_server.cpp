@@ -1,6 +1,10 @@
 #include <csignal>
 #include <fstream>
 
+#include <fcntl.h>
+#include <sys/file.h>
+#include <unistd.h>
+
 #include "deals_server.hpp"
 #include "locks.hpp"
 #include "timing.hpp"
@@ -55,6 +59,8 @@ void signalHandler(int signal) {
 //-----------------------------------------------------------
 void DealsServer::process() {
   uint16_t connections = srv::TCPServer<Context>::process();
+  db.syncLog();
+  db.trainPayloadCodec();
 
   // quit after all connections are closed
   if (gotQuitSignal) {
@@ -66,11 +72,59 @@ void DealsServer::process() {
     std::cout << "Waiting for connections... " << connections << std::endl;
     if (connections == 0) {
       std::cout << "No active connections -> quit!" << std::endl;
+      saveSnapshot();
+      db.syncLog(true);
       std::exit(0);
     }
   }
 }
 
+//-----------------------------------------------------------
+// DealsServer warm restart from snapshot
+//-----------------------------------------------------------
+void DealsServer::loadSnapshot() {
+  if (snapshot_directory.empty()) {
+    return;
+  }
+  timing::Timer timer("loadSnapshot");
+  // every process has its own log, deals of it are replayed if shared memory
+  // they were added to is lost (see DealsDatabase::openLog)
+  db.loadSnapshot(snapshot_directory);
+  db_dst.loadSnapshot(snapshot_directory);
+  if (!db.openLog(snapshot_directory + "/deals-" + std::to_string(port) + ".wal")) {
+    std::cerr << "ERROR DealsServer::loadSnapshot cannot open insert log" << std::endl;
+  }
+  timer.finish("loaded");
+}
+
+//-----------------------------------------------------------
+// DealsServer save snapshot
+//-----------------------------------------------------------
+bool DealsServer::saveSnapshot() {
+  if (snapshot_directory.empty()) {
+    return false;
+  }
+
+  // workers quit together: one of them saves shared tables, others keep their insert logs
+  std::string lock_name = snapshot_directory + "/snapshot.lock";
+  int fd = open(lock_name.c_str(), O_RDWR | O_CREAT, (mode_t)0644);
+  if (fd == -1) {
+    std::cerr << "ERROR DealsServer::saveSnapshot cannot open:" << lock_name << " errno:" << errno
+              << std::endl;
+    return false;
+  }
+  if (flock(fd, LOCK_EX | LOCK_NB) != 0) {
+    std::cout << "WARNING DealsServer::saveSnapshot other process is saving snapshot" << std::endl;
+    close(fd);
+    return false;
+  }
+
+  bool good = db.saveSnapshot(snapshot_directory);
+  good = db_dst.saveSnapshot(snapshot_directory) && good;
+  close(fd);
+  return good;
+}
+
 // --------------------------------------------------------
 // DealsServer on data
 //-----------------------------------------------------------
@@ -124,6 +178,22 @@ void DealsServer::on_data(Connection &conn) {
         return;
       }
       //--------
+      if (conn.context.http.request.query.path == "/snapshot") {
+        if (snapshot_directory.empty()) {
+          conn.close(http::HttpResponse(400, "No snapshot directory", "No snapshot directory\n"));
+        } else if (saveSnapshot()) {
+          conn.close(http::HttpResponse(200, "OK", "snapshot saved\n"));
+        } else {
+          conn.close(http::HttpResponse(500, "Internal Server Error", "snapshot failed\n"));
+        }
+        return;
+      }
+      //--------
+      if (conn.context.http.request.query.path == "/locks/stat") {
+        conn.close(http::HttpResponse(200, "OK", db.lockStats() + db_dst.lockStats()));
+        return;
+      }
+      //--------
       if (conn.context.http.request.query.path == "/ping") {
         http::HttpResponse response(200, "OK", "pong\n");
         conn.close(response);
@@ -162,6 +232,11 @@ void DealsServer::on_data(Connection &conn) {
         addDeal(conn);
         return;
       }
+
+      if (conn.context.http.request.query.path == "/deals/add_batch") {
+        addDealsBatch(conn);
+        return;
+      }
     }  //-------------------  'POST' END ----------------------
 
     // default response:
@@ -447,106 +522,172 @@ void DealsServer::getTop(Connection &conn) {
 // DealsServer addDeal
 //------------------------------------------------------------
 void DealsServer::addDeal(Connection &conn) {
+  std::string locale;
+  deals::DealInfo deal = parseDeal(conn.context.http.request.query.params, locale);
+
+  // read POST body (zipped deal json)
+  deal.data = conn.context.http.get_body();
+
+  // std::cout << "(add) dep:" << deal.departure_date << " from:" << deal.origin
+  //           << " to:" << deal.destination << " ret:" << deal.return_date
+  //           << " price:" << deal.price << std::endl;
+
+  // deals db
+  //---------------
+  bool good = db.addDeal(deal.origin, deal.destination, deal.departure_date, deal.return_date,
+                         deal.flags.direct, deal.price, deal.data);
+
+  if (!good) {
+    conn.close(http::HttpResponse(500, "Could not addDeal", "Could not addDeal\n"));
+    return;
+  }
+
+  // destinations db
+  //---------------
+  good = db_dst.addDestination(locale, deal.destination, deal.departure_date);
+
+  if (!good) {
+    conn.close(http::HttpResponse(500, "Could not addDestination", "Could not addDestination\n"));
+    return;
+  }
+
+  conn.close(http::HttpResponse(200, "OK", "Added\n"));
+}
+
+//------------------------------------------------------------
+// DealsServer addDealsBatch
+//------------------------------------------------------------
+void DealsServer::addDealsBatch(Connection &conn) {
+  //------------------------------------
+  // request body format (same framing as /deals/top response)
+  // <-  size_info  -><-          blocks             ->
+  // ↓ size_info block length
+  // 14;80;121;75;45;{params}{data}{params}{data}
+  //    ↑  ↑   ↑  ↑  params & data block length of every deal
+  // params block is query string of /deals/add: locale=ru&origin=MOW&...
+  // deals which could not be stored are listed in 500 response:
+  // "Added 2 of 4\nFailed 1;3\n" (deal indexes in request), the rest are added
+  std::vector<std::string> blocks = deals::parse_size_info_blocks(conn.context.http.get_body());
+  if (blocks.empty() || blocks.size() % 2 != 0) {
+    throw deals::RequestError("Bad size_info");
+  }
+
+  std::vector<deals::DealInfo> deals;
+  std::vector<std::string> locales;
+
+  for (size_t idx = 0; idx < blocks.size(); idx += 2) {
+    http::URIQueryParams params;
+    params.parse("?" + blocks[idx]);
+
+    std::string locale;
+    deals.push_back(parseDeal(params.params, locale));
+    deals.back().data = blocks[idx + 1];
+    locales.push_back(locale);
+  }
+
+  // deals db
+  //---------------
+  std::vector<bool> added;
+  bool good = db.addDeals(deals, &added);
+
+  // destinations db, for added deals only
+  //---------------
+  std::vector<top::DstRecord> destinations;
+  std::string failed;
+  for (size_t idx = 0; idx < deals.size(); ++idx) {
+    if (!added[idx]) {
+      failed += (failed.empty() ? "" : ";") + std::to_string(idx);
+      continue;
+    }
+    destinations.push_back({locales[idx], deals[idx].destination, deals[idx].departure_date});
+  }
+  bool good_dst = db_dst.addDestinations(destinations);
+
+  std::string text = "Added " + std::to_string(destinations.size());
+  if (!good) {
+    conn.close(http::HttpResponse(500, "Could not addDeals",
+                                  text + " of " + std::to_string(deals.size()) + "\nFailed " +
+                                      failed + "\n"));
+    return;
+  }
+  if (!good_dst) {
+    conn.close(
+        http::HttpResponse(500, "Could not addDestination", "Could not addDestination\n"));
+    return;
+  }
+
+  conn.close(http::HttpResponse(200, "OK", text + "\n"));
+}
+
+//------------------------------------------------------------
+// DealsServer parseDeal
+//------------------------------------------------------------
+// checks /deals/add params, throws deals::RequestError on bad one
+deals::DealInfo DealsServer::parseDeal(utils::ObjectMap &params, std::string &locale) {
+  deals::DealInfo deal = {};
+
   // locale
   //------------
-  std::string locale = utils::toLowerCase(conn.context.http.request.query.params["locale"]);
+  locale = utils::toLowerCase(params["locale"]);
   if (locale.length() != 2) {
-    conn.close(http::HttpResponse(400, "Bad locale", "Bad locale"));
-    return;
+    throw deals::RequestError("Bad locale");
   }
 
   // origin
   //------------
-  std::string origin = utils::toUpperCase(conn.context.http.request.query.params["origin"]);
-  if (origin.length() != 3) {
-    conn.close(http::HttpResponse(400, "Bad origin", "Bad origin"));
-    return;
+  deal.origin = utils::toUpperCase(params["origin"]);
+  if (query::origin_to_code(deal.origin) == 0) {
+    throw deals::RequestError("Bad origin");
   }
 
   // destinations
   //-------------
-  std::string destination =
-      utils::toUpperCase(conn.context.http.request.query.params["destination"]);
-  if (destination.length() != 3) {
-    conn.close(http::HttpResponse(400, "Bad destination", "Bad destination"));
-    return;
+  deal.destination = utils::toUpperCase(params["destination"]);
+  if (query::origin_to_code(deal.destination) == 0) {
+    throw deals::RequestError("Bad destination");
   }
 
-  if (origin == destination) {
-    conn.close(http::HttpResponse(400, "Bad origin eq destination", "Bad origin eq destination"));
-    return;
+  if (deal.origin == deal.destination) {
+    throw deals::RequestError("Bad origin eq destination");
   }
 
   // price
   //-------------
-  uint32_t price = 0;
   try {
-    price = std::stol(conn.context.http.request.query.params["price"]);
+    deal.price = std::stol(params["price"]);
   } catch (...) {
-    conn.close(http::HttpResponse(400, "Bad price", "Bad price"));
-    return;
+    throw deals::RequestError("Bad price");
   }
 
   // direct_flight
   //-------------
-  std::string direct_flight_str =
-      utils::toLowerCase(conn.context.http.request.query.params["direct_flight"]);
+  std::string direct_flight_str = utils::toLowerCase(params["direct_flight"]);
   if (direct_flight_str != "true" && direct_flight_str != "false") {
-    conn.close(http::HttpResponse(400, "Bad direct_flight", "Bad direct_flight"));
-    return;
+    throw deals::RequestError("Bad direct_flight");
   }
-  bool direct_flight = direct_flight_str == "true";
+  deal.flags.direct = direct_flight_str == "true";
 
   // departure_date
   //-------------
-  std::string departure_date = conn.context.http.request.query.params["departure_date"];
-  if (query::date_to_int(departure_date) == 0) {
-    conn.close(http::HttpResponse(400, "Bad departure_date", "Bad departure_date"));
-    return;
+  deal.departure_date = params["departure_date"];
+  if (query::date_to_days(deal.departure_date) == 0) {
+    throw deals::RequestError("Bad departure_date");
   }
 
   // return_date
   //-------------
-  std::string return_date = conn.context.http.request.query.params["return_date"];
-  if (return_date.length() > 0) {
-    if (query::date_to_int(return_date) == 0) {
-      conn.close(http::HttpResponse(400, "Bad return_date", "Bad return_date"));
-      return;
+  deal.return_date = params["return_date"];
+  if (deal.return_date.length() > 0) {
+    if (query::date_to_days(deal.return_date) == 0) {
+      throw deals::RequestError("Bad return_date");
     }
   }
 
-  if (!query::check_date_to_date(departure_date, return_date)) {
-    conn.close(http::HttpResponse(400, "Bad date parameters", "Bad date parameters\n"));
-    return;
-  }
-
-  // read POST body (zipped deal json)
-  std::string data = conn.context.http.get_body();
-
-  // std::cout << "(add) dep:" << departure_date << " from:" << origin
-  //           << " to:" << destination << " ret:" << return_date
-  //           << " price:" << price << std::endl;
-
-  // deals db
-  //---------------
-  bool good =
-      db.addDeal(origin, destination, departure_date, return_date, direct_flight, price, data);
-
-  if (!good) {
-    conn.close(http::HttpResponse(500, "Could not addDeal", "Could not addDeal\n"));
-    return;
-  }
-
-  // destinations db
-  //---------------
-  good = db_dst.addDestination(locale, destination, departure_date);
-
-  if (!good) {
-    conn.close(http::HttpResponse(500, "Could not addDestination", "Could not addDestination\n"));
-    return;
+  if (!query::check_date_to_date(deal.departure_date, deal.return_date)) {
+    throw deals::RequestError("Bad date parameters\n");
   }
 
-  conn.close(http::HttpResponse(200, "OK", "Added\n"));
+  return deal;
 }
 
 /*---------------------------------------------------------
@@ -640,14 +781,10 @@ int main(int argc, char *argv[]) {
   if (argc > 1 && std::string(argv[1]) == "test") {
     std::cout << "running autotests..." << std::endl;
 
-    locks::CriticalSection lock1("DealsInfo");
-    locks::CriticalSection lock2("DealsData");
-    locks::CriticalSection lock3("TopDst");
-    lock1.reset_not_for_production();
-    lock2.reset_not_for_production();
-    lock3.reset_not_for_production();
-
     http::unit_test();
+    codec::unit_test();
+    wal::unit_test();
+    shared_mem::unit_test();
     deals::unit_test();
     timing::unit_test();
     locks::unit_test();
@@ -657,7 +794,7 @@ int main(int argc, char *argv[]) {
   }
 
   if (argc < 3) {
-    std::cout << "deals_server <host> <port>" << std::endl;
+    std::cout << "deals_server <host> <port> [snapshot directory]" << std::endl;
     return -1;
   }
 
@@ -667,7 +804,8 @@ int main(int argc, char *argv[]) {
 
   const std::string host = argv[1];
   const uint16_t port = std::stol(argv[2]);
-  deals_srv::DealsServer srv(host, port);
+  const std::string snapshot_directory = argc > 3 ? argv[3] : "";
+  deals_srv::DealsServer srv(host, port, snapshot_directory);
 
   while (1) {
     srv.process();
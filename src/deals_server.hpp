@@ -21,7 +21,12 @@ class Context {
 //------------------------------------------------------
 class DealsServer : public srv::TCPServer<Context> {
  public:
-  DealsServer(const std::string host, const uint16_t port) : srv::TCPServer<Context>(host, port) {
+  // snapshot_directory: tables are loaded from it on start and saved to it on quit,
+  // added deals are logged there between snapshots (deals-<port>.wal)
+  DealsServer(const std::string host, const uint16_t port,
+              const std::string snapshot_directory = "")
+      : srv::TCPServer<Context>(host, port), snapshot_directory(snapshot_directory), port(port) {
+    loadSnapshot();
   }
   void process();
   void quit();
@@ -31,7 +36,13 @@ class DealsServer : public srv::TCPServer<Context> {
   void on_data(Connection& conn) final override;
 
   void addDeal(Connection& conn);
+  void addDealsBatch(Connection& conn);
+  // /deals/add params of one deal, locale is used by destinations db
+  deals::DealInfo parseDeal(utils::ObjectMap& params, std::string& locale);
   void getTop(Connection& conn);
+  void loadSnapshot();
+  // false if other process is saving snapshot at the moment
+  bool saveSnapshot();
   void getDestiantionsTop(Connection& conn);
 
   // in memory databases
@@ -39,6 +50,8 @@ class DealsServer : public srv::TCPServer<Context> {
   top::TopDstDatabase db_dst;
 
   bool quit_request = false;
+  const std::string snapshot_directory;
+  const uint16_t port;
 };
 }  // namespace deals_srv
 
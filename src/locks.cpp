@@ -2,10 +2,18 @@
 
 #include <cassert>
 #include <cinttypes>
+#include <cstring>
 #include <iostream>
+#include <sstream>
+#include <thread>
 
+#include <errno.h>
 #include <fcntl.h> /* For O_* constants */
 #include <semaphore.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "timing.hpp"
@@ -128,9 +136,304 @@ void CriticalSection::exit() {
   unlock_needed = false;
 }
 
+//-----------------------------------------------
+// SharedMutex Constructor
+//-----------------------------------------------
+SharedMutex::SharedMutex(SharedMutexState* state, std::string name, std::function<void()> repair)
+    : state(state), name(name), repair(repair) {
+  initialize();
+}
+
+//-----------------------------------------------
+// SharedMutex Destructor
+//-----------------------------------------------
+SharedMutex::~SharedMutex() {
+  if (unlock_needed) {
+    std::cout << "ERROR: SharedMutex::~SharedMutex auto unlocking:" << name << std::endl;
+    pthread_mutex_unlock(&state->mutex);
+  }
+}
+
+//-----------------------------------------------
+// SharedMutex initialize    first user of shared memory does it
+//-----------------------------------------------
+// initializer which died (or got no pid published for WAIT_FOR_LOCK_MSEC) is
+// replaced by one of waiting processes
+void SharedMutex::initialize() {
+  uint32_t pid = getpid();
+  uint32_t expected = 0;
+  if (__atomic_compare_exchange_n(&state->initialized, &expected, 1, false, __ATOMIC_ACQ_REL,
+                                  __ATOMIC_ACQUIRE)) {
+    __atomic_store_n(&state->initializer, pid, __ATOMIC_RELEASE);
+  } else {
+    // other process is initializing it right now
+    uint64_t waited_usec = 0;
+    while (__atomic_load_n(&state->initialized, __ATOMIC_ACQUIRE) != 2) {
+      usleep(SLEEP_BETWEEN_TRIES_USEC);
+      waited_usec += SLEEP_BETWEEN_TRIES_USEC;
+
+      uint32_t initializer = __atomic_load_n(&state->initializer, __ATOMIC_ACQUIRE);
+      bool died = initializer == 0 ? waited_usec / 1000 > WAIT_FOR_LOCK_MSEC
+                                   : kill(initializer, 0) == -1 && errno == ESRCH;
+      if (died && __atomic_compare_exchange_n(&state->initializer, &initializer, pid, false,
+                                              __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        std::cerr << "WARNING SharedMutex::initialize initializer died, taking over:" << name
+                  << std::endl;
+        break;
+      }
+    }
+    if (__atomic_load_n(&state->initialized, __ATOMIC_ACQUIRE) == 2) {
+      return;
+    }
+  }
+
+  pthread_mutexattr_t attr;
+  pthread_mutexattr_init(&attr);
+  pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+  pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+  int res = pthread_mutex_init(&state->mutex, &attr);
+  pthread_mutexattr_destroy(&attr);
+  if (res != 0) {
+    std::cerr << "ERROR SharedMutex::initialize pthread_mutex_init():" << res << " " << name
+              << std::endl;
+    throw "cant initialize mutex";
+  }
+  __atomic_store_n(&state->initialized, 2, __ATOMIC_RELEASE);
+}
+
+//-----------------------------------------------
+// SharedMutex recover       lock is taken from dead owner
+//-----------------------------------------------
+void SharedMutex::recover() {
+  __atomic_add_fetch(&state->owner_deaths, 1, __ATOMIC_RELAXED);
+  std::cerr << "WARNING SharedMutex owner died, lock recovered:" << name << std::endl;
+  if (repair) {
+    repair();
+  }
+  pthread_mutex_consistent(&state->mutex);
+}
+
+//-----------------------------------------------
+// cpu hint for spin wait loop
+//-----------------------------------------------
+static inline void cpuRelax() {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#elif defined(__aarch64__)
+  asm volatile("yield");
+#endif
+}
+
+//-----------------------------------------------
+// monotonic clock for lock statistics
+//-----------------------------------------------
+static uint64_t monotonicUsec() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1000000ULL + now.tv_nsec / 1000;
+}
+
+//-----------------------------------------------
+// histogram bucket of duration
+//-----------------------------------------------
+static uint32_t statBucket(uint64_t usec) {
+  if (usec == 0) {
+    return 0;
+  }
+  uint32_t bucket = 64 - __builtin_clzll(usec);
+  return bucket < LOCK_STAT_BUCKETS ? bucket : LOCK_STAT_BUCKETS - 1;
+}
+
+//-----------------------------------------------
+// SharedMutex enter()
+//-----------------------------------------------
+void SharedMutex::enter() {
+  uint64_t enter_usec = monotonicUsec();
+  int res = pthread_mutex_trylock(&state->mutex);
+  bool contended = res == EBUSY;
+
+  // lock is usually held for a short time, wait for it without syscalls first.
+  // backoff keeps cache line of mutex from bouncing between spinning cores
+  for (uint32_t tries = 1, pauses = 1; tries < SPIN_BEFORE_SLEEP_TRIES && res == EBUSY;
+       ++tries, pauses *= 2) {
+    for (uint32_t pause = 0; pause < pauses; ++pause) {
+      cpuRelax();
+    }
+    res = pthread_mutex_trylock(&state->mutex);
+  }
+  if (res == EBUSY) {
+    res = pthread_mutex_lock(&state->mutex);
+  }
+
+  if (res == EOWNERDEAD) {
+    recover();
+  } else if (res != 0) {
+    std::cerr << "ERROR: SharedMutex::enter pthread_mutex_lock():" << res << " " << name
+              << std::endl;
+    throw "cant lock";
+  }
+  unlock_needed = true;
+
+  // statistics are protected by lock itself
+  acquired_at_usec = contended ? monotonicUsec() : enter_usec;
+  uint64_t wait_usec = acquired_at_usec - enter_usec;
+  SharedMutexStats& stats = state->stats;
+  stats.acquisitions++;
+  stats.contended += contended;
+  stats.wait_usec += wait_usec;
+  stats.wait_histogram[statBucket(wait_usec)]++;
+}
+
+//-----------------------------------------------
+// SharedMutex exit()
+//-----------------------------------------------
+void SharedMutex::exit() {
+  uint64_t hold_usec = monotonicUsec() - acquired_at_usec;
+  state->stats.hold_usec += hold_usec;
+  state->stats.hold_histogram[statBucket(hold_usec)]++;
+
+  int res = pthread_mutex_unlock(&state->mutex);
+  unlock_needed = false;
+  if (res != 0) {
+    std::cerr << "ERROR SharedMutex::exit pthread_mutex_unlock():" << res << " " << name
+              << std::endl;
+    throw "cant unlock";
+  }
+}
+
+//-----------------------------------------------
+// SharedMutex stats()
+//-----------------------------------------------
+SharedMutexStats SharedMutex::stats() {
+  SharedMutexStats copy;
+  std::memcpy(&copy, &state->stats, sizeof(copy));
+  return copy;
+}
+
+//-----------------------------------------------
+// SharedMutex statsText()
+//-----------------------------------------------
+std::string SharedMutex::statsText() {
+  return locks::statsText(name, stats(), __atomic_load_n(&state->owner_deaths, __ATOMIC_RELAXED));
+}
+
+//-----------------------------------------------
+// statsText
+//-----------------------------------------------
+// DealsInfo acquisitions:10 contended:1 owner_deaths:0 wait_usec:40 hold_usec:95
+// DealsInfo wait <1:9 <64:1
+// DealsInfo hold <2:3 <16:7
+std::string statsText(const std::string& name, const SharedMutexStats& stats,
+                      uint32_t owner_deaths) {
+  std::stringstream text;
+  text << name << " acquisitions:" << stats.acquisitions << " contended:" << stats.contended
+       << " owner_deaths:" << owner_deaths << " wait_usec:" << stats.wait_usec
+       << " hold_usec:" << stats.hold_usec << "\n";
+
+  auto histogram = [&text, &name](const char* title, const uint64_t* buckets) {
+    text << name << " " << title;
+    for (uint32_t bucket = 0; bucket < LOCK_STAT_BUCKETS; ++bucket) {
+      if (buckets[bucket] == 0) {
+        continue;
+      }
+      if (bucket == LOCK_STAT_BUCKETS - 1) {
+        text << " >=" << (1ULL << (bucket - 1)) << ":" << buckets[bucket];
+      } else {
+        text << " <" << (1ULL << bucket) << ":" << buckets[bucket];
+      }
+    }
+    text << "\n";
+  };
+  histogram("wait", stats.wait_histogram);
+  histogram("hold", stats.hold_histogram);
+
+  return text.str();
+}
+
 //-----------------------------------------------
 // Testing...
 //-----------------------------------------------
+void testSharedMutex() {
+  // memory shared with child process
+  SharedMutexState* state =
+      (SharedMutexState*)mmap(nullptr, sizeof(SharedMutexState), PROT_READ | PROT_WRITE,
+                              MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  assert(state != MAP_FAILED);
+
+  uint32_t repairs = 0;
+  SharedMutex lock(state, "test", [&repairs]() { ++repairs; });
+  lock.enter();
+  lock.exit();
+
+  // child dies holding the lock
+  pid_t child = fork();
+  if (child == 0) {
+    SharedMutex child_lock(state, "test");
+    child_lock.enter();
+    _exit(0);
+  }
+  int status = 0;
+  waitpid(child, &status, 0);
+
+  lock.enter();
+  assert(state->owner_deaths == 1 && repairs == 1);
+  lock.exit();
+  lock.enter();
+  lock.exit();
+  assert(state->owner_deaths == 1 && repairs == 1);
+
+  // statistics of both processes, child never released lock
+  SharedMutexStats stats = lock.stats();
+  assert(stats.acquisitions == 4);
+  uint64_t holds = 0;
+  for (uint32_t bucket = 0; bucket < LOCK_STAT_BUCKETS; ++bucket) {
+    holds += stats.hold_histogram[bucket];
+  }
+  assert(holds == 3);
+
+  // other thread holds lock for 2ms
+  bool holding = false;
+  std::thread holder([state, &holding]() {
+    SharedMutex holder_lock(state, "test");
+    holder_lock.enter();
+    __atomic_store_n(&holding, true, __ATOMIC_RELEASE);
+    usleep(2000);
+    holder_lock.exit();
+  });
+  while (!__atomic_load_n(&holding, __ATOMIC_ACQUIRE)) {
+  }
+  lock.enter();
+  lock.exit();
+  holder.join();
+
+  stats = lock.stats();
+  assert(stats.acquisitions == 6 && stats.contended == 1);
+  assert(stats.wait_usec >= 1000 && stats.hold_usec >= 1000);
+  uint64_t long_waits = 0;
+  for (uint32_t bucket = statBucket(1000); bucket < LOCK_STAT_BUCKETS; ++bucket) {
+    long_waits += stats.wait_histogram[bucket];
+  }
+  assert(long_waits >= 1);
+  std::cout << lock.statsText();
+
+  // child dies initializing the lock, next process initializes it again
+  std::memset(state, 0, sizeof(SharedMutexState));
+  child = fork();
+  if (child == 0) {
+    __atomic_store_n(&state->initialized, 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&state->initializer, getpid(), __ATOMIC_RELEASE);
+    _exit(0);
+  }
+  waitpid(child, &status, 0);
+  SharedMutex reinitialized(state, "test");
+  assert(state->initialized == 2 && state->initializer == (uint32_t)getpid());
+  reinitialized.enter();
+  reinitialized.exit();
+
+  munmap(state, sizeof(SharedMutexState));
+  std::cout << "SharedMutex... OK" << std::endl;
+}
+
 void testf(bool& second_enter) {
   //-------------------------------
   // test1
@@ -160,6 +463,8 @@ void testf(bool& second_enter) {
 }
 
 int unit_test() {
+  testSharedMutex();
+
   bool exception = false;
   bool second_enter = false;
   try {
@@ -1,8 +1,12 @@
 #ifndef LOCKS_HPP
 #define LOCKS_HPP
 
+#include <cinttypes>
+#include <functional>
 #include <iostream>
+#include <string>
 
+#include <pthread.h>
 #include <semaphore.h>
 
 namespace locks {
@@ -10,6 +14,11 @@ namespace locks {
 #define WAIT_INFINITY_TIME TRUE
 #define SLEEP_BETWEEN_TRIES_USEC 10
 #define WAIT_FOR_LOCK_MSEC 5000
+// SharedMutex: tries to take busy lock before sleeping in kernel,
+// cpu pauses between tries double (1, 2, 4...)
+#define SPIN_BEFORE_SLEEP_TRIES 10
+// SharedMutexStats histograms: [0] - under 1 usec, [n] - [2^(n-1), 2^n) usec, last - the rest
+#define LOCK_STAT_BUCKETS 24
 
 class CriticalSection {
  public:
@@ -31,6 +40,61 @@ class CriticalSection {
   sem_t *lock;
 };
 
+// acquisitions by all processes, updated by lock owner
+struct SharedMutexStats {
+  uint64_t acquisitions;
+  uint64_t contended;  // lock was busy on enter
+  uint64_t wait_usec;  // totals
+  uint64_t hold_usec;
+  uint64_t wait_histogram[LOCK_STAT_BUCKETS];
+  uint64_t hold_histogram[LOCK_STAT_BUCKETS];
+};
+
+// SharedMutex data placed in shared memory, zero filled memory is a valid initial state
+struct SharedMutexState {
+  uint32_t initialized;  // 0 - not yet, 1 - being initialized, 2 - ready
+  uint32_t initializer;  // pid of process initializing it, others take over if it died
+  uint32_t owner_deaths;  // times lock was recovered after its owner died
+  pthread_mutex_t mutex;
+  SharedMutexStats stats;
+};
+
+// one line of totals and lines of not empty histogram buckets
+std::string statsText(const std::string& name, const SharedMutexStats& stats,
+                      uint32_t owner_deaths);
+
+//-----------------------------------------------
+// SharedMutex
+//-----------------------------------------------
+// robust process shared mutex: if owner dies holding it, next process gets lock
+// (data protected by it may be half updated). same interface as CriticalSection,
+// every thread must use its own instance
+class SharedMutex {
+ public:
+  // repair: called by enter() holding lock taken from dead owner, before lock is
+  // made consistent again. it must bring protected data into valid state
+  SharedMutex(SharedMutexState* state, std::string name,
+              std::function<void()> repair = nullptr);
+  ~SharedMutex();
+
+  void enter();
+  void exit();
+  // copy, may be slightly inconsistent: read without lock
+  SharedMutexStats stats();
+  // statsText of this lock
+  std::string statsText();
+
+ private:
+  void initialize();
+  void recover();
+
+  SharedMutexState* state;
+  std::string name;
+  std::function<void()> repair;
+  bool unlock_needed = false;
+  uint64_t acquired_at_usec = 0;
+};
+
 int unit_test();
 }  // namespace locks
 
@@ -0,0 +1,514 @@
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "payload_codec.hpp"
+#include "timing.hpp"
+
+namespace codec {
+
+//------------------------------------------------------------
+// DictionaryCodec Constructor
+//------------------------------------------------------------
+DictionaryCodec::DictionaryCodec(std::string name, uint32_t payload_lifetime,
+                                 uint32_t train_interval)
+    : payload_lifetime(payload_lifetime), train_interval(train_interval) {
+  memory = new shared_mem::SharedMemoryArena(name, sizeof(SharedCodecMemory));
+
+  // without shared dictionaries payloads are stored as is
+  if (!memory->isAllocated()) {
+    shared = nullptr;
+    std::cerr << "ERROR DictionaryCodec::DictionaryCodec compression disabled:" << name
+              << std::endl;
+  } else {
+    SharedCodecMemory* codec_memory = (SharedCodecMemory*)memory->getMemory();
+    shared = &codec_memory->dictionaries;
+    // no repair: dead owner leaves slot it was writing empty (id 0), ids are
+    // published after dictionary
+    lock = new locks::SharedMutex(&codec_memory->lock, name);
+  }
+
+  samples.resize(CODEC_TRAIN_SAMPLES);
+}
+
+//------------------------------------------------------------
+// DictionaryCodec Destructor
+//------------------------------------------------------------
+DictionaryCodec::~DictionaryCodec() {
+  delete lock;
+  delete memory;
+}
+
+//------------------------------------------------------------
+// DictionaryCodec compress
+//------------------------------------------------------------
+std::string DictionaryCodec::compress(const std::string& data) {
+  samples[samples_count % CODEC_TRAIN_SAMPLES] = data.substr(0, CODEC_SAMPLE_MAX_SIZE);
+  ++samples_count;
+
+  std::string result;
+  if (shared == nullptr) {
+    return data;
+  }
+
+  uint32_t current_time = timing::getTimestampSec();
+  uint32_t current_id = __atomic_load_n(&shared->current_id, __ATOMIC_ACQUIRE);
+  if (current_id != current.id) {
+    current = Dictionary();
+    if (current_id != 0 && !load_dictionary(current_id, current)) {
+      current = Dictionary();
+    }
+  }
+
+  if (current.id != 0) {
+    result.reserve(data.size());
+    result.push_back((char)CODEC_MAGIC);
+    result.append((const char*)&current.id, sizeof(current.id));
+
+    const uint8_t* src = (const uint8_t*)data.data();
+    size_t size = data.size();
+    size_t pos = 0;
+    while (pos < size && result.size() < size) {
+      uint8_t byte = src[pos];
+      bool matched = false;
+      for (uint8_t idx : current.by_first_byte[byte]) {
+        const std::string& entry = current.entries[idx];
+        if (entry.size() <= size - pos && memcmp(entry.data(), src + pos, entry.size()) == 0) {
+          result.push_back((char)(CODEC_FIRST_TOKEN + idx));
+          pos += entry.size();
+          matched = true;
+          break;
+        }
+      }
+      if (matched) {
+        continue;
+      }
+      if (byte >= CODEC_FIRST_TOKEN) {
+        result.push_back((char)CODEC_ESCAPE);
+      }
+      result.push_back((char)byte);
+      ++pos;
+    }
+
+    if (result.size() < size) {
+      // keep dictionary slot while payloads compressed with it are alive
+      SharedDictionary& slot = shared->slots[current.id % CODEC_DICT_SLOTS];
+      if (__atomic_load_n(&slot.last_used, __ATOMIC_RELAXED) != current_time) {
+        __atomic_store_n(&slot.last_used, current_time, __ATOMIC_RELAXED);
+      }
+      return result;
+    }
+  }
+
+  // stored as is, unless it can be confused with compressed payload
+  if (data.empty() || (uint8_t)data[0] != CODEC_MAGIC) {
+    return data;
+  }
+  uint32_t raw_id = 0;
+  result.clear();
+  result.push_back((char)CODEC_MAGIC);
+  result.append((const char*)&raw_id, sizeof(raw_id));
+  result.append(data);
+  return result;
+}
+
+//------------------------------------------------------------
+// DictionaryCodec decompress
+//------------------------------------------------------------
+std::string DictionaryCodec::decompress(const std::string& data) {
+  if (data.size() < CODEC_HEADER_SIZE || (uint8_t)data[0] != CODEC_MAGIC) {
+    return data;
+  }
+
+  uint32_t id;
+  memcpy(&id, data.data() + 1, sizeof(id));
+  if (id == 0) {
+    return data.substr(CODEC_HEADER_SIZE);
+  }
+
+  const Dictionary* dict = get_dictionary(id);
+  if (dict == nullptr) {
+    std::cerr << "ERROR DictionaryCodec::decompress dictionary not found:" << id << std::endl;
+    return "";
+  }
+
+  std::string result;
+  result.reserve(data.size() * 3);
+  const uint8_t* src = (const uint8_t*)data.data();
+  for (size_t pos = CODEC_HEADER_SIZE; pos < data.size(); ++pos) {
+    uint8_t byte = src[pos];
+    if (byte < CODEC_FIRST_TOKEN) {
+      result.push_back((char)byte);
+    } else if (byte == CODEC_ESCAPE) {
+      if (++pos < data.size()) {
+        result.push_back((char)src[pos]);
+      }
+    } else if ((size_t)(byte - CODEC_FIRST_TOKEN) < dict->entries.size()) {
+      result.append(dict->entries[byte - CODEC_FIRST_TOKEN]);
+    } else {
+      std::cerr << "ERROR DictionaryCodec::decompress wrong token:" << (int)byte << std::endl;
+      return "";
+    }
+  }
+
+  return result;
+}
+
+//------------------------------------------------------------
+// DictionaryCodec trainIfDue
+//------------------------------------------------------------
+bool DictionaryCodec::trainIfDue() {
+  if (shared == nullptr || samples_count < CODEC_TRAIN_MIN_SAMPLES) {
+    return false;
+  }
+  uint32_t current_time = timing::getTimestampSec();
+  if (__atomic_load_n(&shared->current_id, __ATOMIC_ACQUIRE) != 0 &&
+      current_time - __atomic_load_n(&shared->trained_at, __ATOMIC_RELAXED) < train_interval) {
+    return false;
+  }
+  return train();
+}
+
+//------------------------------------------------------------
+// DictionaryCodec train
+//------------------------------------------------------------
+// only one process trains at a time: trained_at is updated before training.
+// dictionary slot is reused after all payloads compressed with it expired
+bool DictionaryCodec::train() {
+  if (shared == nullptr) {
+    return false;
+  }
+
+  uint32_t current_time = timing::getTimestampSec();
+  lock->enter();
+  uint32_t id = shared->last_id + 1;
+  if (id == 0) {  // 0 - raw payload
+    id = 1;
+  }
+  SharedDictionary& slot = shared->slots[id % CODEC_DICT_SLOTS];
+  bool too_early = shared->current_id != 0 && current_time - shared->trained_at < train_interval;
+  bool slot_used = slot.id != 0 && slot.last_used + payload_lifetime >= current_time;
+  if (too_early || slot_used) {
+    lock->exit();
+    return false;
+  }
+  shared->trained_at = current_time;
+  lock->exit();
+
+  std::vector<std::string> entries = frequent_substrings();
+  if (entries.empty()) {
+    return false;
+  }
+
+  lock->enter();
+  // other process could publish dictionary with the same id
+  id = shared->last_id + 1;
+  if (id == 0) {
+    id = 1;
+  }
+  SharedDictionary& target = shared->slots[id % CODEC_DICT_SLOTS];
+  if (target.id != 0 && target.last_used + payload_lifetime >= current_time) {
+    lock->exit();
+    return false;
+  }
+
+  // readers check id before and after copying
+  __atomic_store_n(&target.id, 0, __ATOMIC_RELEASE);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  target.entries_count = entries.size();
+  for (size_t idx = 0; idx < entries.size(); ++idx) {
+    target.lengths[idx] = entries[idx].size();
+    memcpy(target.entries[idx], entries[idx].data(), entries[idx].size());
+  }
+  target.last_used = current_time;
+  __atomic_store_n(&target.id, id, __ATOMIC_RELEASE);
+
+  shared->last_id = id;
+  __atomic_store_n(&shared->current_id, id, __ATOMIC_RELEASE);
+  lock->exit();
+
+  std::cout << "DictionaryCodec::train dictionary:" << id << " entries:" << entries.size()
+            << std::endl;
+  return true;
+}
+
+//------------------------------------------------------------
+// DictionaryCodec saveSnapshot
+//------------------------------------------------------------
+bool DictionaryCodec::saveSnapshot(const std::string& file_name) {
+  if (shared == nullptr) {
+    return false;
+  }
+
+  SharedDictionaries copy;
+  lock->enter();
+  copy = *shared;
+  lock->exit();
+
+  // other processes could save the same file
+  std::string temp_name = file_name + "." + std::to_string(getpid()) + ".tmp";
+  int fd = open(temp_name.c_str(), O_WRONLY | O_CREAT | O_TRUNC, (mode_t)0644);
+  if (fd == -1) {
+    std::cerr << "ERROR DictionaryCodec::saveSnapshot cannot create:" << temp_name
+              << " errno:" << errno << std::endl;
+    return false;
+  }
+
+  bool good = shared_mem::writeFileBlock(fd, &copy, sizeof(copy), 0) && fsync(fd) == 0;
+  close(fd);
+  if (!good || rename(temp_name.c_str(), file_name.c_str()) != 0) {
+    std::cerr << "ERROR DictionaryCodec::saveSnapshot failed:" << file_name << std::endl;
+    unlink(temp_name.c_str());
+    return false;
+  }
+  return true;
+}
+
+//------------------------------------------------------------
+// DictionaryCodec loadSnapshot
+//------------------------------------------------------------
+bool DictionaryCodec::loadSnapshot(const std::string& file_name) {
+  if (shared == nullptr) {
+    return false;
+  }
+
+  int fd = open(file_name.c_str(), O_RDONLY);
+  if (fd == -1) {
+    std::cout << "DictionaryCodec::loadSnapshot no snapshot:" << file_name << std::endl;
+    return false;
+  }
+
+  SharedDictionaries* copy = new SharedDictionaries;
+  bool good = shared_mem::readFileBlock(fd, copy, sizeof(*copy), 0);
+  close(fd);
+
+  lock->enter();
+  // dictionaries survived restart
+  good = good && shared->last_id == 0;
+  if (good) {
+    *shared = *copy;
+  }
+  lock->exit();
+  delete copy;
+
+  std::cout << "DictionaryCodec::loadSnapshot " << file_name << (good ? " OK" : " SKIP")
+            << std::endl;
+  return good;
+}
+
+//------------------------------------------------------------
+// DictionaryCodec frequent_substrings
+//------------------------------------------------------------
+// substrings which save most bytes in samples: (length - 1) bytes per
+// occurrence. substrings of already selected entries are skipped
+std::vector<std::string> DictionaryCodec::frequent_substrings() {
+  static const size_t lengths[] = {4, 6, 8, 12, 16, 24, 32, 48, 64};
+  static_assert(CODEC_DICT_ENTRY_MAX_LEN >= 64, "CODEC_DICT_ENTRY_MAX_LEN TOO SMALL");
+
+  struct Candidate {
+    uint32_t count;
+    uint32_t sample;
+    uint32_t offset;
+    uint32_t length;
+  };
+  std::unordered_map<uint64_t, Candidate> candidates;
+
+  uint32_t samples_used = std::min<uint32_t>(samples_count, CODEC_TRAIN_SAMPLES);
+  for (uint32_t sample = 0; sample < samples_used; ++sample) {
+    const std::string& text = samples[sample];
+    for (size_t length : lengths) {
+      for (size_t offset = 0; offset + length <= text.size(); ++offset) {
+        uint64_t hash = shared_mem::contentHash(text.data() + offset, length) ^ length;
+        auto it = candidates.find(hash);
+        if (it == candidates.end()) {
+          candidates[hash] = {1, sample, (uint32_t)offset, (uint32_t)length};
+        } else {
+          ++it->second.count;
+        }
+      }
+    }
+  }
+
+  std::vector<Candidate> sorted;
+  for (const auto& it : candidates) {
+    if (it.second.count > 1) {
+      sorted.push_back(it.second);
+    }
+  }
+  std::sort(sorted.begin(), sorted.end(), [](const Candidate& a, const Candidate& b) {
+    return (uint64_t)(a.length - 1) * (a.count - 1) > (uint64_t)(b.length - 1) * (b.count - 1);
+  });
+
+  std::vector<std::string> entries;
+  for (const Candidate& candidate : sorted) {
+    if (entries.size() == CODEC_DICT_ENTRIES) {
+      break;
+    }
+    std::string entry = samples[candidate.sample].substr(candidate.offset, candidate.length);
+    bool covered = false;
+    for (const std::string& selected : entries) {
+      if (selected.find(entry) != std::string::npos) {
+        covered = true;
+        break;
+      }
+    }
+    if (!covered) {
+      entries.push_back(entry);
+    }
+  }
+
+  return entries;
+}
+
+//------------------------------------------------------------
+// DictionaryCodec get_dictionary
+//------------------------------------------------------------
+const DictionaryCodec::Dictionary* DictionaryCodec::get_dictionary(uint32_t id) {
+  if (current.id == id) {
+    return &current;
+  }
+
+  auto it = dictionaries.find(id);
+  if (it != dictionaries.end()) {
+    return &it->second;
+  }
+
+  Dictionary dict;
+  if (!load_dictionary(id, dict)) {
+    return nullptr;
+  }
+  // slots are reused, so only last dictionaries are needed
+  if (dictionaries.size() >= CODEC_DICT_SLOTS) {
+    dictionaries.clear();
+  }
+  return &(dictionaries[id] = std::move(dict));
+}
+
+//------------------------------------------------------------
+// DictionaryCodec load_dictionary
+//------------------------------------------------------------
+bool DictionaryCodec::load_dictionary(uint32_t id, Dictionary& dict) {
+  if (shared == nullptr) {
+    return false;
+  }
+
+  const SharedDictionary& slot = shared->slots[id % CODEC_DICT_SLOTS];
+  if (__atomic_load_n(&slot.id, __ATOMIC_ACQUIRE) != id) {
+    return false;
+  }
+
+  uint16_t entries_count = std::min<uint16_t>(slot.entries_count, CODEC_DICT_ENTRIES);
+  dict.entries.clear();
+  for (uint16_t idx = 0; idx < entries_count; ++idx) {
+    uint8_t length = std::min<uint8_t>(slot.lengths[idx], CODEC_DICT_ENTRY_MAX_LEN);
+    dict.entries.emplace_back(slot.entries[idx], length);
+  }
+
+  // slot was rewritten while copying
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&slot.id, __ATOMIC_ACQUIRE) != id) {
+    return false;
+  }
+
+  dict.id = id;
+  make_index(dict);
+  return true;
+}
+
+//------------------------------------------------------------
+// DictionaryCodec make_index
+//------------------------------------------------------------
+void DictionaryCodec::make_index(Dictionary& dict) {
+  for (auto& candidates : dict.by_first_byte) {
+    candidates.clear();
+  }
+  for (size_t idx = 0; idx < dict.entries.size(); ++idx) {
+    if (!dict.entries[idx].empty()) {
+      dict.by_first_byte[(uint8_t)dict.entries[idx][0]].push_back(idx);
+    }
+  }
+  // longest match first
+  for (auto& candidates : dict.by_first_byte) {
+    std::sort(candidates.begin(), candidates.end(), [&dict](uint8_t a, uint8_t b) {
+      return dict.entries[a].size() > dict.entries[b].size();
+    });
+  }
+}
+
+//------------------------------------------------------------
+// unit_test
+//------------------------------------------------------------
+void unit_test() {
+  shared_mem::SharedMemoryArena::unlink("TestDict");
+
+  DictionaryCodec codec("TestDict", 60, 3600);
+  DictionaryCodec reader("TestDict", 60, 3600);
+
+  // not trained yet: passed through
+  std::string magic_data = std::string(1, (char)CODEC_MAGIC) + "binary";
+  assert(codec.compress("{}") == "{}");
+  assert(codec.compress(magic_data) != magic_data);
+  assert(reader.decompress(codec.compress(magic_data)) == magic_data);
+  assert(reader.decompress("{}") == "{}");
+  assert(reader.decompress("") == "");
+
+  uint64_t raw_size = 0;
+  uint64_t compressed_size = 0;
+  for (uint32_t i = 0; i < CODEC_TRAIN_MIN_SAMPLES * 2; ++i) {
+    std::string deal = "{\"origin\":\"MOW\",\"destination\":\"LED\",\"depart_date\":\"2017-0" +
+                       std::to_string(1 + i % 9) + "-1" + std::to_string(i % 10) +
+                       "\",\"return_date\":\"\",\"number_of_changes\":" + std::to_string(i % 3) +
+                       ",\"value\":" + std::to_string(1000 + i * 7) +
+                       ",\"gate\":\"Агентство\",\"actual\":true}";
+    if (i == CODEC_TRAIN_MIN_SAMPLES) {
+      assert(codec.trainIfDue());
+      assert(!codec.trainIfDue());
+    }
+    std::string compressed = codec.compress(deal);
+    assert(reader.decompress(compressed) == deal);
+    assert(codec.decompress(compressed) == deal);
+    if (i >= CODEC_TRAIN_MIN_SAMPLES) {
+      raw_size += deal.size();
+      compressed_size += compressed.size();
+    }
+  }
+  std::cout << "codec ratio: " << raw_size << "/" << compressed_size << std::endl;
+  assert(codec.shared->current_id != 0);
+  assert(compressed_size * 2 < raw_size);
+
+  // payloads compressed with previous dictionary are still readable
+  uint32_t previous_id = codec.shared->current_id;
+  std::string old_deal = "{\"origin\":\"MOW\",\"destination\":\"LED\",\"value\":42}";
+  std::string old_compressed = codec.compress(old_deal);
+  codec.train_interval = 0;
+  assert(codec.train());
+  assert(codec.shared->current_id != previous_id);
+  assert(reader.decompress(old_compressed) == old_deal);
+  assert(reader.decompress(codec.compress(old_deal)) == old_deal);
+  assert(reader.decompress(codec.compress(magic_data)) == magic_data);
+
+  // alive dictionary slot is not reused
+  for (uint32_t i = 0; i < CODEC_DICT_SLOTS; ++i) {
+    codec.train();
+  }
+  assert(codec.shared->current_id - previous_id < CODEC_DICT_SLOTS);
+  assert(reader.decompress(old_compressed) == old_deal);
+
+  // dictionaries are restored after restart
+  assert(codec.saveSnapshot("/tmp/TestDict.snapshot"));
+  std::memset(codec.shared, 0, sizeof(*codec.shared));
+  DictionaryCodec restarted("TestDict", 60, 3600);
+  assert(restarted.loadSnapshot("/tmp/TestDict.snapshot"));
+  assert(restarted.decompress(old_compressed) == old_deal);
+  assert(!restarted.loadSnapshot("/tmp/TestDict.snapshot"));
+  unlink("/tmp/TestDict.snapshot");
+
+  shared_mem::SharedMemoryArena::unlink("TestDict");
+}
+
+}  // namespace codec
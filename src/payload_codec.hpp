@@ -0,0 +1,111 @@
+#ifndef SRC_PAYLOAD_CODEC_HPP
+#define SRC_PAYLOAD_CODEC_HPP
+
+#include <cinttypes>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "locks.hpp"
+#include "shared_memory.hpp"
+
+namespace codec {
+
+// compressed payload: [CODEC_MAGIC][dictionary id:4][tokens...]
+// token is a byte: < 0x80 - literal, 0x80..0xFE - dictionary entry,
+// CODEC_ESCAPE - next byte is literal (bytes >= 0x80)
+#define CODEC_MAGIC 0xDC
+#define CODEC_HEADER_SIZE 5
+#define CODEC_ESCAPE 0xFF
+#define CODEC_FIRST_TOKEN 0x80
+#define CODEC_DICT_ENTRIES (CODEC_ESCAPE - CODEC_FIRST_TOKEN)
+#define CODEC_DICT_ENTRY_MAX_LEN 64
+#define CODEC_DICT_SLOTS 16
+#define CODEC_TRAIN_SAMPLES 256
+#define CODEC_TRAIN_MIN_SAMPLES 64
+#define CODEC_SAMPLE_MAX_SIZE 1024
+
+void unit_test();
+
+// dictionary published for all processes
+struct SharedDictionary {
+  uint32_t id;         // 0 - empty or being written
+  uint32_t last_used;  // slot is reused only after payloads compressed with it expired
+  uint16_t entries_count;
+  uint8_t lengths[CODEC_DICT_ENTRIES];
+  char entries[CODEC_DICT_ENTRIES][CODEC_DICT_ENTRY_MAX_LEN];
+};
+
+struct SharedDictionaries {
+  uint32_t current_id;  // dictionary for compression, 0 - not trained yet
+  uint32_t last_id;
+  uint32_t trained_at;
+  SharedDictionary slots[CODEC_DICT_SLOTS];
+};
+
+// DictionaryCodec arena, dictionaries are saved to snapshot without lock
+struct SharedCodecMemory {
+  locks::SharedMutexState lock;
+  SharedDictionaries dictionaries;
+};
+
+//------------------------------------------------------------
+// DictionaryCodec
+//------------------------------------------------------------
+// small documents with repetitive keys (deal json) are compressed with
+// dictionary of frequent substrings. dictionary is trained periodically on
+// recent payloads by any process and shared with others via shared memory.
+// compress only collects samples, training is driven from event loop (trainIfDue)
+class DictionaryCodec {
+ public:
+  // payload_lifetime: max seconds compressed payload can be stored,
+  // train_interval: seconds between dictionary updates
+  DictionaryCodec(std::string name, uint32_t payload_lifetime, uint32_t train_interval);
+  ~DictionaryCodec();
+
+  // data is returned as is if it doesn't become smaller
+  std::string compress(const std::string& data);
+  // compressed or passed through data, empty string if dictionary is lost
+  std::string decompress(const std::string& data);
+  // build dictionary from recent payloads and make it current, false if it's too early
+  bool train();
+  // train if enough samples are collected and train_interval passed, call it
+  // outside of request handling: training takes much longer than compress
+  bool trainIfDue();
+
+  // shared dictionaries for warm restart, see Table::saveSnapshot
+  bool saveSnapshot(const std::string& file_name);
+  // only if no dictionary was trained yet
+  bool loadSnapshot(const std::string& file_name);
+
+ private:
+  struct Dictionary {
+    uint32_t id = 0;
+    std::vector<std::string> entries;
+    // entry indexes by first byte, longest first
+    std::vector<uint8_t> by_first_byte[256];
+  };
+
+  void make_index(Dictionary& dict);
+  bool load_dictionary(uint32_t id, Dictionary& dict);
+  const Dictionary* get_dictionary(uint32_t id);
+  std::vector<std::string> frequent_substrings();
+
+  shared_mem::SharedMemoryArena* memory;
+  SharedDictionaries* shared;
+  locks::SharedMutex* lock = nullptr;
+
+  uint32_t payload_lifetime;
+  uint32_t train_interval;
+
+  Dictionary current;  // used for compression
+  std::unordered_map<uint32_t, Dictionary> dictionaries;
+  std::vector<std::string> samples;
+  uint32_t samples_count = 0;
+
+  friend void unit_test();
+};
+
+}  // namespace codec
+
+#endif
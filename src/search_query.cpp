@@ -52,28 +52,28 @@ void SearchQuery::departure_dates(std::string departure_date_from, std::string d
     return;
   }
 
-  departure_date_values.duration = 0;
-  if (departure_date_from.length() > 0 && departure_date_to.length() > 0) {
-    departure_date_values.duration =
-        utils::days_between_dates(departure_date_from, departure_date_to) + 1;
-  }
-
   filter_departure_date = true;
 
   if (departure_date_from.length() == 0) {
     departure_date_values.from = 0;
   } else {
-    departure_date_values.from = date_to_int(departure_date_from);
+    departure_date_values.from = date_to_days(departure_date_from);
   }
 
   if (departure_date_to.length() == 0) {
-    departure_date_values.to = UINT32_MAX;
+    departure_date_values.to = UINT16_MAX;
   } else {
-    departure_date_values.to = date_to_int(departure_date_to);
+    departure_date_values.to = date_to_days(departure_date_to);
   }
 
   if (departure_date_values.from > departure_date_values.to) {
     query_is_broken = true;
+    return;
+  }
+
+  departure_date_values.duration = 0;
+  if (departure_date_from.length() > 0 && departure_date_to.length() > 0) {
+    departure_date_values.duration = departure_date_values.to - departure_date_values.from + 1;
   }
 }
 
@@ -87,9 +87,9 @@ void SearchQuery::departure_dates(std::string departure_dates) {
 
   auto dates = ::utils::split_string(departure_dates);
   for (auto& date : dates) {
-    uint32_t date_int = date_to_int(date);
-    if (date_int) {
-      departure_dates_vector.push_back(date_int);
+    uint16_t date_days = date_to_days(date);
+    if (date_days) {
+      departure_dates_vector.push_back(date_days);
     }
   }
 
@@ -108,9 +108,9 @@ void SearchQuery::return_dates(std::string return_dates) {
 
   auto dates = ::utils::split_string(return_dates);
   for (auto& date : dates) {
-    uint32_t date_int = date_to_int(date);
-    if (date_int) {
-      return_dates_vector.push_back(date_int);
+    uint16_t date_days = date_to_days(date);
+    if (date_days) {
+      return_dates_vector.push_back(date_days);
     }
   }
 
@@ -127,23 +127,18 @@ void SearchQuery::return_dates(std::string return_date_from, std::string return_
     return;
   }
 
-  return_date_values.duration = 0;
-  if (return_date_from.length() > 0 && return_date_to.length() > 0) {
-    return_date_values.duration = utils::days_between_dates(return_date_from, return_date_to);
-  }
-
   filter_return_date = true;
 
   if (return_date_from.length() == 0) {
     return_date_values.from = 0;
   } else {
-    return_date_values.from = date_to_int(return_date_from);
+    return_date_values.from = date_to_days(return_date_from);
   }
 
   if (return_date_to.length() == 0) {
-    return_date_values.to = UINT32_MAX;
+    return_date_values.to = UINT16_MAX;
   } else {
-    return_date_values.to = date_to_int(return_date_to);
+    return_date_values.to = date_to_days(return_date_to);
   }
 
   if (return_date_values.from > return_date_values.to) {
@@ -152,6 +147,11 @@ void SearchQuery::return_dates(std::string return_date_from, std::string return_
   if (return_date_values.from == 0 && return_date_values.to == 0) {
     query_is_broken = true;
   }
+
+  return_date_values.duration = 0;
+  if (!query_is_broken && return_date_from.length() > 0 && return_date_to.length() > 0) {
+    return_date_values.duration = return_date_values.to - return_date_values.from;
+  }
 }
 
 //--------------------------------------------------
@@ -362,15 +362,15 @@ bool check_weekdays_format(std::string weekdays) {
 // check_date_format
 //--------------------------------------------------
 bool check_date_format(std::string date) {
-  return date_to_int(date) != 0;
+  return date_to_days(date) != 0;
 }
 
 //--------------------------------------------------
 // check_date_to_date
 //--------------------------------------------------
 bool check_date_to_date(std::string _date_from, std::string _date_to) {
-  uint32_t date_from = date_to_int(_date_from);
-  uint32_t date_to = date_to_int(_date_to);
+  uint16_t date_from = date_to_days(_date_from);
+  uint16_t date_to = date_to_days(_date_to);
   if (date_from && date_to) {
     return date_from <= date_to;
   }
@@ -378,72 +378,113 @@ bool check_date_to_date(std::string _date_from, std::string _date_to) {
 }
 
 //--------------------------------------------------
-// origin_to_code
+// origin_to_code    3 base-36 digits [0-9A-Z]: "AAA" -> 13331
+//                   codes are 1..46656, 0 means bad code
 //--------------------------------------------------
-uint32_t origin_to_code(std::string code) {
-  PlaceCodec a2i;
-  a2i.iata_code[0] = 0;
-  a2i.iata_code[1] = code[0];
-  a2i.iata_code[2] = code[1];
-  a2i.iata_code[3] = code[2];
-  return a2i.int_code;
+uint16_t origin_to_code(std::string code) {
+  if (code.length() != 3) {
+    return 0;
+  }
+
+  uint16_t result = 0;
+  for (const char letter : code) {
+    uint8_t digit;
+    if (letter >= '0' && letter <= '9') {
+      digit = letter - '0';
+    } else if (letter >= 'A' && letter <= 'Z') {
+      digit = letter - 'A' + 10;
+    } else {
+      return 0;
+    }
+    result = result * 36 + digit;
+  }
+
+  return result + 1;
 }
 
 //--------------------------------------------------
 // code_to_origin
 //--------------------------------------------------
-std::string code_to_origin(uint32_t code) {
-  PlaceCodec a2i;
-  a2i.int_code = code;
-  std::string result;
-  result += a2i.iata_code[1];
-  result += a2i.iata_code[2];
-  result += a2i.iata_code[3];
+std::string code_to_origin(uint16_t code) {
+  if (code == 0) {
+    return "";
+  }
+
+  static const char digits[] = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+  std::string result(3, ' ');
+  code -= 1;
+  result[2] = digits[code % 36];
+  result[1] = digits[code / 36 % 36];
+  result[0] = digits[code / 1296 % 36];
   return result;
 }
 
 //--------------------------------------------------
-// date_to_int          ISO date standare 2016-06-16
+// date_to_days          ISO date standare 2016-06-16
+// returns days since 1970-01-01, 0 is reserved for wrong/empty date
 //--------------------------------------------------
-uint32_t date_to_int(std::string date) {
+uint16_t date_to_days(std::string date) {
   if (date.length() != 10) {
     return 0;
   }
   if (date[4] != '-' || date[7] != '-') {
     return 0;
   }
+  for (int i : {0, 1, 2, 3, 5, 6, 8, 9}) {
+    if (date[i] < '0' || date[i] > '9') {
+      return 0;
+    }
+  }
+
+  int32_t year = std::stoi(date.substr(0, 4));
+  uint32_t month = std::stoi(date.substr(5, 2));
+  uint32_t day = std::stoi(date.substr(8, 2));
+  if (year < 1970 || month < 1 || month > 12 || day < 1 || day > 31) {
+    return 0;
+  }
 
-  date.erase(4, 1);
-  date.erase(6, 1);
+  // civil date to days, march based year
+  year -= month <= 2;
+  const int32_t era = year / 400;
+  const uint32_t yoe = year - era * 400;
+  const uint32_t doy = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+  const uint32_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+  const int32_t days = era * 146097 + doe - 719468;
 
-  try {
-    return std::stol(date);
-  } catch (std::exception e) {
+  if (days <= 0 || days >= UINT16_MAX) {
     return 0;
   }
+  return days;
 };
 
 //--------------------------------------------------
-// int_to_date          ISO date standare 2016-06-16
+// days_to_date          ISO date standare 2016-06-16
 //--------------------------------------------------
-std::string int_to_date(uint32_t date) {
-  if (!date) {
+std::string days_to_date(uint16_t days) {
+  if (!days) {
     return "";
   }
 
-  std::string result;
-  uint16_t year;
-  uint16_t month;
-  uint16_t day;
+  const int32_t z = days + 719468;
+  const int32_t era = z / 146097;
+  const uint32_t doe = z - era * 146097;
+  const uint32_t yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+  const uint32_t doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+  const uint32_t mp = (5 * doy + 2) / 153;
+  const uint32_t day = doy - (153 * mp + 2) / 5 + 1;
+  const uint32_t month = mp < 10 ? mp + 3 : mp - 9;
+  const uint32_t year = yoe + era * 400 + (month <= 2);
 
-  // 20160601
-  year = date / 10000;
-  month = (date - year * 10000) / 100;
-  day = date - year * 10000 - month * 100;
+  return std::to_string(year) + "-" + (month < 10 ? "0" : "") + std::to_string(month) + "-" +
+         (day < 10 ? "0" : "") + std::to_string(day);
+};
 
-  result = std::to_string(year) + "-" + (month < 10 ? "0" : "") + std::to_string(month) + "-" +
-           (day < 10 ? "0" : "") + std::to_string(day);
-  return result;
+//--------------------------------------------------
+// day_of_week          mon = 0 ... sun = 6
+//--------------------------------------------------
+uint8_t day_of_week(uint16_t days) {
+  // 1970-01-01 was thursday
+  return (days + 3) % 7;
 };
 
 //-------------------------------------------
@@ -7,9 +7,10 @@
 
 namespace query {
 
+// dates are days since 1970-01-01 (see date_to_days)
 struct DateInterval {
-  uint32_t from;
-  uint32_t to;
+  uint16_t from;
+  uint16_t to;
   uint32_t duration;
 };
 
@@ -47,10 +48,10 @@ class SearchQuery {
   uint8_t weekdays_bitmask(std::string days_of_week);
 
   bool filter_origin = false;
-  uint32_t origin_value;
+  uint16_t origin_value;
 
   bool filter_destination = false;
-  std::unordered_set<uint32_t> destination_values_set;
+  std::unordered_set<uint16_t> destination_values_set;
 
   bool filter_departure_date = false;
   DateInterval departure_date_values;
@@ -58,7 +59,7 @@ class SearchQuery {
   // example: [2016-10-01, 2016-10-02, 2016-10-03]
   // NOT IMPLEMENTED YET:
   bool filter_departure_dates = false;
-  std::vector<uint32_t> departure_dates_vector;
+  std::vector<uint16_t> departure_dates_vector;
 
   bool filter_return_date = false;
   DateInterval return_date_values;
@@ -66,7 +67,7 @@ class SearchQuery {
   // example: [2016-10-01, 2016-10-02, 2016-10-03]
   // NOT IMPLEMENTED YET:
   bool filter_return_dates = false;
-  std::vector<uint32_t> return_dates_vector;
+  std::vector<uint16_t> return_dates_vector;
 
   bool filter_timestamp = false;
   uint32_t timestamp_value;
@@ -104,15 +105,14 @@ bool check_weekdays_format(std::string weekdays);
 bool check_date_format(std::string date);
 bool check_date_to_date(std::string date_from, std::string date_to);
 
-union PlaceCodec {
-  uint32_t int_code;
-  char iata_code[4];
-};
+// IATA code <-> 16 bit place id
+uint16_t origin_to_code(std::string code);
+std::string code_to_origin(uint16_t code);
 
-uint32_t origin_to_code(std::string code);
-std::string code_to_origin(uint32_t code);
-uint32_t date_to_int(std::string date);
-std::string int_to_date(uint32_t date);
+// ISO date <-> days since 1970-01-01, 0 means no date
+uint16_t date_to_days(std::string date);
+std::string days_to_date(uint16_t days);
+uint8_t day_of_week(uint16_t days);
 
 union LocaleCodec {
   uint16_t int_code;
@@ -1,5 +1,7 @@
 #include <cassert>
+#include <sys/wait.h>
 
+#include <fcntl.h>
 #include <sys/statvfs.h>
 
 #include "shared_memory.hpp"
@@ -30,6 +32,235 @@ bool checkSharedMemAvailability() {
   return freemem > LOWMEM_ERROR_PERCENT;
 }
 
+//-----------------------------------------------------------
+// sharedMemFreePercent
+//-----------------------------------------------------------
+uint32_t sharedMemFreePercent() {
+#ifdef __APPLE__
+  return 100;
+#endif
+  struct statvfs res;
+  if (statvfs("/dev/shm/", &res) != 0 || res.f_blocks == 0) {
+    return 100;
+  }
+  return 100 * res.f_bavail / res.f_blocks;
+}
+
+//-----------------------------------------------------------
+// adviseHugePages
+//-----------------------------------------------------------
+bool adviseHugePages(void* memory, uint64_t size) {
+#ifdef MADV_HUGEPAGE
+  if (madvise(memory, size, MADV_HUGEPAGE) == 0) {
+    return true;
+  }
+
+  // report once, mapping keeps working on regular pages
+  static bool reported = false;
+  if (!reported) {
+    std::cout << "WARNING adviseHugePages madvise failed:" << errno
+              << ", using regular pages" << std::endl;
+    reported = true;
+  }
+#endif
+  return false;
+}
+
+//-----------------------------------------------------------
+// contentHash
+//-----------------------------------------------------------
+uint64_t contentHash(const void* data, uint64_t size) {
+  const uint8_t* bytes = (const uint8_t*)data;
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  for (uint64_t idx = 0; idx < size; ++idx) {
+    hash ^= bytes[idx];
+    hash *= 0x100000001b3ULL;
+  }
+  return hash;
+}
+
+//-----------------------------------------------------------
+// writeFileBlock
+//-----------------------------------------------------------
+bool writeFileBlock(int fd, const void* data, uint64_t size, uint64_t offset) {
+  const uint8_t* bytes = (const uint8_t*)data;
+  while (size > 0) {
+    ssize_t written = pwrite(fd, bytes, size, offset);
+    if (written <= 0) {
+      if (written == -1 && errno == EINTR) {
+        continue;
+      }
+      std::cerr << "ERROR writeFileBlock errno:" << errno << std::endl;
+      return false;
+    }
+    bytes += written;
+    size -= written;
+    offset += written;
+  }
+  return true;
+}
+
+//-----------------------------------------------------------
+// readFileBlock
+//-----------------------------------------------------------
+bool readFileBlock(int fd, void* data, uint64_t size, uint64_t offset) {
+  uint8_t* bytes = (uint8_t*)data;
+  while (size > 0) {
+    ssize_t was_read = pread(fd, bytes, size, offset);
+    if (was_read <= 0) {
+      if (was_read == -1 && errno == EINTR) {
+        continue;
+      }
+      std::cerr << "ERROR readFileBlock errno:" << errno << " left:" << size << std::endl;
+      return false;
+    }
+    bytes += was_read;
+    size -= was_read;
+    offset += was_read;
+  }
+  return true;
+}
+
+//-----------------------------------------------------------
+// sharedMemSize
+//-----------------------------------------------------------
+uint64_t sharedMemSize(int fd) {
+  struct stat buf;
+  fstat(fd, &buf);
+  // creator is between shm_open() and ftruncate()
+  for (uint32_t waited_usec = 0; buf.st_size == 0 && waited_usec < MEMPAGE_CREATE_WAIT_MSEC * 1000;
+       waited_usec += 100) {
+    usleep(100);
+    fstat(fd, &buf);
+  }
+  return buf.st_size;
+}
+
+/*-----------------------------------------------------------------
+* SHARED MEMORY ARENA
+*-----------------------------------------------------------------*/
+
+//------------------------------------------------------------
+// SharedMemoryArena Constructor
+//------------------------------------------------------------
+SharedMemoryArena::SharedMemoryArena(std::string name, uint64_t size, bool huge_pages)
+    : name(name), size(size) {
+  fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, (mode_t)0666);
+  if (fd == -1) {
+    if (errno == EEXIST) {
+      fd = shm_open(name.c_str(), O_RDWR | O_CREAT, (mode_t)0666);
+    }
+
+    if (fd == -1) {
+      std::cerr << "ERROR SharedMemoryArena::SharedMemoryArena Cannot create or open arena:"
+                << errno << " " << name << std::endl;
+      return;
+    }
+
+    std::cout << "OPENED:" << name << std::endl;
+  } else {
+    // sparse object, memory is allocated by page on first write
+    if (ftruncate(fd, size) == -1) {
+      std::cerr << "ERROR SharedMemoryArena::SharedMemoryArena cant truncate:" << errno << " "
+                << name << " REMOVING..." << std::endl;
+      shm_unlink(name.c_str());
+      close(fd);
+      fd = -1;
+      return;
+    }
+    std::cout << "CREATE:" << name << " size:" << size << std::endl;
+  }
+
+  // see SharedMemoryPage constructor: arena could be not truncated yet
+  uint64_t arena_size = sharedMemSize(fd);
+  if (arena_size != size) {
+    std::cerr << "ERROR SharedMemoryArena::SharedMemoryArena size != arena size (" << name << ") "
+              << arena_size << " != " << size << " REMOVING..." << std::endl;
+    shm_unlink(name.c_str());
+    close(fd);
+    fd = -1;
+    return;
+  }
+
+  // reserve address space only
+  void* map = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_NORESERVE, fd, 0);
+  if (map == MAP_FAILED) {
+    std::cerr << "ERROR SharedMemoryArena::SharedMemoryArena MAP_FAILED:" << errno << " name("
+              << name << ") size:" << size << std::endl;
+    return;
+  }
+
+  if (huge_pages) {
+    adviseHugePages(map, size);
+  }
+
+  memory = (uint8_t*)map;
+}
+
+//------------------------------------------------------------
+// SharedMemoryArena Destructor
+//------------------------------------------------------------
+SharedMemoryArena::~SharedMemoryArena() {
+  if (memory != nullptr) {
+    std::cout << "FREE " << name << " (" << size << ") ";
+    int res_unmap = munmap(memory, size);
+    std::cout << (res_unmap == 0 ? "OK " : "FAIL ") << std::endl;
+    memory = nullptr;
+  }
+  if (fd != -1) {
+    close(fd);
+    fd = -1;
+  }
+}
+
+//------------------------------------------------------------
+// SharedMemoryArena isAllocated
+//------------------------------------------------------------
+bool SharedMemoryArena::isAllocated() {
+  return memory != nullptr;
+}
+
+//------------------------------------------------------------
+// SharedMemoryArena getMemory
+//------------------------------------------------------------
+uint8_t* SharedMemoryArena::getMemory() {
+  return memory;
+}
+
+//------------------------------------------------------------
+// SharedMemoryArena release
+//------------------------------------------------------------
+void SharedMemoryArena::release(uint64_t offset, uint64_t length) {
+  std::cout << "RELEASE: " << name << " offset:" << offset << " size:" << length << std::endl;
+#ifdef __APPLE__
+  // no hole punching on apple, just zero memory
+  std::memset(memory + offset, 0, length);
+#else
+  if (fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, offset, length) == -1) {
+    std::cerr << "ERROR SharedMemoryArena::release fallocate:" << errno << " " << name
+              << std::endl;
+    std::memset(memory + offset, 0, length);
+  }
+#endif
+}
+
+//------------------------------------------------------------
+// SharedMemoryArena prefault
+//------------------------------------------------------------
+bool SharedMemoryArena::prefault(uint64_t offset, uint64_t length) {
+#ifdef __APPLE__
+  return false;
+#else
+  // allocates missing tmpfs pages, already allocated are left untouched
+  if (fallocate(fd, 0, offset, length) == -1) {
+    std::cerr << "ERROR SharedMemoryArena::prefault fallocate:" << errno << " " << name
+              << std::endl;
+    return false;
+  }
+  return true;
+#endif
+}
+
 /* ----------------------------------------------------------
 **  TESTING......
 ** ----------------------------------------------------------*/
@@ -102,11 +333,86 @@ void testAddMultipleRecords(Table<TestInfo>* t, uint32_t number, uint8_t numval
   // std::cout << "ADDED " << idx << " records" << std::endl;
 }
 
+// drops shared memory left by previous run before tables are opened
+template <typename ELEMENT_T>
+void removeTable(const std::string& name, uint16_t max_pages, uint32_t elements_in_page) {
+  {
+    Table<ELEMENT_T> old(name, max_pages, elements_in_page, 60);
+    old.cleanup();
+  }
+  // cleanup keeps table shared, other geometry needs new one
+  for (const char* suffix : {"", ":header", ":dedup", ":upsert", ":keys", ":arena"}) {
+    shm_unlink((name + suffix).c_str());
+  }
+}
+
+void testTableExpiration(StorageMode storage, bool huge_pages = false);
+void testSparePages();
+void testSharedTail();
+void testTailShards();
+void testBatchInsert();
+void testInlinePayload();
+void testSizeClasses();
+void testDedup();
+void testUpsert();
+void testSnapshot();
+void testReclamation();
+void testLockFreeReads();
+void testMaintenanceThread();
+void testOwnerDeath();
+void testDetachedHandles();
+
 //---------------------------------------------------------
 // Test::unit_test
 //---------------------------------------------------------
 int unit_test() {
-  Table<TestInfo> index("TT", 1000, 100, 60);
+  // filter of two keys sized for 10000 records, as Table makes it
+  std::vector<uint64_t> bits(2 * 131072 / 64, 0);
+  KeyFilter keys = {bits.data(), 131072 - 1};
+  for (uint32_t value = 0; value < 10000; ++value) {
+    keys.add(0, value * 2);
+  }
+  keys.add(1, 200);
+  uint32_t false_positives = 0;
+  for (uint32_t value = 0; value < 10000; ++value) {
+    assert(keys.may_contain(0, value * 2));
+    false_positives += keys.may_contain(0, value * 2 + 1);
+  }
+  assert(false_positives < 500);
+  assert(keys.may_contain(1, 200) && !keys.may_contain(1, 202));
+
+  testTableExpiration(StorageMode::PAGES);
+  testTableExpiration(StorageMode::ARENA);
+  testTableExpiration(StorageMode::PAGES, true /* huge pages */);
+  testSparePages();
+  testSharedTail();
+  testTailShards();
+  testBatchInsert();
+  testInlinePayload();
+  testSizeClasses();
+  testDedup();
+  testUpsert();
+  testSnapshot();
+  testReclamation();
+  testLockFreeReads();
+  testMaintenanceThread();
+  testOwnerDeath();
+  testDetachedHandles();
+
+  std::cout << "TEST: OK" << std::endl;
+
+  return 0;
+}
+
+//---------------------------------------------------------
+// Test::testTableExpiration
+//---------------------------------------------------------
+void testTableExpiration(StorageMode storage, bool huge_pages) {
+  TableOptions options;
+  options.storage = storage;
+  options.huge_pages = huge_pages;
+
+  Table<TestInfo> index("TT", 1000, 100, 60, options);
   index.cleanup();
   /* ----------------------------------------------------------
   **  Fill table
@@ -193,13 +499,664 @@ int unit_test() {
       assert(res.size() == 0);
   }
 
-  std::cout << "TEST: OK" << std::endl;
+  index.cleanup();
+}
 
-  return 0;
+//---------------------------------------------------------
+// Test::testSparePages
+//---------------------------------------------------------
+void testSparePages() {
+  TableOptions options;
+  options.spare_pages = 2;
+
+  Table<TestInfo> index("TS", 10, 100, 60, options);
+  index.cleanup();
+
+  // page 0 is used, 1 and 2 must be prepared in background
+  testAddMultipleRecords(&index, 1, 1);
+
+  bool prepared = false;
+  for (int retry = 0; retry < 100 && !prepared; ++retry) {
+    usleep(20000);
+    int fd = shm_open("TS:2", O_RDONLY, (mode_t)0666);
+    if (fd != -1) {
+      close(fd);
+      prepared = true;
+    }
+  }
+  assert(prepared);
+
+  // rollover to prepared page
+  testAddMultipleRecords(&index, 150, 2);
+  std::vector<uint32_t> res = check(index);
+  assert(res[1] == 1);
+  assert(res[2] == 150);
+
+  index.cleanup();
 }
-}  // namespace shared_mem
 
-int mainss() {
-  shared_mem::unit_test();
-  return 0;
+//---------------------------------------------------------
+// Test::testSharedTail
+//---------------------------------------------------------
+void testSharedTail() {
+  // two table instances act like two processes inserting into same tail page
+  Table<TestInfo> writer1("TW", 10, 100, 60);
+  Table<TestInfo> writer2("TW", 10, 100, 60);
+  writer1.cleanup();
+
+  for (uint32_t idx = 0; idx < 150; ++idx) {
+    testAddMultipleRecords(&writer1, 1, 1);
+    testAddMultipleRecords(&writer2, 1, 2);
+  }
+
+  std::vector<uint32_t> res = check(writer1);
+  assert(res[1] == 150);
+  assert(res[2] == 150);
+
+  writer1.cleanup();
+}
+
+//---------------------------------------------------------
+// Test::testTailShards
+//---------------------------------------------------------
+void testTailShards() {
+  TableOptions options;
+  options.tail_shards = 2;
+  Table<TestInfo> writer1("TH", 10, 100, 60, options);
+  Table<TestInfo> writer2("TH", 10, 100, 60, options);
+  writer1.cleanup();
+
+  // writers of different shards fill own pages
+  TestInfo info1 = {1};
+  TestInfo info2 = {2};
+  auto first1 = writer1.addRecord(&info1);
+  auto first2 = writer2.addRecord(&info2);
+  assert(first1.page_id != first2.page_id);
+  for (uint32_t idx = 1; idx < 150; ++idx) {
+    auto added1 = writer1.addRecord(&info1);
+    auto added2 = writer2.addRecord(&info2);
+    assert(added1.page_id != first2.page_id && added2.page_id != first1.page_id);
+  }
+
+  // readers see union of all pages
+  std::vector<uint32_t> res = check(writer1);
+  assert(res[1] == 150);
+  assert(res[2] == 150);
+
+  writer1.cleanup();
+}
+
+//---------------------------------------------------------
+// Test::testBatchInsert
+//---------------------------------------------------------
+void testBatchInsert() {
+  Table<TestInfo> index("TB", 3, 100, 60);
+  index.cleanup();
+
+  // 60 + 60 elements: second entry doesn't fit tail page and opens next one
+  std::vector<TestInfo> ones(60, {1});
+  std::vector<TestInfo> twos(60, {2});
+  std::vector<TestInfo> big(101, {3});
+  std::vector<RecordsBatchItem<TestInfo>> batch = {
+      {ones.data(), 60}, {big.data(), 101}, {twos.data(), 60}};
+
+  auto result = index.addRecords(batch);
+  assert(result.size() == 3);
+  assert(result[0].error == ErrorCode::NO_ERROR);
+  assert(result[1].error == ErrorCode::RECORD_SIZE_TO_BIG);
+  assert(result[2].error == ErrorCode::NO_ERROR);
+  assert(result[0].page_id != result[2].page_id);
+  assert(result[2].index == 0 && result[2].size == 60);
+
+  // table has 3 pages: third one is filled, rest of batch doesn't fit
+  batch = {{twos.data(), 60}, {ones.data(), 60}, {ones.data(), 60}};
+  result = index.addRecords(batch);
+  assert(result[0].error == ErrorCode::NO_ERROR);
+  assert(result[1].error == ErrorCode::NO_SPACE_TO_INSERT);
+  assert(result[2].error == ErrorCode::NO_SPACE_TO_INSERT);
+
+  std::vector<uint32_t> res = check(index);
+  assert(res[1] == 60);
+  assert(res[2] == 120);
+
+  index.cleanup();
 }
+
+//---------------------------------------------------------
+// Test::testInlinePayload
+//---------------------------------------------------------
+struct TestPayloadInfo {
+  uint32_t value;
+  PayloadRef ref;
+};
+
+void testInlinePayload() {
+  TableOptions options;
+  options.storage = StorageMode::ARENA;
+  options.page_extent_size = 64;
+  options.payload_ref = SHARED_MEM_COLUMN(TestPayloadInfo, ref);
+
+  Table<TestPayloadInfo> index("TI", 10, 100, 60, options);
+  index.cleanup();
+
+  // [size][20 bytes] takes 24 bytes of extent: two payloads per page
+  std::string payloads[3] = {"payload-0-----------", "payload-1-----------",
+                             "payload-2-----------"};
+  std::vector<ElementPointer<TestPayloadInfo>> results;
+  for (uint32_t idx = 0; idx < 3; ++idx) {
+    TestPayloadInfo info = {idx, {0, 0, 0}};
+    results.push_back(
+        index.addInlineRecord(&info, (const uint8_t*)payloads[idx].c_str(), payloads[idx].size()));
+    assert(results.back().error == ErrorCode::NO_ERROR);
+  }
+  assert(results[0].page_id == results[1].page_id);
+  assert(results[1].page_id != results[2].page_id);
+
+  for (uint32_t idx = 0; idx < 3; ++idx) {
+    TestPayloadInfo* info = results[idx].get_data();
+    assert(info->value == idx && info->ref.page_id == results[idx].page_id);
+
+    uint32_t size = 0;
+    const uint8_t* payload = index.getPayload(info->ref, size);
+    assert(std::string((const char*)payload, size) == payloads[idx]);
+  }
+
+  // payload doesn't fit page extent
+  TestPayloadInfo info = {9, {0, 0, 0}};
+  std::string big(61, 'x');
+  assert(index.addInlineRecord(&info, (const uint8_t*)big.c_str(), big.size()).error ==
+         ErrorCode::RECORD_SIZE_TO_BIG);
+
+  index.cleanup();
+
+  // payload slots: every page holds payloads of one size
+  options.extent_classes = {16, 32};
+  Table<TestPayloadInfo> classes_index("TY", 10, 100, 60, options);
+  classes_index.cleanup();
+
+  std::string sizes[] = {"abc", "payload-1-----------", "12345", "payload-2-----------",
+                         "payload-3-----------"};
+  std::vector<ElementPointer<TestPayloadInfo>> stored;
+  for (auto& payload : sizes) {
+    stored.push_back(
+        classes_index.addInlineRecord(&info, (const uint8_t*)payload.c_str(), payload.size()));
+    assert(stored.back().error == ErrorCode::NO_ERROR);
+  }
+  assert(stored[0].page_id == stored[2].page_id && stored[2].get_data()->ref.offset == 16);
+  assert(stored[1].page_id == stored[3].page_id && stored[1].page_id != stored[0].page_id);
+  assert(stored[4].page_id != stored[1].page_id && stored[4].page_id != stored[0].page_id);
+  for (uint32_t idx = 0; idx < stored.size(); ++idx) {
+    uint32_t size = 0;
+    const uint8_t* payload = classes_index.getPayload(stored[idx].get_data()->ref, size);
+    assert(std::string((const char*)payload, size) == sizes[idx]);
+  }
+
+  std::vector<SizeClassStats> stats = classes_index.sizeClassStats();
+  assert(stats.size() == 2);
+  assert(stats[0].pages == 1 && stats[0].reserved_extent == 32 && stats[0].used_extent == 20);
+  assert(stats[1].pages == 2 && stats[1].reserved_extent == 96 && stats[1].used_extent == 72);
+
+  // [size][29 bytes] doesn't fit largest slot
+  std::string over(29, 'x');
+  assert(classes_index.addInlineRecord(&info, (const uint8_t*)over.c_str(), over.size()).error ==
+         ErrorCode::RECORD_SIZE_TO_BIG);
+
+  classes_index.cleanup();
+  stats = classes_index.sizeClassStats();
+  assert(stats[0].pages == 0 && stats[1].reserved_extent == 0 && stats[1].used_extent == 0);
+}
+
+//---------------------------------------------------------
+// Test::testSizeClasses
+//---------------------------------------------------------
+void testSizeClasses() {
+  TableOptions options;
+  options.size_classes = {4, 8, 16};
+
+  Table<TestInfo> index("TC", 10, 100, 60, options);
+  index.cleanup();
+
+  std::vector<TestInfo> records(17, {1});
+  auto small1 = index.addRecord(records.data(), 3);
+  auto medium = index.addRecord(records.data(), 8);
+  auto small2 = index.addRecord(records.data(), 2);
+  assert(small1.error == ErrorCode::NO_ERROR && small1.size == 3);
+  assert(medium.error == ErrorCode::NO_ERROR);
+  assert(small2.error == ErrorCode::NO_ERROR);
+
+  // every class has its own pages, slots are fixed size
+  assert(small1.page_id == small2.page_id && small1.page_id != medium.page_id);
+  assert(small1.index == 0 && small2.index == 4);
+  assert(index.addRecord(records.data(), 17).error == ErrorCode::RECORD_SIZE_TO_BIG);
+
+  std::vector<SizeClassStats> stats = index.sizeClassStats();
+  assert(stats.size() == 3);
+  assert(stats[0].pages == 1 && stats[0].reserved_elements == 8 && stats[0].used_elements == 5);
+  assert(stats[1].pages == 1 && stats[1].reserved_elements == 8 && stats[1].used_elements == 8);
+  assert(stats[2].pages == 0 && stats[2].reserved_elements == 0);
+
+  // 100 / 4 slots per page: 26th small record opens second page
+  for (uint32_t idx = 0; idx < 24; ++idx) {
+    assert(index.addRecord(records.data(), 4).error == ErrorCode::NO_ERROR);
+  }
+  stats = index.sizeClassStats();
+  assert(stats[0].pages == 2 && stats[0].reserved_elements == 104);
+
+  index.cleanup();
+  stats = index.sizeClassStats();
+  assert(stats[0].pages == 0 && stats[0].used_elements == 0);
+}
+
+//---------------------------------------------------------
+// Test::testDedup
+//---------------------------------------------------------
+void testDedup() {
+  // records
+  TableOptions options;
+  options.dedup_buckets = 64;
+  Table<TestInfo> index("TD", 10, 100, 5, options);
+  index.cleanup();
+
+  std::vector<TestInfo> records = {{1}, {2}, {3}};
+  std::vector<TestInfo> other = {{1}, {2}, {4}};
+  auto first = index.addRecord(records.data(), 3, 5);
+  auto second = index.addRecord(records.data(), 3, 20);
+  auto third = index.addRecord(other.data(), 3);
+  assert(first.error == ErrorCode::NO_ERROR && second.error == ErrorCode::NO_ERROR);
+  assert(first.page_id == second.page_id && first.index == second.index);
+  assert(third.index == 3);
+
+  // page of shared records lives as long as the latest copy
+  timing::TimeLord time;
+  time += 10;
+  auto fourth = index.addRecord(records.data(), 3);
+  assert(fourth.page_id == first.page_id && fourth.index == first.index);
+  index.cleanup();
+
+  // inline payloads
+  TableOptions inline_options;
+  inline_options.page_extent_size = 1024;
+  inline_options.payload_ref = SHARED_MEM_COLUMN(TestPayloadInfo, ref);
+  inline_options.dedup_buckets = 1024;
+  Table<TestPayloadInfo> inline_index("TE", 10, 100, 60, inline_options);
+  inline_index.cleanup();
+
+  std::string payload = "same payload";
+  TestPayloadInfo info1 = {1, {0, 0, 0}};
+  TestPayloadInfo info2 = {2, {0, 0, 0}};
+  auto rec1 =
+      inline_index.addInlineRecord(&info1, (const uint8_t*)payload.c_str(), payload.size(), 5);
+  auto rec2 =
+      inline_index.addInlineRecord(&info2, (const uint8_t*)payload.c_str(), payload.size(), 5);
+  assert(rec1.index == 0 && rec2.index == 1);
+  assert(rec1.get_data()->ref.offset == rec2.get_data()->ref.offset);
+
+  uint32_t size = 0;
+  const uint8_t* stored = inline_index.getPayload(rec2.get_data()->ref, size);
+  assert(std::string((const char*)stored, size) == payload);
+
+  // payload is shared by records of other pages
+  TestPayloadInfo filler = {3, {0, 0, 0}};
+  uint16_t last_page = rec2.page_id;
+  for (uint32_t idx = 0; last_page == rec1.page_id; ++idx) {
+    std::string other = "other payload " + std::to_string(idx);
+    auto added =
+        inline_index.addInlineRecord(&filler, (const uint8_t*)other.c_str(), other.size(), 5);
+    assert(added.error == ErrorCode::NO_ERROR);
+    last_page = added.page_id;
+  }
+  auto rec3 = inline_index.addInlineRecord(&info1, (const uint8_t*)payload.c_str(), payload.size());
+  auto rec4 = inline_index.addInlineRecord(&info2, (const uint8_t*)payload.c_str(), payload.size());
+  assert(rec3.page_id == last_page && rec3.get_data()->ref.page_id == rec1.page_id);
+  assert(rec4.get_data()->ref.page_id == rec1.page_id);
+
+  // expired page of payload is kept while page of records pointing to it lives
+  time += MEMPAGE_REMOVE_EXPIRED_PAGES_DELAY_SEC / 2;
+  std::string fresh = "fresh payload";
+  inline_index.addInlineRecord(&filler, (const uint8_t*)fresh.c_str(), fresh.size());
+  time += MEMPAGE_REMOVE_EXPIRED_PAGES_DELAY_SEC / 2 + 10;
+  inline_index.addInlineRecord(&filler, (const uint8_t*)fresh.c_str(), fresh.size());
+  stored = inline_index.getPayload(rec3.get_data()->ref, size);
+  assert(stored != nullptr && std::string((const char*)stored, size) == payload);
+
+  // expired page is not used for dedup anymore
+  auto rec5 = inline_index.addInlineRecord(&info1, (const uint8_t*)payload.c_str(), payload.size());
+  assert(rec5.get_data()->ref.page_id == rec5.page_id);
+
+  // released after the last page of its records
+  time += 60 + MEMPAGE_REMOVE_EXPIRED_PAGES_DELAY_SEC + MEMPAGE_CHECK_EXPIRED_PAGES_INTERVAL_SEC;
+  inline_index.addInlineRecord(&filler, (const uint8_t*)fresh.c_str(), fresh.size());
+  time += MEMPAGE_CHECK_EXPIRED_PAGES_INTERVAL_SEC + 1;
+  inline_index.addInlineRecord(&filler, (const uint8_t*)fresh.c_str(), fresh.size());
+  assert(inline_index.sizeClassStats()[0].pages == 1);
+  inline_index.cleanup();
+}
+
+//---------------------------------------------------------
+// Test::testUpsert
+//---------------------------------------------------------
+struct TestKeyInfo {
+  uint32_t key;
+  uint32_t value;
+};
+
+class TestUpsertResult : public TableProcessor<TestKeyInfo> {
+ public:
+  void process_element(const TestKeyInfo& element) {
+    values.push_back(element.value);
+  }
+  void process_page(const PageView<TestKeyInfo>& page) {
+    ++pages;
+    TableProcessor<TestKeyInfo>::process_page(page);
+  }
+  std::vector<uint32_t> values;
+  uint32_t pages = 0;
+};
+
+std::vector<uint32_t> upsertValues(Table<TestKeyInfo>& index, uint32_t* pages = nullptr) {
+  TestUpsertResult result;
+  index.processRecords(result);
+  std::sort(result.values.begin(), result.values.end());
+  if (pages != nullptr) {
+    *pages = result.pages;
+  }
+  return result.values;
+}
+
+void testUpsert() {
+  for (PageFormat format : {PageFormat::ROWS, PageFormat::COLUMNS}) {
+    TableOptions options;
+    options.page_format = format;
+    if (format == PageFormat::COLUMNS) {
+      options.columns = {SHARED_MEM_COLUMN(TestKeyInfo, key), SHARED_MEM_COLUMN(TestKeyInfo, value)};
+    }
+    options.upsert_buckets = 64;
+    options.upsert_key = {SHARED_MEM_COLUMN(TestKeyInfo, key)};
+    Table<TestKeyInfo> index("TU", 10, 2, 60, options);
+    index.cleanup();
+
+    // latest record of key is live
+    TestKeyInfo records[] = {{1, 1}, {2, 2}, {1, 3}};
+    for (auto& record : records) {
+      assert(index.addRecord(&record).error == ErrorCode::NO_ERROR);
+    }
+    assert(upsertValues(index) == std::vector<uint32_t>({2, 3}));
+
+    std::vector<TestKeyInfo> batch = {{2, 4}, {3, 5}};
+    index.addRecords({{&batch[0], 1}, {&batch[1], 1}});
+    uint32_t pages = 0;
+    assert(upsertValues(index, &pages) == std::vector<uint32_t>({3, 4, 5}));
+
+    // first page has no live records and is not scanned
+    assert(pages == 2);
+
+    // expired page is reused without dead marks of previous records
+    timing::TimeLord time;
+    time += 100;
+    TestKeyInfo fresh[] = {{7, 7}, {8, 8}};
+    for (auto& record : fresh) {
+      assert(index.addRecord(&record).error == ErrorCode::NO_ERROR);
+    }
+    assert(upsertValues(index, &pages) == std::vector<uint32_t>({7, 8}) && pages == 1);
+    index.cleanup();
+  }
+
+  // colliding keys take next buckets, key without free bucket is not replaced
+  TableOptions options;
+  options.upsert_buckets = 2;
+  options.upsert_key = {SHARED_MEM_COLUMN(TestKeyInfo, key)};
+  Table<TestKeyInfo> index("TK", 10, 100, 60, options);
+  index.cleanup();
+
+  TestKeyInfo records[] = {{1, 1}, {2, 2}, {1, 3}, {2, 4}, {3, 5}, {3, 6}};
+  for (auto& record : records) {
+    assert(index.addRecord(&record).error == ErrorCode::NO_ERROR);
+  }
+  assert(upsertValues(index) == std::vector<uint32_t>({3, 4, 5, 6}));
+
+  // bucket of page reused 65536 times since is stale
+  index.table_index->getElements()[0].generation += 1 << 16;
+  TestKeyInfo later = {1, 7};
+  assert(index.addRecord(&later).error == ErrorCode::NO_ERROR);
+  assert(upsertValues(index) == std::vector<uint32_t>({3, 4, 5, 6, 7}));
+  index.cleanup();
+}
+
+//---------------------------------------------------------
+// Test::testSnapshot
+//---------------------------------------------------------
+void testSnapshot() {
+  std::string file_name = "/tmp/TP.snapshot";
+  Table<TestInfo> index("TP", 10, 100, 60);
+  Table<TestInfo> writer("TP", 10, 100, 60);  // other process
+  index.cleanup();
+
+  // first page expires before restart
+  testAddMultipleRecords(&index, 100, 1, 5);
+  testAddMultipleRecords(&index, 50, 2);
+
+  // writer could reserve slots and not fill them yet
+  writer.enterRead();
+  assert(!index.saveSnapshot(file_name));
+  writer.exitRead();
+  assert(index.saveSnapshot(file_name));
+  index.cleanup();
+
+  timing::TimeLord time;
+  time += 10;
+  assert(index.loadSnapshot(file_name));
+  std::vector<uint32_t> found = check(index);
+  assert(found.size() == 3 && found[1] == 0 && found[2] == 50);
+
+  // only empty table is loaded, gaps are used for new records
+  assert(!index.loadSnapshot(file_name));
+  testAddMultipleRecords(&index, 1, 3);
+  found = check(index);
+  assert(found[2] == 50 && found[3] == 1);
+  index.cleanup();
+
+  // inline payloads
+  TableOptions options;
+  options.storage = StorageMode::ARENA;
+  options.page_extent_size = 64;
+  options.payload_ref = SHARED_MEM_COLUMN(TestPayloadInfo, ref);
+  Table<TestPayloadInfo> inline_index("TN", 10, 100, 60, options);
+  inline_index.cleanup();
+
+  std::string payload = "payload";
+  TestPayloadInfo info = {1, {0, 0, 0}};
+  auto stored = inline_index.addInlineRecord(&info, (const uint8_t*)payload.c_str(), payload.size());
+  assert(inline_index.saveSnapshot(file_name));
+  inline_index.cleanup();
+  assert(inline_index.loadSnapshot(file_name));
+
+  uint32_t size = 0;
+  const uint8_t* loaded = inline_index.getPayload(stored.get_data()->ref, size);
+  assert(loaded != nullptr && std::string((const char*)loaded, size) == payload);
+  inline_index.cleanup();
+
+  // other table geometry
+  Table<TestInfo> other("TG", 10, 50, 60);
+  assert(!other.loadSnapshot(file_name));
+  other.cleanup();
+  unlink(file_name.c_str());
+}
+
+//---------------------------------------------------------
+// Test::testReclamation
+//---------------------------------------------------------
+void testReclamation() {
+  TableOptions options;
+  options.storage = StorageMode::ARENA;
+  {
+    Table<TestInfo> old("TR", 10, 100, 60, options);
+    old.cleanup();
+  }
+  Table<TestInfo> index("TR", 10, 100, 60, options);
+  Table<TestInfo> reader("TR", 10, 100, 60, options);  // other process
+
+  TestInfo info = {7};
+  auto stored = index.addRecord(&info);
+  testAddMultipleRecords(&index, 150, 1);
+  ElementPointer<TestInfo> seen(reader, stored.page_id, stored.index, stored.size);
+
+  // pages are hidden by cleanup, but memory is kept for reader
+  reader.enterRead();
+  assert(check(reader)[7] == 1);
+  index.cleanup();
+  assert(check(reader).size() == 0);
+  assert(!index.isEmpty() && seen.get_data()->value == 7);
+
+  // new records don't reuse retired pages
+  testAddMultipleRecords(&index, 1, 2);
+  std::vector<uint32_t> found = check(index);
+  assert(found.size() == 3 && found[2] == 1);
+  assert(seen.get_data()->value == 7);
+
+  // released by next maintenance
+  reader.exitRead();
+  timing::TimeLord time;
+  time += MEMPAGE_CHECK_EXPIRED_PAGES_INTERVAL_SEC + 1;
+  found = check(index);
+  assert(found.size() == 3 && found[2] == 1);
+  assert(seen.get_data()->value == 0);
+
+  index.cleanup();
+  assert(index.isEmpty());
+
+  // table stays shared after cleanup: process started later sees same records
+  Table<TestInfo> started_later("TR", 10, 100, 60, options);
+  testAddMultipleRecords(&started_later, 3, 4);
+  testAddMultipleRecords(&index, 2, 5);
+  found = check(index);
+  assert(found.size() == 6 && found[4] == 3 && found[5] == 2);
+  assert(check(started_later) == found);
+  index.cleanup();
+  assert(started_later.isEmpty());
+}
+
+//---------------------------------------------------------
+// Test::testLockFreeReads
+//---------------------------------------------------------
+void testLockFreeReads() {
+  {
+    Table<TestInfo> old("TL", 200, 10, 60);
+    old.cleanup();
+  }
+  // Table object per thread
+  Table<TestInfo> index("TL", 200, 10, 60);
+  Table<TestInfo> reader("TL", 200, 10, 60);
+
+  // pages are rolled over while reader scans index
+  const uint32_t records = 1000;
+  std::thread writer([&index, records]() { testAddMultipleRecords(&index, records, 1); });
+
+  uint32_t last_found = 0;
+  while (last_found < records) {
+    TestResult scan_result(&reader);
+    scan_result.go();
+    uint32_t found = scan_result.found.size() > 1 ? scan_result.found[1] : 0;
+    // written records never disappear
+    assert(found >= last_found && found <= records);
+    last_found = found;
+  }
+  writer.join();
+  index.cleanup();
+}
+
+//---------------------------------------------------------
+// Test::testMaintenanceThread
+//---------------------------------------------------------
+void testMaintenanceThread() {
+  {
+    Table<TestInfo> old("TM", 50, 10, 60);
+    old.cleanup();
+  }
+  Table<TestInfo> index("TM", 50, 10, 60);
+  testAddMultipleRecords(&index, 400, 1, 2);
+  assert(!index.isEmpty());
+
+  // all 40 pages expire at once and their reuse delay passes
+  timing::TimeLord time;
+  time += MEMPAGE_REMOVE_EXPIRED_PAGES_DELAY_SEC + 3;
+
+  // other process, its maintenance thread starts first round right away
+  // and speeds up while pages are left over
+  TableOptions options;
+  options.maintenance_thread = true;
+  Table<TestInfo> maintained("TM", 50, 10, 60, options);
+  for (uint32_t tries = 0; tries < 20 && !maintained.isEmpty(); ++tries) {
+    usleep(MEMPAGE_MAINTENANCE_BUSY_INTERVAL_MSEC * 1000);
+  }
+  assert(maintained.isEmpty());
+  assert(check(maintained).size() == 0);
+
+  index.cleanup();
+}
+
+//---------------------------------------------------------
+// Test::testOwnerDeath
+//---------------------------------------------------------
+void testOwnerDeath() {
+  removeTable<TestInfo>("TO", 10, 10);
+  Table<TestInfo> index("TO", 10, 10, 60);
+  testAddMultipleRecords(&index, 15, 1);
+
+  // other process dies holding lock in the middle of index update
+  pid_t child = fork();
+  if (child == 0) {
+    index.lock->enter();
+    index.begin_index_update();
+    _exit(0);
+  }
+  int status = 0;
+  waitpid(child, &status, 0);
+  TableHeader* header = index.header;
+  assert(header->index_version & 1);
+
+  // reader gives up waiting for update and takes lock, it's repaired
+  std::vector<uint32_t> found = check(index);
+  assert(found.size() == 2 && found[1] == 15);
+  assert((header->index_version & 1) == 0);
+
+  // next updates keep parity
+  testAddMultipleRecords(&index, 10, 1);
+  assert((header->index_version & 1) == 0);
+  found = check(index);
+  assert(found.size() == 2 && found[1] == 25);
+
+  index.cleanup();
+}
+
+//---------------------------------------------------------
+// Test::testDetachedHandles
+//---------------------------------------------------------
+void testDetachedHandles() {
+  removeTable<TestInfo>("TJ", 10, 10);
+  Table<TestInfo> index("TJ", 10, 10, 60);
+  Table<TestInfo> reader("TJ", 10, 10, 60);  // other thread
+  testAddMultipleRecords(&index, 5, 3);
+
+  // handle is dropped while other thread reads, it stays mapped
+  reader.enterRead();
+  SharedMemoryPage<TestInfo>* page = index.getPage(0);
+  {
+    std::lock_guard<std::mutex> guard(index.page_handles_mutex);
+    index.drop_page_handle(index.page_handles[0]);
+    index.free_detached_pages();
+  }
+  assert(index.detached_pages.size() == 1);
+  assert(page->getElements()[0].value == 3);
+
+  // deleted after reader is done, page is mapped again
+  reader.exitRead();
+  {
+    std::lock_guard<std::mutex> guard(index.page_handles_mutex);
+    index.free_detached_pages();
+  }
+  assert(index.detached_pages.empty());
+  assert(index.getPage(0)->getElements()[0].value == 3);
+
+  index.cleanup();
+}
+}  // namespace shared_mem
@@ -2,8 +2,14 @@
 #define SRC_SHAREDMEM_HPP
 
 #include <sys/mman.h>
+#include <atomic>
 #include <cinttypes>
+#include <condition_variable>
+#include <cstddef>
+#include <cstring>
 #include <iostream>
+#include <mutex>
+#include <thread>
 #include <vector>
 
 #include "locks.hpp"
@@ -11,9 +17,37 @@
 namespace shared_mem {
 
 #define MEMPAGE_NAME_MAX_LEN 20
+#define MEMPAGE_HUGE_PAGE_SIZE (2 * 1024 * 1024)
+#define MEMPAGE_MAX_PAGES 65536
+#define MEMPAGE_ZONES 4
+#define MEMPAGE_KEYS 2
+#define MEMPAGE_SIZE_CLASSES 40
+#define MEMPAGE_TAIL_SHARDS 16
+// page key filter bits per record and key field, rounded up to power of 2 (~3% false positives)
+#define MEMPAGE_KEY_FILTER_BITS_PER_KEY 10
 #define MEMPAGE_REMOVE_EXPIRED_PAGES_AT_ONCE 5
+// expired page memory is kept for rollover reuse, it's released after this delay
 #define MEMPAGE_REMOVE_EXPIRED_PAGES_DELAY_SEC 60
 #define MEMPAGE_CHECK_EXPIRED_PAGES_INTERVAL_SEC 5
+#define MEMPAGE_PREALLOCATE_INTERVAL_SEC 1
+// maintenance thread (TableOptions::maintenance_thread) doubles pages released per round
+// up to that while expired pages are left over, next round is started after busy interval
+#define MEMPAGE_MAINTENANCE_MAX_PAGES_AT_ONCE 1024
+#define MEMPAGE_MAINTENANCE_BUSY_INTERVAL_MSEC 100
+// shm object opened right after other process created it may be not truncated yet
+#define MEMPAGE_CREATE_WAIT_MSEC 1000
+// Table objects (of all processes) reading table at once, see Table::enterRead
+#define MEMPAGE_READER_SLOTS 64
+// buckets probed for record key (TableOptions::upsert_buckets)
+#define MEMPAGE_UPSERT_PROBES 8
+// processRecords reads index without lock, after that many changes of index it takes lock
+#define MEMPAGE_INDEX_READ_TRIES 100
+// Table::saveSnapshot file: "SHMSNAP" + version
+#define MEMPAGE_SNAPSHOT_MAGIC 0x0450414E534D4853ULL
+// Table::saveSnapshot waits that long for writers of slots reserved before it
+#define MEMPAGE_SNAPSHOT_WAIT_MSEC 1000
+// page data is placed at file offsets aligned for direct reads or mmap
+#define MEMPAGE_SNAPSHOT_ALIGN 4096
 static_assert(MEMPAGE_REMOVE_EXPIRED_PAGES_DELAY_SEC > MEMPAGE_CHECK_EXPIRED_PAGES_INTERVAL_SEC,
               "CHECK MEM CLEAR SETTINGS");
 
@@ -21,7 +55,20 @@ static_assert(MEMPAGE_REMOVE_EXPIRED_PAGES_DELAY_SEC > MEMPAGE_CHECK_EXPIRED_PAG
 #define LOWMEM_ERROR_PERCENT 3
 static_assert(LOWMEM_WARNING_PERCENT > LOWMEM_ERROR_PERCENT, "CHECK LOWMEM SETTINGS");
 
+int unit_test();
+
 bool checkSharedMemAvailability();
+// free /dev/shm space, no logging
+uint32_t sharedMemFreePercent();
+// ask kernel to back mapping with transparent huge pages, false if not supported
+bool adviseHugePages(void* memory, uint64_t size);
+// 64 bit FNV-1a of memory block, used by content dedup index
+uint64_t contentHash(const void* data, uint64_t size);
+// whole block file io at offset, false on error or end of file
+bool writeFileBlock(int fd, const void* data, uint64_t size, uint64_t offset);
+bool readFileBlock(int fd, void* data, uint64_t size, uint64_t offset);
+// size of opened shm object, waits up to MEMPAGE_CREATE_WAIT_MSEC while it's zero
+uint64_t sharedMemSize(int fd);
 
 // result of page insertion
 enum class ErrorCode : int {
@@ -31,16 +78,312 @@ enum class ErrorCode : int {
   CANT_FIND_PAGE = 3
 };
 
+// how elements are stored inside the table page
+enum class PageFormat : int {
+  ROWS = 0,    // [el1][el2][el3]... array of ELEMENT_T
+  COLUMNS = 1  // [el1.a][el2.a]...[el1.b][el2.b]... each field in its own contiguous column
+};
+
+// how table pages are backed by shared memory
+enum class StorageMode : int {
+  PAGES = 0,  // shm object per page "Table:idx", every process maps pages it uses
+  ARENA = 1   // one sparse shm object "Table:arena" with pages at fixed offsets, mapped once
+};
+
+// ELEMENT_T field description for PageFormat::COLUMNS pages
+struct ColumnInfo {
+  uint16_t offset;  // field offset inside ELEMENT_T
+  uint16_t size;    // field size in bytes
+};
+
+#define SHARED_MEM_COLUMN(type, field) \
+  { (uint16_t) offsetof(type, field), (uint16_t) sizeof(((type*)nullptr)->field) }
+
+// optional table settings
+struct TableOptions {
+  PageFormat page_format = PageFormat::ROWS;
+  StorageMode storage = StorageMode::PAGES;
+  // page size is rounded up to MEMPAGE_HUGE_PAGE_SIZE and mapping is advised for huge pages.
+  // falls back to regular pages if system has no shmem THP support
+  bool huge_pages = false;
+  // pages to create and prefault in background thread ahead of page rollover, 0 - disabled
+  uint16_t spare_pages = 0;
+  // expire, release and unmap pages in background thread instead of addRecord and
+  // processRecords. release rate grows with backlog and low memory
+  bool maintenance_thread = false;
+  // writers (Table objects) are spread over that many sets of tail pages, so concurrent
+  // inserts don't share pages. max MEMPAGE_TAIL_SHARDS, 1 - one tail for all
+  uint16_t tail_shards = 1;
+  // COLUMNS only: fields to store, column index == position in vector
+  std::vector<ColumnInfo> columns;
+  // unsigned integer fields (1, 2 or 4 bytes) to keep min/max per page for,
+  // zone index == position in vector, max MEMPAGE_ZONES
+  std::vector<ColumnInfo> zones;
+  // unsigned integer fields (1, 2 or 4 bytes) to keep membership filter per page for,
+  // key index == position in vector, max MEMPAGE_KEYS
+  std::vector<ColumnInfo> keys;
+  // bytes of variable length payloads stored inline after page elements, 0 - disabled.
+  // payload lives and expires with the page of its record (see Table::addInlineRecord),
+  // shared payload lives as long as pages of all its records (see dedup_buckets)
+  uint32_t page_extent_size = 0;
+  // PayloadRef field of ELEMENT_T, filled by Table::addInlineRecord
+  ColumnInfo payload_ref = {0, 0};
+  // slot sizes in elements, ascending, max MEMPAGE_SIZE_CLASSES. every page holds slots
+  // of one class, records take slot of the smallest class they fit. empty - slot == records.
+  // slot tails are not records, so it's for tables read by ElementPointer only (payloads)
+  std::vector<uint32_t> size_classes;
+  // inline payload slot sizes in page extent bytes (multiples of 4), ascending,
+  // max MEMPAGE_SIZE_CLASSES, can't be used with size_classes. every page holds payloads
+  // of one class, [size][payload] entry takes slot of the smallest class it fits in,
+  // so page extent is not left half empty by payload which doesn't fit its tail.
+  // empty - payloads are packed one after other
+  std::vector<uint32_t> extent_classes;
+  // buckets of content hash index ("<table>:dedup"), 0 - disabled. identical content is
+  // stored once: inline payloads if page_extent_size is set, ROWS records otherwise.
+  // page with shared records lives as long as the latest record that uses it, page with
+  // shared inline payload is pinned by pages of records pointing to it (not expired
+  // while any of them lives)
+  uint32_t dedup_buckets = 0;
+  // buckets of record key index ("<table>:upsert"), 0 - disabled. single records with
+  // equal upsert_key fields replace each other: previous record is marked dead in its
+  // page and skipped by processRecords. keep it well above number of live keys, record
+  // is not replaced if MEMPAGE_UPSERT_PROBES buckets are taken by other keys.
+  // can't be used with dedup of ROWS records or pages above 65536 elements
+  uint32_t upsert_buckets = 0;
+  std::vector<ColumnInfo> upsert_key;
+};
+
+// inline payload position: page extent of table page
+// extent holds [uint32_t size][payload bytes] entries
+struct PayloadRef {
+  uint16_t page_id;
+  uint16_t reserved;
+  uint32_t offset;  // from the extent begining
+};
+
+// copies PayloadRef into record field, records too small to hold PayloadRef
+// can't have inline payloads (Table::Table checks options.payload_ref)
+template <typename ELEMENT_T, bool FITS>
+struct PayloadRefWriter {
+  static void write(ELEMENT_T& record, uint32_t offset, const PayloadRef& ref) {
+    if (offset + sizeof(ref) <= sizeof(record)) {
+      std::memcpy((uint8_t*)&record + offset, &ref, sizeof(ref));
+    }
+  }
+};
+
+template <typename ELEMENT_T>
+struct PayloadRefWriter<ELEMENT_T, false> {
+  static void write(ELEMENT_T&, uint32_t, const PayloadRef&) {}
+};
+
 template <typename ELEMENT_T>
 class SharedMemoryPage;
 template <typename ELEMENT_T>
 class Table;
 
+//-----------------------------------------------
+// SharedMemoryArena  (StorageMode::ARENA table memory)
+//-----------------------------------------------
+class SharedMemoryArena {
+ public:
+  SharedMemoryArena(std::string name, uint64_t size, bool huge_pages = false);
+  ~SharedMemoryArena();
+
+  bool isAllocated();
+  uint8_t* getMemory();
+  // return memory range to the system, it reads as zeros afterwards
+  void release(uint64_t offset, uint64_t length);
+  // allocate memory range in advance, false if failed
+  bool prefault(uint64_t offset, uint64_t length);
+
+  static void unlink(std::string name) {
+    std::cout << "UNLINK: " << name << std::endl;
+    shm_unlink(name.c_str());
+  }
+
+  const std::string name;
+
+ private:
+  uint64_t size;
+  int fd = -1;  // kept open for release()
+  uint8_t* memory = nullptr;
+};
+
+// lock free min/max of value shared between processes
+inline void atomic_min(uint32_t& target, uint32_t value) {
+  uint32_t current = __atomic_load_n(&target, __ATOMIC_RELAXED);
+  while (value < current && !__atomic_compare_exchange_n(&target, &current, value, true,
+                                                         __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+  }
+}
+
+inline void atomic_max(uint32_t& target, uint32_t value) {
+  uint32_t current = __atomic_load_n(&target, __ATOMIC_RELAXED);
+  while (value > current && !__atomic_compare_exchange_n(&target, &current, value, true,
+                                                         __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+  }
+}
+
+// min/max values of TableOptions::zones fields of all records in page
+// empty zone: min = UINT32_MAX, max = 0
+struct ZoneMap {
+  uint32_t min[MEMPAGE_ZONES];
+  uint32_t max[MEMPAGE_ZONES];
+
+  // true if any value of zone could be in [from, to]
+  bool overlaps(uint16_t zone_idx, uint32_t from, uint32_t to) const {
+    return min[zone_idx] <= to && max[zone_idx] >= from;
+  }
+};
+
+// bloom filter (2 hashes) of TableOptions::keys fields of all records in page.
+// view of page filters kept in "<table>:keys" shared memory (see Table::page_keys),
+// every key field has filter of mask + 1 bits
+struct KeyFilter {
+  uint64_t* bits;
+  uint32_t mask;
+
+  void add(uint16_t key_idx, uint32_t value) {
+    uint64_t hash = value * 0x9E3779B97F4A7C15ULL;
+    set_bit(key_idx, hash >> 40);
+    set_bit(key_idx, hash >> 16);
+  }
+
+  // false if page has no such value, true if it may have
+  bool may_contain(uint16_t key_idx, uint32_t value) const {
+    uint64_t hash = value * 0x9E3779B97F4A7C15ULL;
+    return test_bit(key_idx, hash >> 40) && test_bit(key_idx, hash >> 16);
+  }
+
+ private:
+  uint64_t word(uint16_t key_idx, uint64_t hash) const {
+    return ((uint64_t)key_idx * (mask + 1ULL) + (hash & mask)) / 64;
+  }
+  void set_bit(uint16_t key_idx, uint64_t hash) {
+    __atomic_fetch_or(&bits[word(key_idx, hash)], 1ULL << (hash % 64), __ATOMIC_RELAXED);
+  }
+  bool test_bit(uint16_t key_idx, uint64_t hash) const {
+    return __atomic_load_n(&bits[word(key_idx, hash)], __ATOMIC_RELAXED) & (1ULL << (hash % 64));
+  }
+};
+
 // information about all open pages in all processes
-struct TablePageIndexElement {
+// cache line aligned: writers of different pages don't share lines
+struct alignas(64) TablePageIndexElement {
   uint32_t expire_at;
   uint32_t page_elements_available;
+  uint32_t page_extent_available;  // TableOptions::page_extent_size left
+  uint32_t page_elements_used;     // elements of records, without slot tails
+  uint32_t page_elements_dead;     // superseded records (TableOptions::upsert_buckets)
+  uint32_t page_extent_used;       // payload bytes, without slot tails
+  uint8_t size_class;              // TableOptions::size_classes or extent_classes index
+  uint32_t generation;             // incremented on page reuse, kept by clear_index_record
+  // [generation : 32][pages pinning it : 32], pages with records pointing to inline
+  // payloads of this page (TableOptions::dedup_buckets), reset on page reuse
+  uint64_t payload_pins;
   char page_name[MEMPAGE_NAME_MAX_LEN];
+  ZoneMap zones;
+  // page is not visible to new readers since TableHeader::epoch + 1 == retired_epoch,
+  // it's released or reused after older readers finished. 0 - not retired
+  uint32_t retired_epoch;
+};
+
+// space accounting of one size class (see TableOptions::size_classes & extent_classes),
+// counts pages which are not recycled yet, expired ones too
+struct SizeClassStats {
+  uint64_t pages;
+  uint64_t reserved_elements;  // taken by slots
+  uint64_t used_elements;      // reserved_elements - used_elements is lost to slot rounding
+  uint64_t reserved_extent;    // page extent bytes taken by inline payloads
+  uint64_t used_extent;
+};
+
+// content hash index bucket (TableOptions::dedup_buckets)
+// entry is a hint only: it's valid if page generation is the same and content matches
+struct DedupEntry {
+  uint64_t hash;
+  uint16_t page_id;
+  uint16_t reserved;
+  uint32_t generation;
+  uint32_t offset;  // element index or page extent offset of inline payload
+  uint32_t size;    // elements or inline payload bytes
+};
+
+// record key index bucket (TableOptions::upsert_buckets), 0 - empty
+// [page_id + 1 : 16][page generation : 32][element index : 16]
+using UpsertEntry = uint64_t;
+
+// reader of table pages (Table::enterRead)
+struct ReaderSlot {
+  uint32_t pid;    // 0 - free slot
+  uint32_t epoch;  // TableHeader::epoch + 1 at read start, 0 - not reading
+};
+
+// what table holds, for logs kept outside of shared memory (Table::version)
+struct TableVersion {
+  uint64_t instance;       // random id of shared memory, set when it's created
+  uint32_t cleanups;       // Table::cleanup calls
+  uint32_t snapshot_time;  // SnapshotHeader::created_at of loaded snapshot, 0 - none
+};
+
+// table state shared between processes ("<table>:header")
+struct TableHeader {
+  locks::SharedMutexState lock;  // Table::lock
+  // seqlock of index records: odd while writer holding lock reorganizes them
+  // (page rollover, release, cleanup), see Table::begin_index_update
+  uint32_t index_version;
+  // page for lock free inserts per writers shard and size class (see Table::reserve_in_tail),
+  // stored as page_id + 1: zeroed header has no tails, not page 0 in all shards
+  uint32_t tail_page_id[MEMPAGE_TAIL_SHARDS][MEMPAGE_SIZE_CLASSES];
+  // pages [0, high_water_mark) were used since cleanup
+  uint32_t high_water_mark;
+  // expired or released pages below high_water_mark, reused on rollover
+  uint64_t free_pages[MEMPAGE_MAX_PAGES / 64];
+  SizeClassStats class_stats[MEMPAGE_SIZE_CLASSES];
+  // incremented when pages are retired (see Table::reclaim_retired_pages)
+  uint32_t epoch;
+  ReaderSlot readers[MEMPAGE_READER_SLOTS];
+  // readers which got no slot, nothing is reclaimed while they read
+  uint32_t unslotted_readers;
+  TableVersion version;
+};
+
+// Table::saveSnapshot file: [SnapshotHeader][SnapshotPage x pages]...[page data]
+// page data: used elements (whole elements memory for COLUMNS), used extent, dead bitmap,
+// key filters.
+// table geometry must be the same to load it
+struct SnapshotHeader {
+  uint64_t magic;
+  uint32_t element_size;
+  uint32_t max_elements_in_page;
+  uint32_t page_extent_size;
+  uint32_t page_format;
+  uint32_t dead_bits_offset;
+  uint32_t pinned_bits_offset;
+  uint32_t pages;
+  uint32_t created_at;
+};
+
+struct SnapshotPage {
+  TablePageIndexElement record;
+  uint64_t data_offset;
+  uint32_t elements_bytes;
+  uint32_t extent_bytes;
+  uint32_t dead_bits_bytes;
+  uint32_t key_filter_bytes;
+  uint32_t pinned_bits_bytes;
+  uint16_t page_id;
+};
+
+// one entry of Table::addRecords batch: count elements starting at records
+// optional inline payload requires count == 1 (see Table::addInlineRecord)
+template <typename ELEMENT_T>
+struct RecordsBatchItem {
+  ELEMENT_T* records;
+  uint32_t count;
+  const uint8_t* payload;
+  uint32_t payload_size;
 };
 
 //-----------------------------------------------
@@ -50,15 +393,15 @@ template <typename ELEMENT_T>
 class ElementPointer {
  public:
   ElementPointer(Table<ELEMENT_T>& table, ErrorCode error)
-      : error(error), page_name(""), index(0), size(0), table(table){};
-  ElementPointer(Table<ELEMENT_T>& table, std::string page_name, uint32_t index, uint32_t size)
-      : error(ErrorCode::NO_ERROR), page_name(page_name), index(index), size(size), table(table){};
+      : error(error), page_id(0), index(0), size(0), table(table){};
+  ElementPointer(Table<ELEMENT_T>& table, uint16_t page_id, uint32_t index, uint32_t size)
+      : error(ErrorCode::NO_ERROR), page_id(page_id), index(index), size(size), table(table){};
 
   ELEMENT_T* get_data();
   operator ELEMENT_T*();
 
   const ErrorCode error;
-  const std::string page_name;
+  const uint16_t page_id;
   const uint32_t index;
   const uint32_t size;
 
@@ -66,6 +409,33 @@ class ElementPointer {
   Table<ELEMENT_T>& table;
 };
 
+//-----------------------------------------------
+// PageView  (read access to elements of one page)
+//-----------------------------------------------
+template <typename ELEMENT_T>
+class PageView {
+ public:
+  PageView(const Table<ELEMENT_T>& table, const ELEMENT_T* elements, uint32_t size,
+           const uint64_t* dead = nullptr)
+      : table(table), elements(elements), size(size), dead(dead){};
+
+  bool is_columnar() const;
+  // false if record was superseded (TableOptions::upsert_buckets)
+  bool is_live(uint32_t idx) const;
+  // ROWS: element pointer in shared memory
+  const ELEMENT_T& row(uint32_t idx) const;
+  // COLUMNS: pointer to the first value of column
+  template <typename T>
+  const T* column(uint16_t column_idx) const;
+  // copy element to local memory (any format)
+  void get(uint32_t idx, ELEMENT_T& element) const;
+
+  const Table<ELEMENT_T>& table;
+  const ELEMENT_T* const elements;
+  const uint32_t size;
+  const uint64_t* const dead;  // page bitmap of superseded records, nullptr - no upserts
+};
+
 //-----------------------------------------------
 // TableProcessor
 //-----------------------------------------------
@@ -75,6 +445,18 @@ class TableProcessor {
   // function that will be called for iterating over all not expired pages in table
   virtual void process_element(const ELEMENT_T& element) = 0;
 
+  // called for every not expired page. default calls process_element() for each element,
+  // override it to read only required columns of PageFormat::COLUMNS pages
+  virtual void process_page(const PageView<ELEMENT_T>& page);
+
+  // called before page is mapped, return false to skip whole page
+  virtual bool process_page_zones(const ZoneMap& zones) {
+    return true;
+  }
+  virtual bool process_page_keys(const KeyFilter& keys) {
+    return true;
+  }
+
   template <class T>
   friend class Table;
 };
@@ -86,37 +468,246 @@ template <typename ELEMENT_T>
 class Table {
  public:
   Table(std::string table_name, uint16_t table_max_pages, uint32_t max_elements_in_page,
-        uint32_t record_expire_seconds);
+        uint32_t record_expire_seconds, const TableOptions& options = TableOptions());
   // cleanup all shared memory mappings on exit
   ~Table();
 
   ElementPointer<ELEMENT_T> addRecord(ELEMENT_T* el, uint32_t size = 1,
                                       uint32_t lifetime_seconds = 0);
+  // one record with payload in the same page (TableOptions::page_extent_size),
+  // PayloadRef is written to TableOptions::payload_ref field of stored record.
+  // it points to identical payload of other page if it's found (dedup_buckets)
+  ElementPointer<ELEMENT_T> addInlineRecord(ELEMENT_T* el, const uint8_t* payload,
+                                            uint32_t payload_size, uint32_t lifetime_seconds = 0);
+  // payload stored by addInlineRecord, nullptr if ref is not valid
+  const uint8_t* getPayload(const PayloadRef& ref, uint32_t& payload_size);
+  // all batch entries are placed under one lock acquisition,
+  // result has ElementPointer (or error) for every entry in the same order
+  std::vector<ElementPointer<ELEMENT_T>> addRecords(
+      const std::vector<RecordsBatchItem<ELEMENT_T>>& batch, uint32_t lifetime_seconds = 0);
   void processRecords(TableProcessor<ELEMENT_T>& result);
+  // pages (and payloads) seen between enterRead and exitRead are not released or reused
+  // by any process. calls can be nested, processRecords and inserts do it themselves.
+  // not thread safe: reader slot belongs to Table object
+  void enterRead();
+  void exitRead();
+  // space accounting by size class, one entry if table has no size classes
+  std::vector<SizeClassStats> sizeClassStats();
+  // table lock acquisitions, wait & hold times of all processes (locks::statsText)
+  std::string lockStats();
+  // drop all records, /clear can run under load: table stays shared by all processes
+  // (shared memory is not unlinked), pages are released when their readers are done
   void cleanup();
+  // no pages were used since cleanup (or reboot)
+  bool isEmpty();
+  TableVersion version();
+  // not expired pages with their index records, pages keep their ids (records of
+  // other tables may refer to them). written to temporary file and renamed
+  bool saveSnapshot(const std::string& file_name);
+  // only into empty table (after cleanup or reboot), expired pages are skipped.
+  // dedup & upsert indexes start empty
+  bool loadSnapshot(const std::string& file_name);
 
  private:
-  SharedMemoryPage<ELEMENT_T>* localGetPageByName(const std::string& page_name_to_look);
-  SharedMemoryPage<ELEMENT_T>* getPageByName(const std::string& page_name_to_look);
+  std::string page_name(uint16_t page_id);
+  SharedMemoryPage<ELEMENT_T>* getPage(uint16_t page_id);
   void release_open_pages();
+  // non ARENA: page_handles_mutex must be held
+  SharedMemoryPage<ELEMENT_T>* map_page(uint16_t page_id);
+  bool release_page(uint16_t page_id);
   void clear_index_record(TablePageIndexElement& record);
+  // filters of page of shared index record
+  KeyFilter page_keys(const TablePageIndexElement& record);
   void release_expired_memory_pages();
-
-  locks::CriticalSection* lock;  // [interprocess memory access management]
-  std::vector<SharedMemoryPage<ELEMENT_T>*> opened_pages_list;
+  // retire & reclaim expired pages if no process did it this interval,
+  // true if pages were left over because of max_released
+  bool expire_pages(locks::SharedMutex& mutex, uint32_t current_time, uint16_t max_released,
+                    uint32_t release_delay);
+  void unmap_unlinked_pages();
+  // page_handles_mutex must be held
+  void drop_page_handle(SharedMemoryPage<ELEMENT_T>*& page);
+  void free_detached_pages();
+  // epoch based reclamation, must be called under lock
+  void retire_page(TablePageIndexElement& record);
+  bool reclaim_retired_pages(uint32_t current_time, uint16_t max_released,
+                             uint32_t release_delay);
+  uint32_t oldest_reader_epoch();
+  void take_reader_slot();
+  // index records seqlock (TableHeader::index_version), must be called under lock
+  void begin_index_update();
+  void end_index_update();
+  // SharedMutex repair: lock was taken from process died holding it
+  void repair_after_owner_death();
+  void write_elements(ELEMENT_T* page_elements, uint32_t element_idx, const ELEMENT_T* records,
+                      uint32_t records_count);
+  uint32_t field_value(const ELEMENT_T& record, const ColumnInfo& field);
+  ElementPointer<ELEMENT_T> insert_records(ELEMENT_T* records, uint32_t records_count,
+                                           uint32_t lifetime_seconds, const uint8_t* payload,
+                                           uint32_t payload_size);
+  bool reserve_in_tail(const ELEMENT_T* records, uint32_t records_count,
+                       const ZoneMap& records_zones, uint32_t expire_time, uint32_t current_time,
+                       uint8_t size_class, uint32_t extent_size, uint16_t& page_id,
+                       uint32_t& element_idx, uint32_t& extent_offset);
+  uint16_t take_free_page(uint32_t current_time, bool& was_cleared);
+  // tail page id of writer shard (TableOptions::tail_shards)
+  uint32_t& tail_page(uint8_t size_class);
+  void open_page(uint16_t page_id, bool was_cleared, const ELEMENT_T* records,
+                 uint32_t records_count, const ZoneMap& records_zones, uint32_t expire_time,
+                 uint8_t size_class, uint32_t extent_size);
+  // smallest class records (or their inline payload) fit in, UINT8_MAX if there is no such
+  uint8_t size_class(uint32_t records_count, uint32_t extent_size);
+  uint32_t slot_size(uint8_t size_class, uint32_t records_count);
+  uint32_t extent_slot_size(uint8_t size_class, uint32_t extent_size);
+  void count_slot(TablePageIndexElement& record, uint8_t size_class, uint32_t records_count,
+                  uint32_t extent_size);
+  bool reserve_extent(TablePageIndexElement& record, uint32_t extent_size,
+                      uint32_t& extent_offset);
+  // page extent bytes taken by [size][payload] entry, 4 bytes aligned
+  uint32_t payload_extent_size(uint32_t payload_size);
+  void write_record(SharedMemoryPage<ELEMENT_T>* page, uint32_t element_idx,
+                    const ELEMENT_T* records, uint32_t records_count, const PayloadRef* ref,
+                    const uint8_t* payload, uint32_t payload_size);
+
+  // content dedup (TableOptions::dedup_buckets)
+  bool find_duplicate(uint64_t hash, const uint8_t* data, uint32_t size, uint32_t expire_time,
+                      uint32_t current_time, DedupEntry& found);
+  void remember_content(uint64_t hash, uint16_t page_id, uint32_t offset, uint32_t size);
+  bool extend_page(uint16_t page_id, uint32_t generation, uint32_t expire_time,
+                   uint32_t current_time);
+  // inline payloads shared by pages: page of payload is pinned once by every page
+  // with records pointing to it, pins are dropped when that page expires
+  bool pin_page(uint16_t page_id, uint32_t generation, uint32_t current_time);
+  void unpin_page(uint16_t page_id, uint32_t generation);
+  // pin is dropped if record page pins payload page already
+  void keep_pin(SharedMemoryPage<ELEMENT_T>* record_page, uint16_t record_page_id,
+                uint16_t payload_page_id);
+  void unpin_pinned_pages(uint16_t page_id);
+  uint64_t* pinned_bits(SharedMemoryPage<ELEMENT_T>* page);
+
+  // latest record wins (TableOptions::upsert_buckets)
+  void supersede(const ELEMENT_T& record, uint16_t page_id, uint32_t element_idx);
+  SharedMemoryPage<ELEMENT_T>* live_upsert_page(UpsertEntry entry);
+  bool same_key(const ELEMENT_T& record, SharedMemoryPage<ELEMENT_T>* page,
+                uint32_t element_idx);
+  uint64_t* dead_bits(SharedMemoryPage<ELEMENT_T>* page);
+  ZoneMap records_zones(const ELEMENT_T* records, uint32_t records_count);
+  uint32_t expire_time(uint32_t current_time, uint32_t lifetime_seconds);
+  void request_spare_page();
+  void set_free_page(uint16_t page_id);
+  bool reserve_elements(TablePageIndexElement& record, uint32_t records_count,
+                        uint32_t& element_idx);
+  void update_index_record(TablePageIndexElement& record, const ZoneMap& records_zones,
+                           const ELEMENT_T* records, uint32_t records_count);
+
+  // spare pages preparation (TableOptions::spare_pages)
+  void preallocate_loop();
+  std::vector<uint16_t> spare_page_ids();
+  void prepare_page(uint16_t page_id);
+  void check_fields(const std::vector<ColumnInfo>& fields, uint16_t max_fields);
+
+  // background expiry (TableOptions::maintenance_thread)
+  void maintenance_loop();
+
+  locks::SharedMutex* lock;  // [interprocess memory access management]
+  // mapped pages by page_id, nullptr if not mapped by this process.
+  // read without lock by getPage, changed under page_handles_mutex
+  std::vector<SharedMemoryPage<ELEMENT_T>*> page_handles;
+  std::mutex page_handles_mutex;
+  // handles dropped from page_handles, other thread may still use one it got from
+  // getPage: deleted when readers older than TableHeader::epoch of detach are done
+  struct DetachedPage {
+    SharedMemoryPage<ELEMENT_T>* page;
+    uint32_t epoch;
+  };
+  std::vector<DetachedPage> detached_pages;
   SharedMemoryPage<TablePageIndexElement>* table_index;  // [INDEX]
+  SharedMemoryPage<TableHeader>* table_header;
+  TableHeader* header;  // table_header element
+  SharedMemoryPage<DedupEntry>* dedup_index = nullptr;
+  SharedMemoryPage<UpsertEntry>* upsert_index = nullptr;
+  // TableOptions::keys: key_filter_words per page
+  SharedMemoryPage<uint64_t>* key_filters = nullptr;
+  uint32_t key_filter_words = 0;
+  uint32_t key_filter_mask = 0;
+
+  // StorageMode::ARENA: page_handles are views of arena memory
+  SharedMemoryArena* arena = nullptr;
+  uint64_t arena_page_size = 0;
+
+  std::thread* preallocator = nullptr;
+  std::mutex preallocator_mutex;
+  std::condition_variable preallocator_wakeup;
+  bool preallocate_requested = false;
+  bool preallocator_stop = false;
+  // ARENA: last preallocator memory check, used instead of statvfs on rollover
+  std::atomic<bool> spare_memory_available{true};
+
+  std::thread* maintainer = nullptr;
+  std::mutex maintainer_mutex;
+  std::condition_variable maintainer_wakeup;
+  bool maintainer_stop = false;
 
   uint16_t table_max_pages;
   uint16_t last_known_index_length;
   uint32_t max_elements_in_page;
+  // elements + page extent + dead records bitmap + pinned pages bitmap,
+  // page memory size in ELEMENT_T units
+  uint32_t page_elements;
+  // upserts: bitmap position from page elements begining, bytes
+  uint32_t dead_bits_offset = 0;
+  // inline dedup: bitmap of pages pinned by this one, position from page elements begining
+  uint32_t pinned_bits_offset = 0;
   uint32_t record_expire_seconds;
   uint32_t time_to_check_page_expire = 0;
+  // TableHeader::readers index of this object, -1 - not taken yet or no free slot
+  int32_t reader_slot = -1;
+  uint32_t read_depth = 0;  // nested enterRead calls
+  // TableOptions::tail_shards index of this object, UINT16_MAX - not chosen yet
+  uint16_t tail_shard = UINT16_MAX;
+
+  const TableOptions options;
+  // COLUMNS: column position inside page elements memory
+  std::vector<uint32_t> column_offsets;
 
   template <class T>
   friend class SharedMemoryPage;
 
   template <class T>
   friend class ElementPointer;
+
+  // kills lock owner in the middle of index update
+  friend void testOwnerDeath();
+  // drops page handle other thread is reading
+  friend void testDetachedHandles();
+  // changes page generation above 16 bits
+  friend void testUpsert();
+
+  template <class T>
+  friend class PageView;
+};
+
+//-----------------------------------------------
+// TableReadGuard  (Table::enterRead for scope)
+//-----------------------------------------------
+template <typename ELEMENT_T>
+class TableReadGuard {
+ public:
+  // table can be nullptr (optional table), nothing is done then
+  TableReadGuard(Table<ELEMENT_T>* table) : table(table) {
+    if (table != nullptr) {
+      table->enterRead();
+    }
+  }
+  ~TableReadGuard() {
+    if (table != nullptr) {
+      table->exitRead();
+    }
+  }
+  TableReadGuard(const TableReadGuard&) = delete;
+  TableReadGuard& operator=(const TableReadGuard&) = delete;
+
+ private:
+  Table<ELEMENT_T>* table;
 };
 
 //-------------------------------------------------------
@@ -131,7 +722,12 @@ class SharedMemoryPage {
   ELEMENT_T* getElements();
 
  private:
-  SharedMemoryPage(std::string page_name, uint32_t elements);
+  SharedMemoryPage(std::string page_name, uint32_t elements, bool huge_pages = false);
+  // view of page placed in already mapped memory (StorageMode::ARENA)
+  SharedMemoryPage(std::string page_name, void* memory, uint32_t page_memory_size);
+
+  // page size including Page_information, aligned to system (or huge) page
+  static uint32_t memory_size(uint32_t elements, bool huge_pages = false);
 
   // every shared memory page has this properties:
   struct Page_information {
@@ -139,13 +735,20 @@ class SharedMemoryPage {
     uint32_t expiration_check;
   };
   Page_information* shared_pageinfo;
+  // elements follow Page_information, aligned for ELEMENT_T (TablePageIndexElement is 64)
+  static constexpr uint32_t elements_offset() {
+    return (sizeof(Page_information) + alignof(ELEMENT_T) - 1) / alignof(ELEMENT_T) *
+           alignof(ELEMENT_T);
+  }
 
   // page property
   std::string page_name;
+  uint16_t page_id = 0;  // position in table index
   uint32_t page_memory_size;
 
   // pointer looked to shared memory
   void* shared_memory;
+  bool owns_memory = true;  // munmap on destruction
   ELEMENT_T* shared_elements;
 
   static void unlink(std::string page_name) {
@@ -1,11 +1,14 @@
+#include <algorithm>
 #include <array>
 #include <cinttypes>
 #include <cstring>
 #include <iostream>
+#include <random>
 #include <vector>
 
 #include <errno.h>
 #include <fcntl.h> /* For O_* constants */
+#include <signal.h>
 #include <string.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
@@ -22,11 +25,15 @@ namespace shared_mem {
 *-----------------------------------------------------------------*/
 template <typename ELEMENT_T>
 Table<ELEMENT_T>::Table(std::string table_name, uint16_t table_max_pages,
-                        uint32_t max_elements_in_page, uint32_t record_expire_seconds)
+                        uint32_t max_elements_in_page, uint32_t record_expire_seconds,
+                        const TableOptions& options)
     : table_max_pages(table_max_pages),
       last_known_index_length(0),
       max_elements_in_page(max_elements_in_page),
-      record_expire_seconds(record_expire_seconds) {
+      page_elements(max_elements_in_page +
+                    (options.page_extent_size + sizeof(ELEMENT_T) - 1) / sizeof(ELEMENT_T)),
+      record_expire_seconds(record_expire_seconds),
+      options(options) {
   // max 6 digits (uint16_t) ->  ':65536' - suffix for pages
   if (table_name.length() > MEMPAGE_NAME_MAX_LEN - 6) {
     std::cerr << "ERROR Table::Table TABLE_NAME_TOO_LONG" << table_name
@@ -34,6 +41,72 @@ Table<ELEMENT_T>::Table(std::string table_name, uint16_t table_max_pages,
     throw "TABLE_NAME_TOO_LONG";
   }
 
+  // columns are placed one after another and must fit into page memory
+  // [a][a][a]...[a][b][b][b]...[b][c][c][c]...[c]
+  // ^ column_offsets[0]  ^ column_offsets[1]
+  if (options.page_format == PageFormat::COLUMNS) {
+    uint32_t columns_size = 0;
+    for (const auto& column : options.columns) {
+      if (column.offset + column.size > sizeof(ELEMENT_T)) {
+        std::cerr << "ERROR Table::Table BAD_COLUMN offset:" << column.offset
+                  << " size:" << column.size << std::endl;
+        throw "BAD_COLUMN";
+      }
+      column_offsets.push_back(columns_size * max_elements_in_page);
+      columns_size += column.size;
+    }
+
+    if (columns_size == 0 || columns_size > sizeof(ELEMENT_T)) {
+      std::cerr << "ERROR Table::Table BAD_COLUMNS_SIZE:" << columns_size << std::endl;
+      throw "BAD_COLUMNS_SIZE";
+    }
+  }
+
+  check_fields(options.zones, MEMPAGE_ZONES);
+  check_fields(options.keys, MEMPAGE_KEYS);
+
+  if (options.tail_shards == 0 || options.tail_shards > MEMPAGE_TAIL_SHARDS) {
+    std::cerr << "ERROR Table::Table BAD_TAIL_SHARDS:" << options.tail_shards << std::endl;
+    throw "BAD_TAIL_SHARDS";
+  }
+
+  if (options.size_classes.size() > MEMPAGE_SIZE_CLASSES) {
+    std::cerr << "ERROR Table::Table TOO_MANY_SIZE_CLASSES:" << options.size_classes.size()
+              << std::endl;
+    throw "TOO_MANY_SIZE_CLASSES";
+  }
+  for (uint16_t class_idx = 0; class_idx < options.size_classes.size(); ++class_idx) {
+    uint32_t size = options.size_classes[class_idx];
+    if (size == 0 || size > max_elements_in_page ||
+        (class_idx > 0 && size <= options.size_classes[class_idx - 1])) {
+      std::cerr << "ERROR Table::Table BAD_SIZE_CLASS:" << size << std::endl;
+      throw "BAD_SIZE_CLASS";
+    }
+  }
+
+  if (options.extent_classes.size() > MEMPAGE_SIZE_CLASSES ||
+      (!options.extent_classes.empty() && !options.size_classes.empty())) {
+    std::cerr << "ERROR Table::Table BAD_EXTENT_CLASSES:" << options.extent_classes.size()
+              << std::endl;
+    throw "BAD_EXTENT_CLASSES";
+  }
+  for (uint16_t class_idx = 0; class_idx < options.extent_classes.size(); ++class_idx) {
+    uint32_t size = options.extent_classes[class_idx];
+    if (size == 0 || size % 4 != 0 || size > options.page_extent_size ||
+        (class_idx > 0 && size <= options.extent_classes[class_idx - 1])) {
+      std::cerr << "ERROR Table::Table BAD_EXTENT_CLASS:" << size << std::endl;
+      throw "BAD_EXTENT_CLASS";
+    }
+  }
+
+  if (options.page_extent_size > 0 &&
+      (options.payload_ref.size != sizeof(PayloadRef) ||
+       options.payload_ref.offset + options.payload_ref.size > sizeof(ELEMENT_T))) {
+    std::cerr << "ERROR Table::Table BAD_PAYLOAD_REF offset:" << options.payload_ref.offset
+              << " size:" << options.payload_ref.size << std::endl;
+    throw "BAD_PAYLOAD_REF";
+  }
+
   // open existed index or make new one
   table_index = new SharedMemoryPage<TablePageIndexElement>(table_name, table_max_pages);
 
@@ -43,21 +116,189 @@ Table<ELEMENT_T>::Table(std::string table_name, uint16_t table_max_pages,
     throw "CANNOT_ALLOCATE_TABLE_INDEX";
   }
 
-  lock = new locks::CriticalSection(table_name);
+  // open existed header or make new one
+  table_header = new SharedMemoryPage<TableHeader>(table_name + ":header", 1);
+
+  if (!table_header->isAllocated()) {
+    std::cerr << "ERROR Table::Table CANNOT_ALLOCATE_TABLE_HEADER for: " << table_name
+              << std::endl;
+    throw "CANNOT_ALLOCATE_TABLE_HEADER";
+  }
+  header = table_header->getElements();
+
+  // zeroed header is new shared memory
+  uint64_t no_instance = 0;
+  uint64_t instance = ((uint64_t)std::random_device()() << 32) | std::random_device()() | 1;
+  __atomic_compare_exchange_n(&header->version.instance, &no_instance, instance, false,
+                              __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+
+  if (options.dedup_buckets > 0) {
+    // records are compared as they are stored in ROWS page
+    if (options.page_extent_size == 0 && options.page_format != PageFormat::ROWS) {
+      std::cerr << "ERROR Table::Table DEDUP_REQUIRES_ROWS_OR_EXTENT" << std::endl;
+      throw "DEDUP_REQUIRES_ROWS_OR_EXTENT";
+    }
+
+    dedup_index = new SharedMemoryPage<DedupEntry>(table_name + ":dedup", options.dedup_buckets);
+    if (!dedup_index->isAllocated()) {
+      std::cerr << "ERROR Table::Table CANNOT_ALLOCATE_TABLE_DEDUP for: " << table_name
+                << std::endl;
+      throw "CANNOT_ALLOCATE_TABLE_DEDUP";
+    }
+  }
+
+  if (options.upsert_buckets > 0) {
+    // duplicate records are not inserted, so they can't replace anything
+    if (options.dedup_buckets > 0 && options.page_extent_size == 0) {
+      std::cerr << "ERROR Table::Table UPSERT_WITH_RECORDS_DEDUP" << std::endl;
+      throw "UPSERT_WITH_RECORDS_DEDUP";
+    }
+    if (options.upsert_key.empty()) {
+      std::cerr << "ERROR Table::Table UPSERT_KEY_REQUIRED" << std::endl;
+      throw "UPSERT_KEY_REQUIRED";
+    }
+    for (const auto& field : options.upsert_key) {
+      if (field.offset + field.size > sizeof(ELEMENT_T)) {
+        std::cerr << "ERROR Table::Table BAD_UPSERT_KEY offset:" << field.offset
+                  << " size:" << field.size << std::endl;
+        throw "BAD_UPSERT_KEY";
+      }
+    }
+    // element index takes 16 bits of UpsertEntry
+    if (max_elements_in_page > UINT16_MAX + 1) {
+      std::cerr << "ERROR Table::Table UPSERT_PAGE_TOO_BIG elements:" << max_elements_in_page
+                << std::endl;
+      throw "UPSERT_PAGE_TOO_BIG";
+    }
+
+    // dead records bitmap follows page extent, aligned for atomic updates
+    dead_bits_offset = ((uint64_t)page_elements * sizeof(ELEMENT_T) + 7) & ~7ULL;
+    uint32_t bitmap_size = (max_elements_in_page + 63) / 64 * sizeof(uint64_t);
+    page_elements = (dead_bits_offset + bitmap_size + sizeof(ELEMENT_T) - 1) / sizeof(ELEMENT_T);
+
+    upsert_index =
+        new SharedMemoryPage<UpsertEntry>(table_name + ":upsert", options.upsert_buckets);
+    if (!upsert_index->isAllocated()) {
+      std::cerr << "ERROR Table::Table CANNOT_ALLOCATE_TABLE_UPSERT for: " << table_name
+                << std::endl;
+      throw "CANNOT_ALLOCATE_TABLE_UPSERT";
+    }
+  }
+
+  // shared inline payloads: bitmap of pinned pages follows dead records bitmap
+  if (dedup_index != nullptr && options.page_extent_size > 0) {
+    pinned_bits_offset = ((uint64_t)page_elements * sizeof(ELEMENT_T) + 7) & ~7ULL;
+    uint32_t bitmap_size = (table_max_pages + 63) / 64 * sizeof(uint64_t);
+    page_elements =
+        (pinned_bits_offset + bitmap_size + sizeof(ELEMENT_T) - 1) / sizeof(ELEMENT_T);
+  }
+
+  if (!options.keys.empty()) {
+    uint64_t filter_bits = 64;
+    while (filter_bits < (uint64_t)max_elements_in_page * MEMPAGE_KEY_FILTER_BITS_PER_KEY) {
+      filter_bits *= 2;
+    }
+    key_filter_mask = filter_bits - 1;
+    key_filter_words = filter_bits / 64 * options.keys.size();
+
+    key_filters = new SharedMemoryPage<uint64_t>(table_name + ":keys",
+                                                 key_filter_words * (uint32_t)table_max_pages);
+    if (!key_filters->isAllocated()) {
+      std::cerr << "ERROR Table::Table CANNOT_ALLOCATE_TABLE_KEYS for: " << table_name
+                << std::endl;
+      throw "CANNOT_ALLOCATE_TABLE_KEYS";
+    }
+  }
+
+  if (options.storage == StorageMode::ARENA) {
+    arena_page_size =
+        SharedMemoryPage<ELEMENT_T>::memory_size(page_elements, options.huge_pages);
+    arena = new SharedMemoryArena(table_name + ":arena", arena_page_size * table_max_pages,
+                                  options.huge_pages);
+
+    if (!arena->isAllocated()) {
+      std::cerr << "ERROR Table::Table CANNOT_ALLOCATE_TABLE_ARENA for: " << table_name
+                << " pages:" << table_max_pages << std::endl;
+      throw "CANNOT_ALLOCATE_TABLE_ARENA";
+    }
+  }
+
+  page_handles.resize(table_max_pages, nullptr);
+
+  lock = new locks::SharedMutex(&header->lock, table_name,
+                                [this]() { repair_after_owner_death(); });
+
+  if (options.spare_pages > 0) {
+    preallocator = new std::thread(&Table<ELEMENT_T>::preallocate_loop, this);
+  }
+  if (options.maintenance_thread) {
+    maintainer = new std::thread(&Table<ELEMENT_T>::maintenance_loop, this);
+  }
   std::cout << "Table::Table (" << table_name << ") OK" << std::endl;
 }
 
+//-----------------------------------------------------
+// check_fields      zones & keys must be unsigned integers
+//-----------------------------------------------------
+template <typename ELEMENT_T>
+void Table<ELEMENT_T>::check_fields(const std::vector<ColumnInfo>& fields, uint16_t max_fields) {
+  if (fields.size() > max_fields) {
+    std::cerr << "ERROR Table::Table TOO_MANY_FIELDS:" << fields.size() << std::endl;
+    throw "TOO_MANY_FIELDS";
+  }
+  for (const auto& field : fields) {
+    if (field.offset + field.size > sizeof(ELEMENT_T) ||
+        (field.size != 1 && field.size != 2 && field.size != 4)) {
+      std::cerr << "ERROR Table::Table BAD_FIELD offset:" << field.offset
+                << " size:" << field.size << std::endl;
+      throw "BAD_FIELD";
+    }
+  }
+}
+
 //-----------------------------------------------------
 // Table Destructor
 //-----------------------------------------------------
 template <typename ELEMENT_T>
 Table<ELEMENT_T>::~Table() {
   std::cout << "TABLE (" << table_index->page_name << ") destructor... ";
+  if (preallocator != nullptr) {
+    {
+      std::lock_guard<std::mutex> guard(preallocator_mutex);
+      preallocator_stop = true;
+    }
+    preallocator_wakeup.notify_one();
+    preallocator->join();
+    delete preallocator;
+  }
+  if (maintainer != nullptr) {
+    {
+      std::lock_guard<std::mutex> guard(maintainer_mutex);
+      maintainer_stop = true;
+    }
+    maintainer_wakeup.notify_one();
+    maintainer->join();
+    delete maintainer;
+  }
+
+  if (reader_slot >= 0) {
+    __atomic_store_n(&header->readers[reader_slot].epoch, 0, __ATOMIC_RELEASE);
+    __atomic_store_n(&header->readers[reader_slot].pid, 0, __ATOMIC_RELEASE);
+  }
+
   // cleanup all shared memory mappings on exit
   release_open_pages();
+  for (auto& detached : detached_pages) {
+    delete detached.page;
+  }
 
   // delete index
   delete table_index;
+  delete table_header;
+  delete dedup_index;
+  delete upsert_index;
+  delete key_filters;
+  delete arena;
   delete lock;
   std::cout << "OK" << std::endl;
 }
@@ -67,9 +308,43 @@ Table<ELEMENT_T>::~Table() {
 //-----------------------------------------------------
 template <typename ELEMENT_T>
 void Table<ELEMENT_T>::clear_index_record(TablePageIndexElement& record) {
+  // page data is gone, remove it from size class accounting
+  if (record.page_name[0] != 0) {
+    SizeClassStats& stats = header->class_stats[record.size_class];
+    __atomic_fetch_sub(&stats.pages, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_sub(&stats.reserved_elements,
+                       max_elements_in_page - record.page_elements_available, __ATOMIC_RELAXED);
+    __atomic_fetch_sub(&stats.used_elements, record.page_elements_used, __ATOMIC_RELAXED);
+    __atomic_fetch_sub(&stats.reserved_extent,
+                       options.page_extent_size - record.page_extent_available, __ATOMIC_RELAXED);
+    __atomic_fetch_sub(&stats.used_extent, record.page_extent_used, __ATOMIC_RELAXED);
+  }
+
   record.expire_at = 0;
   record.page_elements_available = max_elements_in_page;
+  record.page_extent_available = options.page_extent_size;
+  record.page_elements_used = 0;
+  record.page_elements_dead = 0;
+  record.page_extent_used = 0;
+  record.size_class = 0;
   record.page_name[0] = 0;
+  record.retired_epoch = 0;
+  for (uint16_t zone_idx = 0; zone_idx < MEMPAGE_ZONES; ++zone_idx) {
+    record.zones.min[zone_idx] = UINT32_MAX;
+    record.zones.max[zone_idx] = 0;
+  }
+  if (key_filters != nullptr) {
+    std::memset(page_keys(record).bits, 0, key_filter_words * sizeof(uint64_t));
+  }
+}
+
+//-----------------------------------------------------
+// page_keys
+//-----------------------------------------------------
+template <typename ELEMENT_T>
+KeyFilter Table<ELEMENT_T>::page_keys(const TablePageIndexElement& record) {
+  uint64_t page_id = &record - table_index->shared_elements;
+  return {key_filters->shared_elements + page_id * key_filter_words, key_filter_mask};
 }
 
 //-----------------------------------------------------
@@ -79,288 +354,1984 @@ template <typename ELEMENT_T>
 void Table<ELEMENT_T>::processRecords(TableProcessor<ELEMENT_T>& processor) {
   // check if there is time to release some pages
   release_expired_memory_pages();
+  // selected pages are scanned without lock
+  TableReadGuard<ELEMENT_T> guard(this);
 
-  // *** Make a copy to local heap ***
-  lock->enter();
-
-  std::vector<TablePageIndexElement> records_to_scan;
-  records_to_scan.reserve(opened_pages_list.size());  // optimisation
+  // page_id and elements count of pages to scan
+  std::vector<std::pair<uint16_t, uint32_t>> pages_to_scan;
+  pages_to_scan.reserve(__atomic_load_n(&header->high_water_mark, __ATOMIC_RELAXED));
 
   uint32_t timestamp_now = timing::getTimestampSec();
 
   TablePageIndexElement* index_first = table_index->getElements();
   TablePageIndexElement* index_current;
 
-  // search for pages to scan (not expired)
-  for (uint16_t idx = 0; idx < table_max_pages; ++idx) {
-    // current page row (pointer to shared memory)
-    index_current = index_first + idx;
+  // *** Make a copy to local heap ***
+  // without lock: pages are collected again if index was reorganized meanwhile,
+  // lock is taken only if it happens too often
+  bool locked = false;
+  for (uint32_t tries = 0;; ++tries) {
+    if (tries == MEMPAGE_INDEX_READ_TRIES) {
+      // writer died in the middle of update: lock repairs index version
+      // (repair_after_owner_death), it's even under lock
+      lock->enter();
+      locked = true;
+    }
+
+    uint32_t version = __atomic_load_n(&header->index_version, __ATOMIC_ACQUIRE);
+    if (version & 1) {
+      continue;
+    }
+    pages_to_scan.clear();
+
+    // search for pages to scan (not expired)
+    // [expired][data][zero][data][expired][data][unused][unused]...[unused]
+    //            ^            ^              ^  ^--- high_water_mark
+    uint32_t high_water_mark = __atomic_load_n(&header->high_water_mark, __ATOMIC_ACQUIRE);
+    for (uint16_t idx = 0; idx < high_water_mark; ++idx) {
+      // current page row (pointer to shared memory)
+      index_current = index_first + idx;
+
+      // if page not empty and not expired
+      if (__atomic_load_n(&index_current->expire_at, __ATOMIC_RELAXED) >= timestamp_now) {
+        // writers reserve slots without lock
+        uint32_t available =
+            __atomic_load_n(&index_current->page_elements_available, __ATOMIC_ACQUIRE);
+        if (available < max_elements_in_page) {
+          // no record in page could pass processor filters
+          if (!options.zones.empty() && !processor.process_page_zones(index_current->zones)) {
+            continue;
+          }
+          if (!options.keys.empty() && !processor.process_page_keys(page_keys(*index_current))) {
+            continue;
+          }
+          // every record was replaced by newer one
+          if (upsert_index != nullptr &&
+              __atomic_load_n(&index_current->page_elements_dead, __ATOMIC_RELAXED) >=
+                  __atomic_load_n(&index_current->page_elements_used, __ATOMIC_RELAXED)) {
+            continue;
+          }
+
+          pages_to_scan.push_back({idx, max_elements_in_page - available});
+        }
+      }
+    }
 
-    // if page not empty and not expired
-    if (index_current->expire_at >= timestamp_now) {
-      // [expired][expired][data][expired][data][expired][expired][expired][expired][zero][unused][unused]...[unused]
-      //                     ^              ^
-      records_to_scan.push_back(*index_current);
-      // last_not_expired_idx = idx;
-    }
-    // or not used yet
-    else if (index_current->expire_at == 0) {
-      // [expired][expired][data][expired][data][expired][expired][expired][expired][zero][unused][unused]...[unused]
-      //                                                                              ^
-      // stop here. next pages are unused
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (locked || __atomic_load_n(&header->index_version, __ATOMIC_RELAXED) == version) {
       break;
-    } else {
-      // [expired][expired][data][expired][data][expired][expired][expired][expired][zero][unused][unused]...[unused]
-      //   ^        ^              ^              ^        ^        ^        ^
     }
   }
 
-  lock->exit();
+  if (locked) {
+    lock->exit();
+  }
 
   // process every element in every page
-  for (const auto& record : records_to_scan) {
+  for (const auto& page_to_scan : pages_to_scan) {
     // call table processor routine
-    SharedMemoryPage<ELEMENT_T>* page = getPageByName(record.page_name);
+    SharedMemoryPage<ELEMENT_T>* page = getPage(page_to_scan.first);
     if (page == nullptr) {
       std::cerr << "ERROR Table::processRecords Cannot allocate page Table::processRecords()"
                 << std::endl;
       continue;
     }
 
-    if (max_elements_in_page == record.page_elements_available) {
+    // go throught all elements and apply process function
+    processor.process_page(
+        PageView<ELEMENT_T>(*this, page->getElements(), page_to_scan.second, dead_bits(page)));
+  }
+}
+
+//-----------------------------------------------------
+// isEmpty
+//-----------------------------------------------------
+template <typename ELEMENT_T>
+bool Table<ELEMENT_T>::isEmpty() {
+  return __atomic_load_n(&header->high_water_mark, __ATOMIC_ACQUIRE) == 0;
+}
+
+//-----------------------------------------------------
+// version
+//-----------------------------------------------------
+template <typename ELEMENT_T>
+TableVersion Table<ELEMENT_T>::version() {
+  TableVersion result;
+  result.instance = __atomic_load_n(&header->version.instance, __ATOMIC_ACQUIRE);
+  result.cleanups = __atomic_load_n(&header->version.cleanups, __ATOMIC_ACQUIRE);
+  result.snapshot_time = __atomic_load_n(&header->version.snapshot_time, __ATOMIC_ACQUIRE);
+  return result;
+}
+
+//-----------------------------------------------------
+// cleanup
+//-----------------------------------------------------
+// table is emptied in place: processes which are running or start later share the same
+// header, lock and index. retired pages are released when their readers are done
+template <typename ELEMENT_T>
+void Table<ELEMENT_T>::cleanup() {
+  lock->enter();
+  uint16_t idx = 0;
+  TablePageIndexElement* index_first = table_index->getElements();
+  TablePageIndexElement* index_current;
+
+  // hide all used pages, other processes may still scan them
+  begin_index_update();
+  for (idx = 0; idx < header->high_water_mark; ++idx) {
+    // current page row (pointer to shared memory)
+    index_current = index_first + idx;
+
+    if (index_current->expire_at > 0) {
+      clear_index_record(*index_current);
+      retire_page(*index_current);
+    }
+  }
+  end_index_update();
+  __atomic_add_fetch(&header->epoch, 1, __ATOMIC_SEQ_CST);
+  __atomic_add_fetch(&header->version.cleanups, 1, __ATOMIC_SEQ_CST);
+
+  std::memset(header->tail_page_id, 0, sizeof(header->tail_page_id));
+  std::memset(header->free_pages, 0, sizeof(header->free_pages));
+  std::memset(header->class_stats, 0, sizeof(header->class_stats));
+  table_index->shared_pageinfo->expiration_check = 0;
+  if (dedup_index != nullptr) {
+    std::memset(dedup_index->shared_elements, 0, sizeof(DedupEntry) * options.dedup_buckets);
+  }
+  if (upsert_index != nullptr) {
+    std::memset(upsert_index->shared_elements, 0, sizeof(UpsertEntry) * options.upsert_buckets);
+  }
+
+  // pages nobody reads are released now, the rest by release_expired_memory_pages()
+  reclaim_retired_pages(timing::getTimestampSec(), UINT16_MAX,
+                        MEMPAGE_REMOVE_EXPIRED_PAGES_DELAY_SEC);
+  lock->exit();
+}
+
+//-----------------------------------------------------
+// saveSnapshot
+//-----------------------------------------------------
+template <typename ELEMENT_T>
+bool Table<ELEMENT_T>::saveSnapshot(const std::string& file_name) {
+  uint32_t current_time = timing::getTimestampSec();
+  SnapshotHeader snapshot_header = {MEMPAGE_SNAPSHOT_MAGIC,
+                                    sizeof(ELEMENT_T),
+                                    max_elements_in_page,
+                                    options.page_extent_size,
+                                    (uint32_t)options.page_format,
+                                    dead_bits_offset,
+                                    pinned_bits_offset,
+                                    0,
+                                    current_time};
+  uint32_t dead_bits_bytes =
+      upsert_index ? (max_elements_in_page + 63) / 64 * sizeof(uint64_t) : 0;
+  uint32_t pinned_bits_bytes =
+      pinned_bits_offset ? (table_max_pages + 63) / 64 * sizeof(uint64_t) : 0;
+
+  // copy of index records, page data is written without lock
+  std::vector<SnapshotPage> pages;
+  lock->enter();
+  // lock free writers could reserve slots of copied records and not fill them yet
+  uint32_t snapshot_epoch = __atomic_add_fetch(&header->epoch, 1, __ATOMIC_SEQ_CST);
+  for (uint16_t idx = 0; idx < header->high_water_mark; ++idx) {
+    const TablePageIndexElement& record = table_index->shared_elements[idx];
+    uint32_t available = __atomic_load_n(&record.page_elements_available, __ATOMIC_ACQUIRE);
+    // expired page is kept if live pages use its inline payloads
+    bool pinned = (uint32_t)__atomic_load_n(&record.payload_pins, __ATOMIC_ACQUIRE) > 0;
+    if ((record.expire_at < current_time && !pinned) || available >= max_elements_in_page) {
+      continue;
+    }
+
+    SnapshotPage page;
+    std::memset(&page, 0, sizeof(page));
+    page.record = record;
+    page.page_id = idx;
+    page.elements_bytes =
+        (options.page_format == PageFormat::COLUMNS ? max_elements_in_page
+                                                    : max_elements_in_page - available) *
+        sizeof(ELEMENT_T);
+    page.extent_bytes = options.page_extent_size -
+                        __atomic_load_n(&record.page_extent_available, __ATOMIC_ACQUIRE);
+    page.dead_bits_bytes = dead_bits_bytes;
+    page.key_filter_bytes = key_filter_words * sizeof(uint64_t);
+    page.pinned_bits_bytes = pinned_bits_bytes;
+    pages.push_back(page);
+  }
+  lock->exit();
+
+  // writers pin table for the write, ones of copied slots have older epoch
+  for (uint32_t waited = 0; oldest_reader_epoch() <= snapshot_epoch; ++waited) {
+    if (waited >= MEMPAGE_SNAPSHOT_WAIT_MSEC) {
+      std::cerr << "ERROR Table::saveSnapshot writers are not finished:" << file_name
+                << std::endl;
+      return false;
+    }
+    usleep(1000);
+  }
+  // copied pages are not released while they are written
+  TableReadGuard<ELEMENT_T> guard(this);
+
+  snapshot_header.pages = pages.size();
+  uint64_t offset = sizeof(snapshot_header) + sizeof(SnapshotPage) * pages.size();
+  for (auto& page : pages) {
+    offset = (offset + MEMPAGE_SNAPSHOT_ALIGN - 1) / MEMPAGE_SNAPSHOT_ALIGN * MEMPAGE_SNAPSHOT_ALIGN;
+    page.data_offset = offset;
+    offset += page.elements_bytes + page.extent_bytes + page.dead_bits_bytes +
+              page.key_filter_bytes + page.pinned_bits_bytes;
+  }
+
+  // other processes could save the same file
+  std::string temp_name = file_name + "." + std::to_string(getpid()) + ".tmp";
+  int fd = open(temp_name.c_str(), O_WRONLY | O_CREAT | O_TRUNC, (mode_t)0644);
+  if (fd == -1) {
+    std::cerr << "ERROR Table::saveSnapshot cannot create:" << temp_name << " errno:" << errno
+              << std::endl;
+    return false;
+  }
+
+  bool good = writeFileBlock(fd, &snapshot_header, sizeof(snapshot_header), 0) &&
+              writeFileBlock(fd, pages.data(), sizeof(SnapshotPage) * pages.size(),
+                             sizeof(snapshot_header));
+  for (const auto& page : pages) {
+    if (!good) {
+      break;
+    }
+    SharedMemoryPage<ELEMENT_T>* memory_page = getPage(page.page_id);
+    if (memory_page == nullptr) {
+      std::cerr << "ERROR Table::saveSnapshot page == nullptr" << std::endl;
+      good = false;
+      break;
+    }
+
+    const uint8_t* elements = (const uint8_t*)memory_page->shared_elements;
+    good = writeFileBlock(fd, elements, page.elements_bytes, page.data_offset) &&
+           writeFileBlock(fd, elements + (uint64_t)max_elements_in_page * sizeof(ELEMENT_T),
+                          page.extent_bytes, page.data_offset + page.elements_bytes) &&
+           writeFileBlock(fd, elements + dead_bits_offset, page.dead_bits_bytes,
+                          page.data_offset + page.elements_bytes + page.extent_bytes) &&
+           (key_filters == nullptr ||
+            writeFileBlock(fd, page_keys(table_index->shared_elements[page.page_id]).bits,
+                           page.key_filter_bytes,
+                           page.data_offset + page.elements_bytes + page.extent_bytes +
+                               page.dead_bits_bytes)) &&
+           writeFileBlock(fd, elements + pinned_bits_offset, page.pinned_bits_bytes,
+                          page.data_offset + page.elements_bytes + page.extent_bytes +
+                              page.dead_bits_bytes + page.key_filter_bytes);
+  }
+
+  good = fsync(fd) == 0 && good;
+  close(fd);
+  if (!good || rename(temp_name.c_str(), file_name.c_str()) != 0) {
+    std::cerr << "ERROR Table::saveSnapshot failed:" << file_name << std::endl;
+    unlink(temp_name.c_str());
+    return false;
+  }
+
+  std::cout << "Table::saveSnapshot " << file_name << " pages:" << pages.size()
+            << " bytes:" << offset << std::endl;
+  return true;
+}
+
+//-----------------------------------------------------
+// loadSnapshot
+//-----------------------------------------------------
+template <typename ELEMENT_T>
+bool Table<ELEMENT_T>::loadSnapshot(const std::string& file_name) {
+  int fd = open(file_name.c_str(), O_RDONLY);
+  if (fd == -1) {
+    std::cout << "Table::loadSnapshot no snapshot:" << file_name << std::endl;
+    return false;
+  }
+
+  SnapshotHeader snapshot_header;
+  if (!readFileBlock(fd, &snapshot_header, sizeof(snapshot_header), 0) ||
+      snapshot_header.magic != MEMPAGE_SNAPSHOT_MAGIC ||
+      snapshot_header.element_size != sizeof(ELEMENT_T) ||
+      snapshot_header.max_elements_in_page != max_elements_in_page ||
+      snapshot_header.page_extent_size != options.page_extent_size ||
+      snapshot_header.page_format != (uint32_t)options.page_format ||
+      snapshot_header.dead_bits_offset != dead_bits_offset ||
+      snapshot_header.pinned_bits_offset != pinned_bits_offset) {
+    std::cerr << "ERROR Table::loadSnapshot incompatible snapshot:" << file_name << std::endl;
+    close(fd);
+    return false;
+  }
+
+  std::vector<SnapshotPage> pages(snapshot_header.pages);
+  if (!readFileBlock(fd, pages.data(), sizeof(SnapshotPage) * pages.size(),
+                     sizeof(snapshot_header))) {
+    close(fd);
+    return false;
+  }
+
+  // pages of snapshot are reserved under lock, writers take pages after them.
+  // page data is read without lock and published at once
+  lock->enter();
+  // shared memory survived restart, it's newer than snapshot
+  if (header->high_water_mark != 0) {
+    lock->exit();
+    close(fd);
+    std::cout << "Table::loadSnapshot table is not empty, skip:" << file_name << std::endl;
+    return false;
+  }
+
+  uint32_t high_water_mark = 0;
+  for (const auto& page : pages) {
+    if (page.page_id < table_max_pages) {
+      high_water_mark = std::max<uint32_t>(high_water_mark, page.page_id + 1);
+    }
+  }
+  begin_index_update();
+  for (uint16_t idx = 0; idx < high_water_mark; ++idx) {
+    clear_index_record(table_index->shared_elements[idx]);
+  }
+  header->high_water_mark = high_water_mark;
+  end_index_update();
+  __atomic_store_n(&header->version.snapshot_time, snapshot_header.created_at, __ATOMIC_RELEASE);
+  lock->exit();
+
+  TableReadGuard<ELEMENT_T> guard(this);
+  uint32_t current_time = timing::getTimestampSec();
+  std::vector<bool> page_loaded(pages.size(), false);
+  for (size_t page_idx = 0; page_idx < pages.size(); ++page_idx) {
+    const SnapshotPage& page = pages[page_idx];
+    uint64_t page_bytes = (uint64_t)page_elements * sizeof(ELEMENT_T);
+    bool pinned = (uint32_t)page.record.payload_pins > 0;
+    if ((page.record.expire_at < current_time && !pinned) || page.page_id >= table_max_pages ||
+        page.elements_bytes > (uint64_t)max_elements_in_page * sizeof(ELEMENT_T) ||
+        page.extent_bytes > options.page_extent_size ||
+        dead_bits_offset + page.dead_bits_bytes > page_bytes ||
+        page.key_filter_bytes != key_filter_words * sizeof(uint64_t) ||
+        pinned_bits_offset + page.pinned_bits_bytes > page_bytes) {
+      continue;
+    }
+
+    SharedMemoryPage<ELEMENT_T>* memory_page = getPage(page.page_id);
+    if (memory_page == nullptr) {
+      std::cerr << "ERROR Table::loadSnapshot page == nullptr" << std::endl;
+      continue;
+    }
+
+    uint8_t* elements = (uint8_t*)memory_page->shared_elements;
+    TablePageIndexElement& record = table_index->shared_elements[page.page_id];
+    if (!readFileBlock(fd, elements, page.elements_bytes, page.data_offset) ||
+        !readFileBlock(fd, elements + (uint64_t)max_elements_in_page * sizeof(ELEMENT_T),
+                       page.extent_bytes, page.data_offset + page.elements_bytes) ||
+        !readFileBlock(fd, elements + dead_bits_offset, page.dead_bits_bytes,
+                       page.data_offset + page.elements_bytes + page.extent_bytes) ||
+        (key_filters != nullptr &&
+         !readFileBlock(fd, page_keys(record).bits, page.key_filter_bytes,
+                        page.data_offset + page.elements_bytes + page.extent_bytes +
+                            page.dead_bits_bytes)) ||
+        !readFileBlock(fd, elements + pinned_bits_offset, page.pinned_bits_bytes,
+                       page.data_offset + page.elements_bytes + page.extent_bytes +
+                           page.dead_bits_bytes + page.key_filter_bytes)) {
+      break;
+    }
+    page_loaded[page_idx] = true;
+  }
+  close(fd);
+
+  uint32_t loaded = 0;
+  lock->enter();
+  begin_index_update();
+  for (size_t page_idx = 0; page_idx < pages.size(); ++page_idx) {
+    if (!page_loaded[page_idx]) {
+      continue;
+    }
+    const SnapshotPage& page = pages[page_idx];
+    TablePageIndexElement& record = table_index->shared_elements[page.page_id];
+    uint32_t generation = record.generation;
+    record = page.record;
+    record.generation = generation + 1;
+    record.payload_pins = (uint64_t)record.generation << 32;
+    record.retired_epoch = 0;
+    std::string name = page_name(page.page_id);
+    std::memset(record.page_name, 0, sizeof(record.page_name));
+    std::memcpy(record.page_name, name.c_str(), name.length());
+
+    SizeClassStats& stats = header->class_stats[record.size_class];
+    stats.pages += 1;
+    stats.reserved_elements += max_elements_in_page - record.page_elements_available;
+    stats.used_elements += record.page_elements_used;
+    stats.reserved_extent += options.page_extent_size - record.page_extent_available;
+    stats.used_extent += record.page_extent_used;
+    ++loaded;
+  }
+
+  // gaps are reused on rollover
+  for (uint16_t idx = 0; idx < high_water_mark; ++idx) {
+    if (table_index->shared_elements[idx].page_name[0] == 0) {
+      clear_index_record(table_index->shared_elements[idx]);
+      set_free_page(idx);
+    }
+  }
+
+  // pins of loaded pages, pages which are not loaded pin nothing
+  for (size_t page_idx = 0; pinned_bits_offset > 0 && page_idx < pages.size(); ++page_idx) {
+    if (!page_loaded[page_idx]) {
       continue;
     }
+    uint64_t* bits = pinned_bits(getPage(pages[page_idx].page_id));
+    for (uint32_t word = 0; word * 64 < table_max_pages; ++word) {
+      for (uint64_t left = bits[word]; left; left &= left - 1) {
+        uint16_t pinned_id = word * 64 + __builtin_ctzll(left);
+        if (pinned_id < high_water_mark &&
+            table_index->shared_elements[pinned_id].page_name[0] != 0) {
+          table_index->shared_elements[pinned_id].payload_pins++;
+        } else {
+          bits[word] &= ~(1ULL << (pinned_id % 64));
+        }
+      }
+    }
+  }
+  end_index_update();
+  lock->exit();
+
+  std::cout << "Table::loadSnapshot " << file_name << " pages:" << loaded << "/"
+            << pages.size() << std::endl;
+  return true;
+}
+
+//-----------------------------------------------------
+// release_open_pages
+//-----------------------------------------------------
+template <typename ELEMENT_T>
+void Table<ELEMENT_T>::release_open_pages() {
+  std::lock_guard<std::mutex> guard(page_handles_mutex);
+  for (auto& page : page_handles) {
+    if (page != nullptr) {
+      drop_page_handle(page);
+    }
+  }
+}
+
+//-----------------------------------------------------
+// release_page      give page memory back to system
+//-----------------------------------------------------
+template <typename ELEMENT_T>
+bool Table<ELEMENT_T>::release_page(uint16_t page_id) {
+  if (arena != nullptr) {
+    // page stays mapped, its memory becomes zero filled
+    arena->release(page_id * arena_page_size, arena_page_size);
+    return true;
+  }
+
+  std::lock_guard<std::mutex> guard(page_handles_mutex);
+  SharedMemoryPage<ELEMENT_T>* page = map_page(page_id);
+  if (page == nullptr) {
+    return false;
+  }
+
+  // other processes release their mappings in unmap_unlinked_pages()
+  page->shared_pageinfo->unlinked = true;
+  SharedMemoryPage<ELEMENT_T>::unlink(page->page_name);
+  return true;
+}
+
+//-----------------------------------------------------
+// Table addRecord
+//-----------------------------------------------------
+template <typename ELEMENT_T>
+ElementPointer<ELEMENT_T> Table<ELEMENT_T>::addRecord(ELEMENT_T* records_pointer,
+                                                      uint32_t records_cout,
+                                                      uint32_t lifetime_seconds) {
+  return insert_records(records_pointer, records_cout, lifetime_seconds, nullptr, 0);
+}
+
+//-----------------------------------------------------
+// Table addInlineRecord
+//-----------------------------------------------------
+template <typename ELEMENT_T>
+ElementPointer<ELEMENT_T> Table<ELEMENT_T>::addInlineRecord(ELEMENT_T* record,
+                                                            const uint8_t* payload,
+                                                            uint32_t payload_size,
+                                                            uint32_t lifetime_seconds) {
+  if (options.page_extent_size == 0) {
+    std::cerr << "ERROR Table::addInlineRecord table has no page extent" << std::endl;
+    return ElementPointer<ELEMENT_T>(*this, ErrorCode::RECORD_SIZE_TO_BIG);
+  }
+  return insert_records(record, 1, lifetime_seconds, payload, payload_size);
+}
+
+//-----------------------------------------------------
+// insert_records       addRecord & addInlineRecord
+//-----------------------------------------------------
+template <typename ELEMENT_T>
+ElementPointer<ELEMENT_T> Table<ELEMENT_T>::insert_records(ELEMENT_T* records_pointer,
+                                                           uint32_t records_cout,
+                                                           uint32_t lifetime_seconds,
+                                                           const uint8_t* payload,
+                                                           uint32_t payload_size) {
+  // check if there is time to release some pages
+  release_expired_memory_pages();
+  // tail page is written without lock
+  TableReadGuard<ELEMENT_T> guard(this);
+
+  uint32_t extent_size = payload ? payload_extent_size(payload_size) : 0;
+  if (extent_size > options.page_extent_size) {
+    std::cout << "ERROR Table::addRecord payload_size > page_extent_size:"
+              << " payload_size:" << payload_size
+              << " page_extent_size:" << options.page_extent_size << std::endl;
+
+    return ElementPointer<ELEMENT_T>(*this, ErrorCode::RECORD_SIZE_TO_BIG);
+  }
+
+  uint8_t records_class = size_class(records_cout, extent_size);
+  if (records_cout > max_elements_in_page || records_class == UINT8_MAX) {
+    std::cout << "ERROR Table::addRecord records_cout > max_elements_in_page:"
+              << " records_cout:" << records_cout
+              << " max_elements_in_page:" << max_elements_in_page << std::endl;
+
+    return ElementPointer<ELEMENT_T>(*this, ErrorCode::RECORD_SIZE_TO_BIG);
+  }
+
+  uint16_t insert_page_id;
+  uint32_t insert_element_idx;
+  uint32_t extent_offset = 0;
+  uint32_t current_time = timing::getTimestampSec();
+  bool current_record_was_cleared = false;
+  bool page_found = false;
+  bool page_rollover = false;
+
+  // page will expire after N seconds
+  uint32_t records_expire_time = expire_time(current_time, lifetime_seconds);
+
+  // identical content could be stored already
+  uint64_t content_hash = 0;
+  DedupEntry duplicate;
+  bool is_duplicate = false;
+  if (dedup_index != nullptr) {
+    const uint8_t* content = payload ? payload : (const uint8_t*)records_pointer;
+    uint32_t content_size = payload ? payload_size : records_cout;
+    content_hash = contentHash(content, payload ? payload_size : records_cout * sizeof(ELEMENT_T));
+    is_duplicate = find_duplicate(content_hash, content, content_size, records_expire_time,
+                                  current_time, duplicate);
+  }
+
+  if (is_duplicate && payload == nullptr) {
+    return ElementPointer<ELEMENT_T>(*this, duplicate.page_id, duplicate.offset, records_cout);
+  }
+
+  // min/max of inserted records, merged into page zones
+  ZoneMap zones = records_zones(records_pointer, records_cout);
+
+  // only record is inserted, it points to stored payload (page of it is pinned by
+  // find_duplicate). payload is stored again if tail page has no room for record
+  if (is_duplicate) {
+    page_found = reserve_in_tail(records_pointer, records_cout, zones, records_expire_time,
+                                 current_time, records_class, 0, insert_page_id,
+                                 insert_element_idx, extent_offset);
+    if (!page_found) {
+      unpin_page(duplicate.page_id, duplicate.generation);
+    }
+    is_duplicate = page_found;
+  }
+
+  // fast path: reserve slots in tail page without lock
+  if (!page_found &&
+      reserve_in_tail(records_pointer, records_cout, zones, records_expire_time, current_time,
+                      records_class, extent_size, insert_page_id, insert_element_idx,
+                      extent_offset)) {
+    page_found = true;
+  }
+
+  // slow path: page rollover under lock
+  bool locked = !page_found;
+  if (locked) {
+    lock->enter();
+
+    // other writer could roll tail over while we were waiting for lock
+    page_found = reserve_in_tail(records_pointer, records_cout, zones, records_expire_time,
+                                 current_time, records_class, extent_size, insert_page_id,
+                                 insert_element_idx, extent_offset);
+  }
+
+  if (!page_found) {
+    begin_index_update();
+    insert_page_id = take_free_page(current_time, current_record_was_cleared);
+
+    if (insert_page_id < table_max_pages) {
+      // page still has full capacity, lets insert at the begining
+      open_page(insert_page_id, current_record_was_cleared, records_pointer, records_cout,
+                zones, records_expire_time, records_class, extent_size);
+      insert_element_idx = 0;
+      extent_offset = 0;
+      page_rollover = true;
+      page_found = true;
+    }
+    end_index_update();
+  }
+
+  if (locked) {
+    lock->exit();
+  }
+
+  // next page is taken, prepare new spare one
+  if (page_rollover) {
+    request_spare_page();
+  }
+
+  if (!page_found) {
+    std::cerr << "ERROR Table::addRecord() no page to insert" << std::endl;
+    return ElementPointer<ELEMENT_T>(*this, ErrorCode::NO_SPACE_TO_INSERT);
+  }
+
+  // now we have page to insert
+  // and position to insert
+  // let's look for page now in local heap or allocate it
+  SharedMemoryPage<ELEMENT_T>* page = getPage(insert_page_id);
+
+  if (page == nullptr) {
+    std::cerr << "ERROR Table::addRecord() page == nullptr" << std::endl;
+    if (is_duplicate) {
+      unpin_page(duplicate.page_id, duplicate.generation);
+    }
+    return ElementPointer<ELEMENT_T>(*this, ErrorCode::CANT_FIND_PAGE);
+  }
+
+  // copy array of (records_cout) elements and payload to shared memeory
+  PayloadRef ref = {insert_page_id, 0, extent_offset};
+  if (is_duplicate) {
+    ref = {duplicate.page_id, 0, duplicate.offset};
+    keep_pin(page, insert_page_id, duplicate.page_id);
+  }
+  write_record(page, insert_element_idx, records_pointer, records_cout, payload ? &ref : nullptr,
+               is_duplicate ? nullptr : payload, payload_size);
+
+  if (dedup_index != nullptr && !is_duplicate) {
+    remember_content(content_hash, insert_page_id, payload ? extent_offset : insert_element_idx,
+                     payload ? payload_size : records_cout);
+  }
+
+  if (upsert_index != nullptr && records_cout == 1) {
+    supersede(*records_pointer, insert_page_id, insert_element_idx);
+  }
+
+  return ElementPointer<ELEMENT_T>(*this, insert_page_id, insert_element_idx, records_cout);
+}
+
+//-----------------------------------------------------
+// Table addRecords     batch insert with one lock acquisition
+//-----------------------------------------------------
+// slots for every entry are reserved first (tail page, then rollover pages),
+// elements are copied to shared memory after the lock is released
+template <typename ELEMENT_T>
+std::vector<ElementPointer<ELEMENT_T>> Table<ELEMENT_T>::addRecords(
+    const std::vector<RecordsBatchItem<ELEMENT_T>>& batch, uint32_t lifetime_seconds) {
+  // check if there is time to release some pages
+  release_expired_memory_pages();
+  // tail pages are written without lock
+  TableReadGuard<ELEMENT_T> guard(this);
+
+  uint32_t current_time = timing::getTimestampSec();
+  uint32_t records_expire_time = expire_time(current_time, lifetime_seconds);
+  bool page_rollover = false;
+
+  struct Placement {
+    ErrorCode error;
+    uint16_t page_id;
+    uint32_t element_idx;
+    uint32_t extent_offset;
+    uint64_t content_hash;
+    bool duplicate;
+    DedupEntry stored;  // content of duplicate
+  };
+  std::vector<Placement> placements(batch.size());
+  for (auto& placement : placements) {
+    placement.error = ErrorCode::NO_SPACE_TO_INSERT;
+    placement.extent_offset = 0;
+    placement.duplicate = false;
+  }
+
+  // dedup lookups don't need lock
+  if (dedup_index != nullptr) {
+    for (size_t idx = 0; idx < batch.size(); ++idx) {
+      const RecordsBatchItem<ELEMENT_T>& item = batch[idx];
+      Placement& placement = placements[idx];
+      const uint8_t* content = item.payload ? item.payload : (const uint8_t*)item.records;
+      uint32_t content_size = item.payload ? item.payload_size : item.count;
+      placement.content_hash =
+          contentHash(content, item.payload ? item.payload_size : item.count * sizeof(ELEMENT_T));
+      placement.duplicate = find_duplicate(placement.content_hash, content, content_size,
+                                           records_expire_time, current_time, placement.stored);
+
+      if (placement.duplicate && item.payload == nullptr) {
+        placement.error = ErrorCode::NO_ERROR;
+        placement.page_id = placement.stored.page_id;
+        placement.element_idx = placement.stored.offset;
+      }
+    }
+  }
+
+  lock->enter();
+
+  for (size_t idx = 0; idx < batch.size(); ++idx) {
+    const RecordsBatchItem<ELEMENT_T>& item = batch[idx];
+    Placement& placement = placements[idx];
+
+    // records are stored already
+    if (placement.duplicate && item.payload == nullptr) {
+      continue;
+    }
+
+    uint32_t extent_size = item.payload ? payload_extent_size(item.payload_size) : 0;
+    if (extent_size > options.page_extent_size || (item.payload && item.count != 1)) {
+      std::cout << "ERROR Table::addRecords bad payload:"
+                << " payload_size:" << item.payload_size << " count:" << item.count
+                << " page_extent_size:" << options.page_extent_size << std::endl;
+      placement.error = ErrorCode::RECORD_SIZE_TO_BIG;
+      continue;
+    }
+
+    uint8_t records_class = size_class(item.count, extent_size);
+    if (item.count > max_elements_in_page || records_class == UINT8_MAX) {
+      std::cout << "ERROR Table::addRecords count > max_elements_in_page:"
+                << " count:" << item.count << " max_elements_in_page:" << max_elements_in_page
+                << std::endl;
+      placement.error = ErrorCode::RECORD_SIZE_TO_BIG;
+      continue;
+    }
+
+    ZoneMap zones = records_zones(item.records, item.count);
+
+    // record points to pinned payload, it's stored again if tail has no room for record
+    if (placement.duplicate) {
+      placement.duplicate =
+          reserve_in_tail(item.records, item.count, zones, records_expire_time, current_time,
+                          records_class, 0, placement.page_id, placement.element_idx,
+                          placement.extent_offset);
+      if (placement.duplicate) {
+        placement.error = ErrorCode::NO_ERROR;
+        continue;
+      }
+      unpin_page(placement.stored.page_id, placement.stored.generation);
+    }
+
+    // lock free writers of other processes still may share the tail page
+    if (reserve_in_tail(item.records, item.count, zones, records_expire_time, current_time,
+                        records_class, extent_size, placement.page_id, placement.element_idx,
+                        placement.extent_offset)) {
+      placement.error = ErrorCode::NO_ERROR;
+      continue;
+    }
+
+    bool was_cleared = false;
+    begin_index_update();
+    uint16_t page_id = take_free_page(current_time, was_cleared);
+    if (page_id >= table_max_pages) {
+      end_index_update();
+      // table is full, rest of batch stays NO_SPACE_TO_INSERT
+      std::cerr << "ERROR Table::addRecords() no page to insert" << std::endl;
+      break;
+    }
+
+    open_page(page_id, was_cleared, item.records, item.count, zones, records_expire_time,
+              records_class, extent_size);
+    end_index_update();
+    placement.error = ErrorCode::NO_ERROR;
+    placement.page_id = page_id;
+    placement.element_idx = 0;
+    placement.extent_offset = 0;
+    page_rollover = true;
+  }
+
+  lock->exit();
+
+  // next page is taken, prepare new spare one
+  if (page_rollover) {
+    request_spare_page();
+  }
+
+  std::vector<ElementPointer<ELEMENT_T>> result;
+  result.reserve(batch.size());
+
+  for (size_t idx = 0; idx < batch.size(); ++idx) {
+    const RecordsBatchItem<ELEMENT_T>& item = batch[idx];
+    const Placement& placement = placements[idx];
+    bool pinned = placement.duplicate && item.payload != nullptr;
+    if (placement.error != ErrorCode::NO_ERROR) {
+      if (pinned) {
+        unpin_page(placement.stored.page_id, placement.stored.generation);
+      }
+      result.push_back(ElementPointer<ELEMENT_T>(*this, placement.error));
+      continue;
+    }
+
+    if (placement.duplicate && item.payload == nullptr) {
+      result.push_back(ElementPointer<ELEMENT_T>(*this, placement.page_id, placement.element_idx,
+                                                 item.count));
+      continue;
+    }
+
+    SharedMemoryPage<ELEMENT_T>* page = getPage(placement.page_id);
+    if (page == nullptr) {
+      std::cerr << "ERROR Table::addRecords() page == nullptr" << std::endl;
+      if (pinned) {
+        unpin_page(placement.stored.page_id, placement.stored.generation);
+      }
+      result.push_back(ElementPointer<ELEMENT_T>(*this, ErrorCode::CANT_FIND_PAGE));
+      continue;
+    }
+
+    PayloadRef ref = {placement.page_id, 0, placement.extent_offset};
+    if (pinned) {
+      ref = {placement.stored.page_id, 0, placement.stored.offset};
+      keep_pin(page, placement.page_id, placement.stored.page_id);
+    }
+    write_record(page, placement.element_idx, item.records, item.count,
+                 item.payload ? &ref : nullptr, placement.duplicate ? nullptr : item.payload,
+                 item.payload_size);
+
+    if (dedup_index != nullptr && !placement.duplicate) {
+      remember_content(placement.content_hash, placement.page_id,
+                       item.payload ? placement.extent_offset : placement.element_idx,
+                       item.payload ? item.payload_size : item.count);
+    }
+    if (upsert_index != nullptr && item.count == 1) {
+      supersede(*item.records, placement.page_id, placement.element_idx);
+    }
+    result.push_back(
+        ElementPointer<ELEMENT_T>(*this, placement.page_id, placement.element_idx, item.count));
+  }
+
+  return result;
+}
+
+//-----------------------------------------------------
+// open_page            make page the new tail, must be called under lock
+//-----------------------------------------------------
+// records are counted as already reserved at the begining of the page
+template <typename ELEMENT_T>
+void Table<ELEMENT_T>::open_page(uint16_t page_id, bool was_cleared, const ELEMENT_T* records,
+                                 uint32_t records_count, const ZoneMap& records_zones,
+                                 uint32_t expire_time, uint8_t size_class,
+                                 uint32_t extent_size) {
+  TablePageIndexElement* index_record = &table_index->shared_elements[page_id];
+  std::string insert_page_name = page_name(page_id);
+  if (was_cleared) {
+    std::cout << "USE EXPIRED page:" << insert_page_name << std::endl;
+  } else {
+    std::cout << "USE NEW page:" << insert_page_name << std::endl;
+  }
+
+  // dedup entries of previous page data become invalid
+  uint32_t generation = __atomic_add_fetch(&index_record->generation, 1, __ATOMIC_RELEASE);
+  __atomic_store_n(&index_record->payload_pins, (uint64_t)generation << 32, __ATOMIC_RELEASE);
+
+  // expired page memory is reused as is, dead marks belong to its previous records
+  if (upsert_index != nullptr && was_cleared) {
+    SharedMemoryPage<ELEMENT_T>* page = getPage(page_id);
+    if (page != nullptr) {
+      std::memset(dead_bits(page), 0, (max_elements_in_page + 63) / 64 * sizeof(uint64_t));
+    }
+  }
+
+  // calculate capacity after we will put records
+  index_record->size_class = size_class;
+  __atomic_store_n(&index_record->page_elements_available,
+                   max_elements_in_page - slot_size(size_class, records_count), __ATOMIC_RELEASE);
+  __atomic_store_n(&index_record->page_extent_available,
+                   options.page_extent_size - extent_slot_size(size_class, extent_size),
+                   __ATOMIC_RELEASE);
+  // copy page_name to shared meme
+  std::memcpy(index_record->page_name, insert_page_name.c_str(), insert_page_name.length());
+  update_index_record(*index_record, records_zones, records, records_count);
+  __atomic_fetch_add(&header->class_stats[size_class].pages, 1, __ATOMIC_RELAXED);
+  count_slot(*index_record, size_class, records_count, extent_size);
+
+  // page becomes visible to fast path writers with expire_at
+  atomic_max(index_record->expire_at, expire_time);
+  __atomic_store_n(&tail_page(size_class), page_id + 1, __ATOMIC_RELEASE);
+}
+
+//-----------------------------------------------------
+// records_zones        min/max of records for every zone
+//-----------------------------------------------------
+template <typename ELEMENT_T>
+ZoneMap Table<ELEMENT_T>::records_zones(const ELEMENT_T* records, uint32_t records_count) {
+  ZoneMap zones;
+  for (uint16_t zone_idx = 0; zone_idx < options.zones.size(); ++zone_idx) {
+    zones.min[zone_idx] = UINT32_MAX;
+    zones.max[zone_idx] = 0;
+    for (uint32_t idx = 0; idx < records_count; ++idx) {
+      uint32_t value = field_value(records[idx], options.zones[zone_idx]);
+      zones.min[zone_idx] = std::min(zones.min[zone_idx], value);
+      zones.max[zone_idx] = std::max(zones.max[zone_idx], value);
+    }
+  }
+  return zones;
+}
+
+//-----------------------------------------------------
+// expire_time          records lifetime or table default one
+//-----------------------------------------------------
+template <typename ELEMENT_T>
+uint32_t Table<ELEMENT_T>::expire_time(uint32_t current_time, uint32_t lifetime_seconds) {
+  if (lifetime_seconds != 0) {
+    return current_time + lifetime_seconds;
+  }
+  return current_time + record_expire_seconds;
+}
+
+//-----------------------------------------------------
+// request_spare_page   wake up preallocator after rollover
+//-----------------------------------------------------
+template <typename ELEMENT_T>
+void Table<ELEMENT_T>::request_spare_page() {
+  if (preallocator == nullptr) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> guard(preallocator_mutex);
+    preallocate_requested = true;
+  }
+  preallocator_wakeup.notify_one();
+}
+
+//-----------------------------------------------------
+// reserve_in_tail      lock free insert into tail page
+//-----------------------------------------------------
+template <typename ELEMENT_T>
+bool Table<ELEMENT_T>::reserve_in_tail(const ELEMENT_T* records, uint32_t records_count,
+                                       const ZoneMap& records_zones, uint32_t expire_time,
+                                       uint32_t current_time, uint8_t size_class,
+                                       uint32_t extent_size, uint16_t& page_id,
+                                       uint32_t& element_idx, uint32_t& extent_offset) {
+  uint32_t tail_page_id = __atomic_load_n(&tail_page(size_class), __ATOMIC_ACQUIRE) - 1;
+  if (tail_page_id >= table_max_pages) {
+    return false;
+  }
+
+  // tail is not used yet or expired
+  TablePageIndexElement& index_record = table_index->shared_elements[tail_page_id];
+  if (__atomic_load_n(&index_record.expire_at, __ATOMIC_ACQUIRE) < current_time) {
+    return false;
+  }
+
+  // page was reused by other size class
+  if (index_record.size_class != size_class) {
+    return false;
+  }
+
+  // summary first: page may be skipped by readers only before records are counted
+  update_index_record(index_record, records_zones, records, records_count);
+  // payload bytes are lost if page has no more elements, page is full anyway
+  if (extent_size &&
+      !reserve_extent(index_record, extent_slot_size(size_class, extent_size), extent_offset)) {
+    return false;
+  }
+  if (!reserve_elements(index_record, slot_size(size_class, records_count), element_idx)) {
+    return false;
+  }
+  count_slot(index_record, size_class, records_count, extent_size);
+
+  // update page expire time only if record expire time greater
+  atomic_max(index_record.expire_at, expire_time);
+  page_id = tail_page_id;
+  return true;
+}
+
+//-----------------------------------------------------
+// tail_page
+//-----------------------------------------------------
+// writer shard is chosen by reader slot: writers of different processes get
+// different shards until there are more of them than shards
+template <typename ELEMENT_T>
+uint32_t& Table<ELEMENT_T>::tail_page(uint8_t size_class) {
+  if (tail_shard == UINT16_MAX) {
+    if (reader_slot < 0) {
+      take_reader_slot();
+    }
+    tail_shard = (reader_slot >= 0 ? reader_slot : getpid()) % options.tail_shards;
+  }
+  return header->tail_page_id[tail_shard][size_class];
+}
+
+//-----------------------------------------------------
+// take_free_page       next page for rollover, must be called under lock
+//-----------------------------------------------------
+// expired or released page from header->free_pages bitmap if any,
+// otherwise never used page at high_water_mark. UINT16_MAX if table is full
+template <typename ELEMENT_T>
+uint16_t Table<ELEMENT_T>::take_free_page(uint32_t current_time, bool& was_cleared) {
+  was_cleared = false;
+
+  for (uint32_t word = 0; word * 64 < header->high_water_mark; ++word) {
+    while (header->free_pages[word]) {
+      uint16_t page_id = word * 64 + __builtin_ctzll(header->free_pages[word]);
+      header->free_pages[word] &= header->free_pages[word] - 1;
+
+      TablePageIndexElement& index_record = table_index->shared_elements[page_id];
+      // released page
+      if (index_record.expire_at == 0) {
+        clear_index_record(index_record);
+        return page_id;
+      }
+      // expired page -> make it empty and use it to save records
+      if (index_record.expire_at < current_time) {
+        clear_index_record(index_record);
+        was_cleared = true;
+        return page_id;
+      }
+      // page is alive again, drop stale bit
+    }
+  }
+
+  if (header->high_water_mark >= table_max_pages) {
+    return UINT16_MAX;
+  }
+
+  // new arena page memory is allocated on first write
+  if (arena != nullptr &&
+      !(preallocator ? spare_memory_available.load() : checkSharedMemAvailability())) {
+    std::cerr << "ERROR Table::addRecord LOW SHARED MEMORY" << std::endl;
+    return UINT16_MAX;
+  }
+
+  uint16_t page_id = header->high_water_mark++;
+  clear_index_record(table_index->shared_elements[page_id]);
+  return page_id;
+}
+
+//-----------------------------------------------------
+// set_free_page        mark page as rollover candidate, must be called under lock
+//-----------------------------------------------------
+template <typename ELEMENT_T>
+void Table<ELEMENT_T>::set_free_page(uint16_t page_id) {
+  header->free_pages[page_id / 64] |= 1ULL << (page_id % 64);
+}
+
+//-----------------------------------------------------
+// reserve_elements     take records_count free slots of page
+//-----------------------------------------------------
+// lock free, returns false if page has not enough space
+template <typename ELEMENT_T>
+bool Table<ELEMENT_T>::reserve_elements(TablePageIndexElement& record, uint32_t records_count,
+                                        uint32_t& element_idx) {
+  uint32_t available = __atomic_load_n(&record.page_elements_available, __ATOMIC_ACQUIRE);
+  do {
+    if (available < records_count) {
+      return false;
+    }
+  } while (!__atomic_compare_exchange_n(&record.page_elements_available, &available,
+                                        available - records_count, true, __ATOMIC_ACQ_REL,
+                                        __ATOMIC_ACQUIRE));
+
+  element_idx = max_elements_in_page - available;
+  return true;
+}
+
+//-----------------------------------------------------
+// reserve_extent       take bytes of page extent for inline payload
+//-----------------------------------------------------
+template <typename ELEMENT_T>
+bool Table<ELEMENT_T>::reserve_extent(TablePageIndexElement& record, uint32_t extent_size,
+                                      uint32_t& extent_offset) {
+  uint32_t available = __atomic_load_n(&record.page_extent_available, __ATOMIC_ACQUIRE);
+  do {
+    if (available < extent_size) {
+      return false;
+    }
+  } while (!__atomic_compare_exchange_n(&record.page_extent_available, &available,
+                                        available - extent_size, true, __ATOMIC_ACQ_REL,
+                                        __ATOMIC_ACQUIRE));
+
+  extent_offset = options.page_extent_size - available;
+  return true;
+}
+
+//-----------------------------------------------------
+// payload_extent_size
+//-----------------------------------------------------
+template <typename ELEMENT_T>
+uint32_t Table<ELEMENT_T>::payload_extent_size(uint32_t payload_size) {
+  return (sizeof(uint32_t) + payload_size + 3) & ~3U;
+}
+
+//-----------------------------------------------------
+// size_class           smallest slot records or their payload fit in
+//-----------------------------------------------------
+template <typename ELEMENT_T>
+uint8_t Table<ELEMENT_T>::size_class(uint32_t records_count, uint32_t extent_size) {
+  const std::vector<uint32_t>& classes =
+      options.extent_classes.empty() ? options.size_classes : options.extent_classes;
+  if (classes.empty()) {
+    return 0;
+  }
+
+  uint32_t size = options.extent_classes.empty() ? records_count : extent_size;
+  auto slot = std::lower_bound(classes.begin(), classes.end(), size);
+  if (slot == classes.end()) {
+    return UINT8_MAX;
+  }
+  return slot - classes.begin();
+}
+
+//-----------------------------------------------------
+// slot_size            elements reserved for records
+//-----------------------------------------------------
+template <typename ELEMENT_T>
+uint32_t Table<ELEMENT_T>::slot_size(uint8_t size_class, uint32_t records_count) {
+  if (options.size_classes.empty()) {
+    return records_count;
+  }
+  return options.size_classes[size_class];
+}
+
+//-----------------------------------------------------
+// extent_slot_size     page extent bytes reserved for inline payload
+//-----------------------------------------------------
+template <typename ELEMENT_T>
+uint32_t Table<ELEMENT_T>::extent_slot_size(uint8_t size_class, uint32_t extent_size) {
+  if (options.extent_classes.empty() || extent_size == 0) {
+    return extent_size;
+  }
+  return options.extent_classes[size_class];
+}
+
+//-----------------------------------------------------
+// count_slot           size class accounting of reserved slot
+//-----------------------------------------------------
+template <typename ELEMENT_T>
+void Table<ELEMENT_T>::count_slot(TablePageIndexElement& record, uint8_t size_class,
+                                  uint32_t records_count, uint32_t extent_size) {
+  SizeClassStats& stats = header->class_stats[size_class];
+  __atomic_fetch_add(&stats.reserved_elements, slot_size(size_class, records_count),
+                     __ATOMIC_RELAXED);
+  __atomic_fetch_add(&stats.used_elements, records_count, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&record.page_elements_used, records_count, __ATOMIC_RELAXED);
+  if (extent_size) {
+    __atomic_fetch_add(&stats.reserved_extent, extent_slot_size(size_class, extent_size),
+                       __ATOMIC_RELAXED);
+    __atomic_fetch_add(&stats.used_extent, extent_size, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&record.page_extent_used, extent_size, __ATOMIC_RELAXED);
+  }
+}
+
+//-----------------------------------------------------
+// lockStats
+//-----------------------------------------------------
+template <typename ELEMENT_T>
+std::string Table<ELEMENT_T>::lockStats() {
+  return lock->statsText();
+}
+
+//-----------------------------------------------------
+// sizeClassStats
+//-----------------------------------------------------
+template <typename ELEMENT_T>
+std::vector<SizeClassStats> Table<ELEMENT_T>::sizeClassStats() {
+  std::vector<SizeClassStats> result(
+      std::max<size_t>(std::max(options.size_classes.size(), options.extent_classes.size()), 1));
+  for (uint16_t class_idx = 0; class_idx < result.size(); ++class_idx) {
+    const SizeClassStats& stats = header->class_stats[class_idx];
+    result[class_idx].pages = __atomic_load_n(&stats.pages, __ATOMIC_RELAXED);
+    result[class_idx].reserved_elements =
+        __atomic_load_n(&stats.reserved_elements, __ATOMIC_RELAXED);
+    result[class_idx].used_elements = __atomic_load_n(&stats.used_elements, __ATOMIC_RELAXED);
+    result[class_idx].reserved_extent = __atomic_load_n(&stats.reserved_extent, __ATOMIC_RELAXED);
+    result[class_idx].used_extent = __atomic_load_n(&stats.used_extent, __ATOMIC_RELAXED);
+  }
+  return result;
+}
+
+//-----------------------------------------------------
+// write_record         elements & inline payload to reserved slots
+//-----------------------------------------------------
+// ref - inline payload position to write into record, payload is copied
+// to ref->offset of page extent if it's not stored yet
+template <typename ELEMENT_T>
+void Table<ELEMENT_T>::write_record(SharedMemoryPage<ELEMENT_T>* page, uint32_t element_idx,
+                                    const ELEMENT_T* records, uint32_t records_count,
+                                    const PayloadRef* ref, const uint8_t* payload,
+                                    uint32_t payload_size) {
+  if (ref == nullptr) {
+    write_elements(page->shared_elements, element_idx, records, records_count);
+    return;
+  }
+
+  if (payload != nullptr) {
+    // extent begins right after page elements
+    uint8_t* entry = (uint8_t*)(page->shared_elements + max_elements_in_page) + ref->offset;
+    std::memcpy(entry, &payload_size, sizeof(payload_size));
+    std::memcpy(entry + sizeof(payload_size), payload, payload_size);
+  }
+
+  // record gets position of its payload
+  ELEMENT_T record = records[0];
+  PayloadRefWriter<ELEMENT_T, (sizeof(ELEMENT_T) >= sizeof(PayloadRef))>::write(
+      record, options.payload_ref.offset, *ref);
+  write_elements(page->shared_elements, element_idx, &record, 1);
+}
+
+//-----------------------------------------------------
+// find_duplicate       stored content equal to data
+//-----------------------------------------------------
+// size is elements count or inline payload bytes. page of found records is kept
+// alive till expire_time, so caller can refer to it. page of found inline payload
+// is pinned, caller keeps pin (keep_pin) or drops it (unpin_page)
+template <typename ELEMENT_T>
+bool Table<ELEMENT_T>::find_duplicate(uint64_t hash, const uint8_t* data, uint32_t size,
+                                      uint32_t expire_time, uint32_t current_time,
+                                      DedupEntry& found) {
+  // entry could be written by other process right now, it's checked below
+  DedupEntry entry = dedup_index->shared_elements[hash % options.dedup_buckets];
+  if (entry.hash != hash || entry.size != size || entry.page_id >= table_max_pages) {
+    return false;
+  }
+
+  bool inline_payload = options.page_extent_size > 0;
+  if (inline_payload ? !pin_page(entry.page_id, entry.generation, current_time)
+                     : !extend_page(entry.page_id, entry.generation, expire_time, current_time)) {
+    return false;
+  }
+
+  bool same = false;
+  SharedMemoryPage<ELEMENT_T>* page = getPage(entry.page_id);
+  if (page != nullptr && inline_payload) {
+    if (entry.offset + payload_extent_size(size) <= options.page_extent_size) {
+      const uint8_t* stored =
+          (uint8_t*)(page->shared_elements + max_elements_in_page) + entry.offset;
+      uint32_t stored_size;
+      std::memcpy(&stored_size, stored, sizeof(stored_size));
+      same = stored_size == size && std::memcmp(stored + sizeof(stored_size), data, size) == 0;
+    }
+  } else if (page != nullptr) {
+    if (entry.offset + size <= max_elements_in_page) {
+      same = std::memcmp(page->shared_elements + entry.offset, data,
+                         (uint64_t)size * sizeof(ELEMENT_T)) == 0;
+    }
+  }
+
+  if (!same) {
+    if (inline_payload) {
+      unpin_page(entry.page_id, entry.generation);
+    }
+    return false;
+  }
+
+  found = entry;
+  return true;
+}
+
+//-----------------------------------------------------
+// remember_content     put stored content into dedup index
+//-----------------------------------------------------
+template <typename ELEMENT_T>
+void Table<ELEMENT_T>::remember_content(uint64_t hash, uint16_t page_id, uint32_t offset,
+                                        uint32_t size) {
+  // last writer wins, entry is just a hint
+  DedupEntry& entry = dedup_index->shared_elements[hash % options.dedup_buckets];
+  entry.hash = hash;
+  entry.page_id = page_id;
+  entry.generation =
+      __atomic_load_n(&table_index->shared_elements[page_id].generation, __ATOMIC_ACQUIRE);
+  entry.offset = offset;
+  entry.size = size;
+}
+
+//-----------------------------------------------------
+// extend_page          keep alive page with shared content
+//-----------------------------------------------------
+// false if page is expired or reused (generation changed)
+template <typename ELEMENT_T>
+bool Table<ELEMENT_T>::extend_page(uint16_t page_id, uint32_t generation, uint32_t expire_time,
+                                   uint32_t current_time) {
+  TablePageIndexElement& record = table_index->shared_elements[page_id];
+  if (__atomic_load_n(&record.generation, __ATOMIC_ACQUIRE) != generation) {
+    return false;
+  }
+
+  // expired page could be reused by rollover any moment, don't touch it
+  uint32_t expire_at = __atomic_load_n(&record.expire_at, __ATOMIC_ACQUIRE);
+  do {
+    if (expire_at < current_time) {
+      return false;
+    }
+    if (expire_at >= expire_time) {
+      break;
+    }
+  } while (!__atomic_compare_exchange_n(&record.expire_at, &expire_at, expire_time, true,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+
+  // page was reused before expire_at was checked
+  return __atomic_load_n(&record.generation, __ATOMIC_ACQUIRE) == generation;
+}
+
+//-----------------------------------------------------
+// pin_page             keep page of shared inline payload
+//-----------------------------------------------------
+// false if page is expired, retired or reused (generation changed)
+template <typename ELEMENT_T>
+bool Table<ELEMENT_T>::pin_page(uint16_t page_id, uint32_t generation, uint32_t current_time) {
+  TablePageIndexElement& record = table_index->shared_elements[page_id];
+  uint64_t pins = __atomic_load_n(&record.payload_pins, __ATOMIC_ACQUIRE);
+  do {
+    if (pins >> 32 != generation) {
+      return false;
+    }
+  } while (!__atomic_compare_exchange_n(&record.payload_pins, &pins, pins + 1, true,
+                                        __ATOMIC_SEQ_CST, __ATOMIC_ACQUIRE));
+
+  // page is retired before its pins are checked (expire_pages), one of us sees the other
+  if (__atomic_load_n(&record.retired_epoch, __ATOMIC_SEQ_CST) != 0 ||
+      __atomic_load_n(&record.expire_at, __ATOMIC_ACQUIRE) < current_time) {
+    unpin_page(page_id, generation);
+    return false;
+  }
+  return true;
+}
+
+//-----------------------------------------------------
+// unpin_page
+//-----------------------------------------------------
+// pins of previous page generation are dropped by page reuse already
+template <typename ELEMENT_T>
+void Table<ELEMENT_T>::unpin_page(uint16_t page_id, uint32_t generation) {
+  TablePageIndexElement& record = table_index->shared_elements[page_id];
+  uint64_t pins = __atomic_load_n(&record.payload_pins, __ATOMIC_ACQUIRE);
+  do {
+    if (pins >> 32 != generation || (uint32_t)pins == 0) {
+      return;
+    }
+  } while (!__atomic_compare_exchange_n(&record.payload_pins, &pins, pins - 1, true,
+                                        __ATOMIC_SEQ_CST, __ATOMIC_ACQUIRE));
+}
+
+//-----------------------------------------------------
+// keep_pin             record page holds pin of payload page
+//-----------------------------------------------------
+// every record page pins payload page once, record page can't expire while
+// its writer is in read section, so pin is released by unpin_pinned_pages
+template <typename ELEMENT_T>
+void Table<ELEMENT_T>::keep_pin(SharedMemoryPage<ELEMENT_T>* record_page,
+                                uint16_t record_page_id, uint16_t payload_page_id) {
+  uint64_t bit = 1ULL << (payload_page_id % 64);
+  if (record_page_id == payload_page_id ||
+      __atomic_fetch_or(&pinned_bits(record_page)[payload_page_id / 64], bit, __ATOMIC_ACQ_REL) &
+          bit) {
+    uint64_t pins = __atomic_load_n(&table_index->shared_elements[payload_page_id].payload_pins,
+                                    __ATOMIC_ACQUIRE);
+    unpin_page(payload_page_id, pins >> 32);
+  }
+}
+
+//-----------------------------------------------------
+// unpin_pinned_pages   expired page releases payload pages, must be called under lock
+//-----------------------------------------------------
+template <typename ELEMENT_T>
+void Table<ELEMENT_T>::unpin_pinned_pages(uint16_t page_id) {
+  if (pinned_bits_offset == 0) {
+    return;
+  }
+  SharedMemoryPage<ELEMENT_T>* page = getPage(page_id);
+  if (page == nullptr) {
+    return;
+  }
+
+  uint64_t* bits = pinned_bits(page);
+  for (uint32_t word = 0; word * 64 < table_max_pages; ++word) {
+    while (bits[word]) {
+      uint16_t pinned_id = word * 64 + __builtin_ctzll(bits[word]);
+      bits[word] &= bits[word] - 1;
+      // pinned page is not reused while it's pinned, generation is the same
+      uint64_t pins = __atomic_load_n(&table_index->shared_elements[pinned_id].payload_pins,
+                                      __ATOMIC_ACQUIRE);
+      unpin_page(pinned_id, pins >> 32);
+    }
+  }
+}
+
+//-----------------------------------------------------
+// pinned_bits          pages pinned by inline payload refs of page records
+//-----------------------------------------------------
+template <typename ELEMENT_T>
+uint64_t* Table<ELEMENT_T>::pinned_bits(SharedMemoryPage<ELEMENT_T>* page) {
+  return (uint64_t*)((uint8_t*)page->shared_elements + pinned_bits_offset);
+}
+
+//-----------------------------------------------------
+// supersede            mark previous record with the same key dead
+//-----------------------------------------------------
+// record is already written to page_id:element_idx. key bucket is one of
+// MEMPAGE_UPSERT_PROBES buckets after key hash (linear probing), probing stops at
+// empty bucket. bucket of the same key is exchanged, so every replaced record is
+// marked by exactly one newer record. new key takes first empty or stale bucket,
+// record stays not indexed if all of them are used by live records of other keys
+template <typename ELEMENT_T>
+void Table<ELEMENT_T>::supersede(const ELEMENT_T& record, uint16_t page_id,
+                                 uint32_t element_idx) {
+  std::string key;
+  for (const auto& field : options.upsert_key) {
+    key.append((const char*)&record + field.offset, field.size);
+  }
+  uint64_t hash = contentHash(key.data(), key.size());
+
+  uint32_t generation =
+      __atomic_load_n(&table_index->shared_elements[page_id].generation, __ATOMIC_ACQUIRE);
+  UpsertEntry entry =
+      ((UpsertEntry)(page_id + 1) << 48) | ((UpsertEntry)generation << 16) | element_idx;
+
+  // bucket changed by other writer: probe again
+  for (uint32_t attempt = 0; attempt < MEMPAGE_UPSERT_PROBES; ++attempt) {
+    UpsertEntry* free_bucket = nullptr;
+    UpsertEntry free_value = 0;
+    bool changed = false;
+
+    for (uint32_t probe = 0; probe < MEMPAGE_UPSERT_PROBES && !changed; ++probe) {
+      UpsertEntry* bucket =
+          &upsert_index->shared_elements[(hash + probe) % options.upsert_buckets];
+      UpsertEntry current = __atomic_load_n(bucket, __ATOMIC_ACQUIRE);
+      if (current == 0) {
+        if (free_bucket == nullptr) {
+          free_bucket = bucket;
+        }
+        break;
+      }
+
+      // record of bucket is expired or replaced by page reuse
+      uint16_t current_page_id = (current >> 48) - 1;
+      uint32_t current_idx = current & UINT16_MAX;
+      SharedMemoryPage<ELEMENT_T>* page = live_upsert_page(current);
+      if (page == nullptr) {
+        if (free_bucket == nullptr) {
+          free_bucket = bucket;
+          free_value = current;
+        }
+        continue;
+      }
+      if (!same_key(record, page, current_idx)) {
+        continue;
+      }
+
+      if (!__atomic_compare_exchange_n(bucket, &current, entry, false, __ATOMIC_ACQ_REL,
+                                       __ATOMIC_ACQUIRE)) {
+        changed = true;
+        continue;
+      }
+
+      TablePageIndexElement& index_record = table_index->shared_elements[current_page_id];
+      uint64_t bit = 1ULL << (current_idx % 64);
+      uint64_t word =
+          __atomic_fetch_or(&dead_bits(page)[current_idx / 64], bit, __ATOMIC_RELEASE);
+      if (!(word & bit)) {
+        __atomic_fetch_add(&index_record.page_elements_dead, 1, __ATOMIC_RELAXED);
+      }
+      return;
+    }
+
+    if (changed) {
+      continue;
+    }
+    if (free_bucket == nullptr ||
+        __atomic_compare_exchange_n(free_bucket, &free_value, entry, false, __ATOMIC_ACQ_REL,
+                                    __ATOMIC_ACQUIRE)) {
+      return;
+    }
+  }
+}
+
+//-----------------------------------------------------
+// live_upsert_page     page of record of upsert index bucket
+//-----------------------------------------------------
+// nullptr if page of record is expired or reused
+template <typename ELEMENT_T>
+SharedMemoryPage<ELEMENT_T>* Table<ELEMENT_T>::live_upsert_page(UpsertEntry entry) {
+  uint16_t page_id = (entry >> 48) - 1;
+  uint32_t element_idx = entry & UINT16_MAX;
+  if (page_id >= table_max_pages || element_idx >= max_elements_in_page) {
+    return nullptr;
+  }
+
+  TablePageIndexElement& index_record = table_index->shared_elements[page_id];
+  uint32_t generation = (entry >> 16) & UINT32_MAX;
+  if (__atomic_load_n(&index_record.generation, __ATOMIC_ACQUIRE) != generation ||
+      __atomic_load_n(&index_record.expire_at, __ATOMIC_ACQUIRE) < timing::getTimestampSec()) {
+    return nullptr;
+  }
+  return getPage(page_id);
+}
+
+//-----------------------------------------------------
+// same_key             upsert key of stored record equals record one
+//-----------------------------------------------------
+template <typename ELEMENT_T>
+bool Table<ELEMENT_T>::same_key(const ELEMENT_T& record, SharedMemoryPage<ELEMENT_T>* page,
+                                uint32_t element_idx) {
+  ELEMENT_T stored;
+  PageView<ELEMENT_T>(*this, page->shared_elements, max_elements_in_page).get(element_idx, stored);
+  for (const auto& field : options.upsert_key) {
+    if (std::memcmp((const uint8_t*)&record + field.offset,
+                    (const uint8_t*)&stored + field.offset, field.size) != 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+//-----------------------------------------------------
+// dead_bits            superseded records bitmap of page
+//-----------------------------------------------------
+template <typename ELEMENT_T>
+uint64_t* Table<ELEMENT_T>::dead_bits(SharedMemoryPage<ELEMENT_T>* page) {
+  if (upsert_index == nullptr) {
+    return nullptr;
+  }
+  return (uint64_t*)((uint8_t*)page->shared_elements + dead_bits_offset);
+}
+
+//-----------------------------------------------------
+// getPayload
+//-----------------------------------------------------
+template <typename ELEMENT_T>
+const uint8_t* Table<ELEMENT_T>::getPayload(const PayloadRef& ref, uint32_t& payload_size) {
+  payload_size = 0;
+  if (ref.offset + sizeof(uint32_t) > options.page_extent_size) {
+    std::cerr << "ERROR Table::getPayload bad offset:" << ref.offset << std::endl;
+    return nullptr;
+  }
+
+  SharedMemoryPage<ELEMENT_T>* page = getPage(ref.page_id);
+  if (page == nullptr) {
+    std::cerr << "ERROR Table::getPayload page == nullptr" << std::endl;
+    return nullptr;
+  }
+
+  const uint8_t* entry = (uint8_t*)(page->shared_elements + max_elements_in_page) + ref.offset;
+  std::memcpy(&payload_size, entry, sizeof(payload_size));
+  if (ref.offset + sizeof(uint32_t) + payload_size > options.page_extent_size) {
+    std::cerr << "ERROR Table::getPayload bad size:" << payload_size << std::endl;
+    payload_size = 0;
+    return nullptr;
+  }
+  return entry + sizeof(uint32_t);
+}
+
+//-----------------------------------------------------
+// update_index_record  add records to page zones & keys
+//-----------------------------------------------------
+// lock free, values only grow (zones.max, keys) or shrink (zones.min)
+template <typename ELEMENT_T>
+void Table<ELEMENT_T>::update_index_record(TablePageIndexElement& record,
+                                           const ZoneMap& records_zones,
+                                           const ELEMENT_T* records, uint32_t records_count) {
+  for (uint16_t zone_idx = 0; zone_idx < options.zones.size(); ++zone_idx) {
+    atomic_min(record.zones.min[zone_idx], records_zones.min[zone_idx]);
+    atomic_max(record.zones.max[zone_idx], records_zones.max[zone_idx]);
+  }
+
+  if (key_filters == nullptr) {
+    return;
+  }
+  KeyFilter keys = page_keys(record);
+  for (uint16_t key_idx = 0; key_idx < options.keys.size(); ++key_idx) {
+    for (uint32_t idx = 0; idx < records_count; ++idx) {
+      keys.add(key_idx, field_value(records[idx], options.keys[key_idx]));
+    }
+  }
+}
+
+//-----------------------------------------------------
+// write_elements        copy elements to page according to page format
+//-----------------------------------------------------
+template <typename ELEMENT_T>
+void Table<ELEMENT_T>::write_elements(ELEMENT_T* page_elements, uint32_t element_idx,
+                                      const ELEMENT_T* records, uint32_t records_count) {
+  if (options.page_format == PageFormat::ROWS) {
+    std::memcpy(&page_elements[element_idx], records, sizeof(ELEMENT_T) * records_count);
+    return;
+  }
+
+  // PageFormat::COLUMNS -> scatter every field to its column
+  uint8_t* page_memory = (uint8_t*)page_elements;
+  for (uint16_t column_idx = 0; column_idx < options.columns.size(); ++column_idx) {
+    const ColumnInfo& column = options.columns[column_idx];
+    uint8_t* destination = page_memory + column_offsets[column_idx] + element_idx * column.size;
+
+    for (uint32_t idx = 0; idx < records_count; ++idx) {
+      std::memcpy(destination + idx * column.size, (uint8_t*)&records[idx] + column.offset,
+                  column.size);
+    }
+  }
+}
+
+//-----------------------------------------------------
+// field_value       zone or key field of record as uint32_t
+//-----------------------------------------------------
+template <typename ELEMENT_T>
+uint32_t Table<ELEMENT_T>::field_value(const ELEMENT_T& record, const ColumnInfo& column) {
+  const uint8_t* field = (const uint8_t*)&record + column.offset;
+
+  switch (column.size) {
+    case 1:
+      return *field;
+    case 2: {
+      uint16_t value;
+      std::memcpy(&value, field, sizeof(value));
+      return value;
+    }
+    default: {
+      uint32_t value;
+      std::memcpy(&value, field, sizeof(value));
+      return value;
+    }
+  }
+}
+
+//-----------------------------------------------------
+// preallocate_loop     background thread routine
+//-----------------------------------------------------
+// keeps next options.spare_pages page slots backed by allocated memory,
+// so addRecord only maps ready page on rollover
+template <typename ELEMENT_T>
+void Table<ELEMENT_T>::preallocate_loop() {
+  std::vector<uint16_t> prepared_ids;
+  std::unique_lock<std::mutex> guard(preallocator_mutex);
+
+  while (!preallocator_stop) {
+    preallocate_requested = false;
+    guard.unlock();
+
+    std::vector<uint16_t> page_ids = spare_page_ids();
+    // nothing changed since last time
+    if (page_ids != prepared_ids) {
+      for (uint16_t page_id : page_ids) {
+        prepare_page(page_id);
+      }
+      prepared_ids = std::move(page_ids);
+    }
 
-    const auto elements = page->getElements();
-    const auto size = max_elements_in_page - record.page_elements_available;
-
-    // processor.type == element_processor
-    // go throught all elements and apply process function
-    for (uint32_t idx = 0; idx < size; ++idx) {
-      processor.process_element(elements[idx]);
-    }
+    guard.lock();
+    preallocator_wakeup.wait_for(guard, std::chrono::seconds(MEMPAGE_PREALLOCATE_INTERVAL_SEC),
+                                 [this] { return preallocator_stop || preallocate_requested; });
   }
 }
 
 //-----------------------------------------------------
-// cleanup
+// spare_page_ids       page slots addRecord will take next
 //-----------------------------------------------------
 template <typename ELEMENT_T>
-void Table<ELEMENT_T>::cleanup() {
-  lock->enter();
-  uint16_t idx = 0;
-  TablePageIndexElement* index_first = table_index->getElements();
-  TablePageIndexElement* index_current;
+std::vector<uint16_t> Table<ELEMENT_T>::spare_page_ids() {
+  std::vector<uint16_t> result;
 
-  // search for free space in pages
-  for (idx = 0; idx < table_max_pages; ++idx) {
-    // current page row (pointer to shared memory)
-    index_current = index_first + idx;
-    // if page not empty and not expired
+  // own lock instance, SharedMutex is used by one thread
+  locks::SharedMutex preallocator_lock(&header->lock, table_index->page_name,
+                                       [this]() { repair_after_owner_death(); });
+  preallocator_lock.enter();
 
-    if (index_current->expire_at > 0) {
-      // mark as deleted
-      SharedMemoryPage<ELEMENT_T>* page = getPageByName(index_current->page_name);
-      if (page == nullptr) {
-        std::cerr << "ERROR Table::cleanup Cannot allocate page Table::cleanup()" << std::endl;
-        continue;
-      }
-      page->shared_pageinfo->unlinked = true;
-      SharedMemoryPage<ELEMENT_T>::unlink(index_current->page_name);
-      clear_index_record(*index_current);
-    } else {
-      // stop here. next pages are unused
+  // same order as take_free_page(): free bitmap first, then high_water_mark
+  for (uint32_t idx = 0; idx < header->high_water_mark; ++idx) {
+    if (result.size() >= options.spare_pages) {
       break;
     }
+    if (header->free_pages[idx / 64] & (1ULL << (idx % 64))) {
+      result.push_back(idx);
+    }
   }
 
-  lock->exit();
+  for (uint32_t idx = header->high_water_mark;
+       idx < table_max_pages && result.size() < options.spare_pages; ++idx) {
+    result.push_back(idx);
+  }
 
-  release_open_pages();
-  SharedMemoryPage<ELEMENT_T>::unlink(table_index->page_name);
+  preallocator_lock.exit();
+  return result;
 }
 
 //-----------------------------------------------------
-// release_open_pages
+// prepare_page         allocate and prefault page memory
 //-----------------------------------------------------
 template <typename ELEMENT_T>
-void Table<ELEMENT_T>::release_open_pages() {
-  for (auto page : opened_pages_list) {
-    delete page;
+void Table<ELEMENT_T>::prepare_page(uint16_t page_id) {
+  if (arena != nullptr) {
+    bool available = checkSharedMemAvailability();
+    spare_memory_available = available;
+    if (available) {
+      arena->prefault(page_id * arena_page_size, arena_page_size);
+    }
+    return;
+  }
+
+  // page already exists (expired one or prepared by other process)
+  std::string name = page_name(page_id);
+  int fd = shm_open(name.c_str(), O_RDONLY, (mode_t)0666);
+  if (fd != -1) {
+    close(fd);
+    return;
   }
-  opened_pages_list.clear();
+
+  // create and zero fill, mapping is dropped but memory stays in shm object
+  // until addRecord opens it
+  std::cout << "PREALLOCATE page:" << name << std::endl;
+  SharedMemoryPage<ELEMENT_T> page(name, page_elements, options.huge_pages);
 }
 
 //-----------------------------------------------------
-// Table addRecord
+// page_name         shared memory name of table page
 //-----------------------------------------------------
 template <typename ELEMENT_T>
-ElementPointer<ELEMENT_T> Table<ELEMENT_T>::addRecord(ELEMENT_T* records_pointer,
-                                                      uint32_t records_cout,
-                                                      uint32_t lifetime_seconds) {
-  // check if there is time to release some pages
-  release_expired_memory_pages();
-
-  if (records_cout > max_elements_in_page) {
-    std::cout << "ERROR Table::addRecord records_cout > max_elements_in_page:"
-              << " records_cout:" << records_cout
-              << " max_elements_in_page:" << max_elements_in_page << std::endl;
+std::string Table<ELEMENT_T>::page_name(uint16_t page_id) {
+  return table_index->page_name + ":" + std::to_string(page_id);
+}
 
-    return ElementPointer<ELEMENT_T>(*this, ErrorCode::RECORD_SIZE_TO_BIG);
+//-----------------------------------------------------
+// getPage
+//-----------------------------------------------------
+template <typename ELEMENT_T>
+SharedMemoryPage<ELEMENT_T>* Table<ELEMENT_T>::getPage(uint16_t page_id) {
+  if (page_id >= table_max_pages) {
+    return nullptr;
   }
 
-  std::string insert_page_name;
-  uint32_t insert_element_idx;
-  uint32_t current_time = timing::getTimestampSec();
-  TablePageIndexElement* index_record;
-  bool current_record_was_cleared;
+  // let's look for page now in local heap, without lock: handle is not deleted
+  // while caller reads (enterRead), even if other thread drops it
+  SharedMemoryPage<ELEMENT_T>* page = __atomic_load_n(&page_handles[page_id], __ATOMIC_ACQUIRE);
+  if (page != nullptr &&
+      (arena != nullptr || !__atomic_load_n(&page->shared_pageinfo->unlinked, __ATOMIC_ACQUIRE))) {
+    return page;
+  }
 
-  // std::cout << "CURRENT_TIME: " << current_time << std::endl;
-  lock->enter();
+  std::lock_guard<std::mutex> guard(page_handles_mutex);
+  if (arena == nullptr) {
+    return map_page(page_id);
+  }
 
-  // search for free space in pages
-  for (uint16_t idx = 0; idx < table_max_pages; ++idx) {
-    // current page row (pointer to shared memory)
-    index_record = &table_index->shared_elements[idx];
-    // std::cout << "===> " << table_index->page_name + ":" +
-    // std::to_string(idx) << " AVAIL:" << index_record->page_elements_available
-    // << " expire_at:" << std::to_string(index_record->expire_at) << std::endl;
-
-    current_record_was_cleared = false;
-    // page expired -> make it empty and use it to save records
-    // [expired][expired][data][expired][data][expired][expired][expired][expired][zero][unused][unused]...[unused]
-    //   ^        ^              ^              ^        ^        ^        ^
-    if (index_record->expire_at > 0 && index_record->expire_at < current_time) {
-      // index_record->expire_at = 0;
-      clear_index_record(*index_record);
-      current_record_was_cleared = true;
-    }
-
-    // page exist and not fit (go next)
-    // [expired][expired][data][expired][data][expired][expired][expired][expired][zero][unused][unused]...[unused]
-    //   ^        ^              ^              ^        ^        ^        ^
-    else if (index_record->expire_at > 0 && index_record->page_elements_available < records_cout) {
-      continue;
-    }
+  // arena is mapped once, page is just a view at fixed offset
+  page = page_handles[page_id];
+  if (page == nullptr) {
+    page = new SharedMemoryPage<ELEMENT_T>(
+        page_name(page_id), arena->getMemory() + page_id * arena_page_size, arena_page_size);
+    page->page_id = page_id;
+    __atomic_store_n(&page_handles[page_id], page, __ATOMIC_RELEASE);
+  }
+  return page;
+}
 
-    // page fit our needs. let's use it
-    insert_page_name = table_index->page_name + ":" + std::to_string(idx);
+//-----------------------------------------------------
+// map_page          getPage for separate shm objects
+//-----------------------------------------------------
+template <typename ELEMENT_T>
+SharedMemoryPage<ELEMENT_T>* Table<ELEMENT_T>::map_page(uint16_t page_id) {
+  SharedMemoryPage<ELEMENT_T>*& page = page_handles[page_id];
 
-    // page is empty -> use it
-    // [expired][expired][data][expired][data][expired][expired][expired][expired][zero][unused][unused]...[unused]
-    //                                                                              ^
-    if (index_record->expire_at == 0) {
-      // page still has full capacity, lets insert at the begining
-      insert_element_idx = 0;
-      if (current_record_was_cleared) {
-        std::cout << "USE EXPIRED page:" << insert_page_name << std::endl;
-      } else {
-        std::cout << "USE NEW page:" << insert_page_name << std::endl;
-      }
+  // page was unlinked and could be created again by other process,
+  // don't wait for unmap_unlinked_pages()
+  if (page != nullptr && page->shared_pageinfo->unlinked) {
+    drop_page_handle(page);
+  }
 
-      // calculate capacity after we will put records
-      index_record->page_elements_available = max_elements_in_page - records_cout;
-      // copy page_name to shared meme
-      std::memcpy(index_record->page_name, insert_page_name.c_str(), insert_page_name.length());
-
-      // fill with zero next index row in case last row  has no space
-      // [data][data][data][data][data][data][data][data][data][zero][unused][unused]...[unused]
-      //                                                         ^     ^- need to be marked as zero
-      if (!current_record_was_cleared && (idx + 1) < table_max_pages) {
-        // table_index->shared_elements[idx + 1].expire_at = 0;
-        clear_index_record(table_index->shared_elements[idx + 1]);
-      }
-    }
-    // or use current page
-    else {
-      // std::cout << "USE EXISTING page:" << insert_page_name << std::endl;
-      // max_elements_in_page stored in table
-      // must be the same on all program instances
-      insert_element_idx = max_elements_in_page - index_record->page_elements_available;
-      // decrease available elements
-      index_record->page_elements_available -= records_cout;
-    }
+  // if not already open or created -> do it
+  if (page == nullptr) {
+    SharedMemoryPage<ELEMENT_T>* mapped =
+        new SharedMemoryPage<ELEMENT_T>(page_name(page_id), page_elements, options.huge_pages);
 
-    // page will expire after N seconds
-    uint32_t expire_time;
-    if (lifetime_seconds != 0) {
-      expire_time = current_time + lifetime_seconds;
-    } else {
-      expire_time = current_time + record_expire_seconds;
+    if (!mapped->isAllocated()) {
+      std::cerr << "ERROR SharedMemoryPage::getPage page not allocated" << std::endl;
+      delete mapped;
+      return nullptr;
     }
+    mapped->page_id = page_id;
+    __atomic_store_n(&page, mapped, __ATOMIC_RELEASE);
+  }
 
-    // update page expire time only if record expire time greater
-    if (expire_time > index_record->expire_at) {
-      index_record->expire_at = expire_time;
-    }
+  return page;
+}
 
-    break;
+//-----------------------------------------------------
+// enterRead
+//-----------------------------------------------------
+// reader announces epoch it started at, pages retired since then are kept for it
+template <typename ELEMENT_T>
+void Table<ELEMENT_T>::enterRead() {
+  if (read_depth++ > 0) {
+    return;
+  }
+  if (reader_slot < 0) {
+    take_reader_slot();
   }
 
-  lock->exit();
+  if (reader_slot >= 0) {
+    uint32_t epoch = __atomic_load_n(&header->epoch, __ATOMIC_ACQUIRE) + 1;
+    __atomic_store_n(&header->readers[reader_slot].epoch, epoch, __ATOMIC_SEQ_CST);
+  } else {
+    __atomic_add_fetch(&header->unslotted_readers, 1, __ATOMIC_SEQ_CST);
+  }
+  // index is read without lock: either reader sees retired pages as gone
+  // or reclaimer sees its epoch
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
 
-  if (insert_page_name.length() == 0) {
-    std::cerr << "ERROR Table::addRecord() insert_page_name.length() == 0" << std::endl;
-    return ElementPointer<ELEMENT_T>(*this, ErrorCode::NO_SPACE_TO_INSERT);
+//-----------------------------------------------------
+// exitRead
+//-----------------------------------------------------
+template <typename ELEMENT_T>
+void Table<ELEMENT_T>::exitRead() {
+  if (read_depth == 0 || --read_depth > 0) {
+    return;
   }
 
-  // now we have page to insert
-  // and position to insert
-  // let's look for page now in local heap or allocate it
-  SharedMemoryPage<ELEMENT_T>* page = getPageByName(insert_page_name);
+  if (reader_slot >= 0) {
+    __atomic_store_n(&header->readers[reader_slot].epoch, 0, __ATOMIC_RELEASE);
+  } else {
+    __atomic_sub_fetch(&header->unslotted_readers, 1, __ATOMIC_RELEASE);
+  }
+}
 
-  if (page == nullptr) {
-    std::cerr << "ERROR Table::addRecord() page == nullptr" << std::endl;
-    return ElementPointer<ELEMENT_T>(*this, ErrorCode::CANT_FIND_PAGE);
+//-----------------------------------------------------
+// take_reader_slot     slot of TableHeader::readers for this object
+//-----------------------------------------------------
+template <typename ELEMENT_T>
+void Table<ELEMENT_T>::take_reader_slot() {
+  uint32_t pid = getpid();
+  for (int32_t idx = 0; idx < MEMPAGE_READER_SLOTS; ++idx) {
+    uint32_t free_pid = 0;
+    if (__atomic_compare_exchange_n(&header->readers[idx].pid, &free_pid, pid, false,
+                                    __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+      reader_slot = idx;
+      return;
+    }
   }
+  std::cerr << "ERROR Table::enterRead no free reader slot:" << table_index->page_name
+            << std::endl;
+}
 
-  // copy array of (records_cout) elements to shared memeory
-  std::memcpy(&page->shared_elements[insert_element_idx], records_pointer,
-              sizeof(ELEMENT_T) * records_cout);
+//-----------------------------------------------------
+// begin_index_update / end_index_update
+//-----------------------------------------------------
+// readers don't take lock, they retry if version was odd or changed
+template <typename ELEMENT_T>
+void Table<ELEMENT_T>::begin_index_update() {
+  __atomic_store_n(&header->index_version, header->index_version + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+}
 
-  // std::cout << "COPY :" << insert_page_name << " idx:" << insert_element_idx
-  // << " cout:" << records_cout << " size:" << sizeof(ELEMENT_T)*records_cout << std::endl;
-  return ElementPointer<ELEMENT_T>(*this, insert_page_name, insert_element_idx, records_cout);
+template <typename ELEMENT_T>
+void Table<ELEMENT_T>::end_index_update() {
+  __atomic_store_n(&header->index_version, header->index_version + 1, __ATOMIC_RELEASE);
 }
 
 //-----------------------------------------------------
-// localGetPageByName
+// repair_after_owner_death
 //-----------------------------------------------------
+// owner could die rolling tail page over: tails are dropped, writers open new pages.
+// pages it took but didn't publish are unused until cleanup
 template <typename ELEMENT_T>
-SharedMemoryPage<ELEMENT_T>* Table<ELEMENT_T>::localGetPageByName(const std::string& page_to_look) {
-  // find page in open pages list
-  for (auto& page : opened_pages_list) {
-    if (page->page_name == page_to_look) {
-      return page;
+void Table<ELEMENT_T>::repair_after_owner_death() {
+  // index update was interrupted: odd version would make readers wait for nobody
+  // and next update would leave it odd (readers would trust torn records)
+  if (header->index_version & 1) {
+    std::cerr << "WARNING Table::repair_after_owner_death index update was interrupted:"
+              << table_index->page_name << std::endl;
+    end_index_update();
+  }
+  for (uint32_t shard = 0; shard < MEMPAGE_TAIL_SHARDS; ++shard) {
+    for (uint32_t size_class = 0; size_class < MEMPAGE_SIZE_CLASSES; ++size_class) {
+      __atomic_store_n(&header->tail_page_id[shard][size_class], 0, __ATOMIC_RELEASE);
     }
   }
+}
 
-  return nullptr;
+//-----------------------------------------------------
+// retire_page          hide page from new readers, must be called under lock
+//-----------------------------------------------------
+// epoch is incremented by caller after all pages are retired
+template <typename ELEMENT_T>
+void Table<ELEMENT_T>::retire_page(TablePageIndexElement& record) {
+  record.retired_epoch = __atomic_load_n(&header->epoch, __ATOMIC_RELAXED) + 1;
 }
 
 //-----------------------------------------------------
-// getPagesByName
+// oldest_reader_epoch  UINT32_MAX if nobody reads
 //-----------------------------------------------------
+// slots of crashed processes are freed
 template <typename ELEMENT_T>
-SharedMemoryPage<ELEMENT_T>* Table<ELEMENT_T>::getPageByName(const std::string& page_to_look) {
-  // let's look for page now in local heap
-  SharedMemoryPage<ELEMENT_T>* page = localGetPageByName(page_to_look);
+uint32_t Table<ELEMENT_T>::oldest_reader_epoch() {
+  // pairs with enterRead()
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&header->unslotted_readers, __ATOMIC_SEQ_CST) > 0) {
+    return 0;
+  }
 
-  // if not already open or created -> do it
-  if (page == nullptr || !page->isAllocated()) {
-    page = new SharedMemoryPage<ELEMENT_T>(page_to_look, max_elements_in_page);
+  uint32_t oldest = UINT32_MAX;
+  for (auto& slot : header->readers) {
+    uint32_t epoch = __atomic_load_n(&slot.epoch, __ATOMIC_SEQ_CST);
+    if (epoch == 0) {
+      continue;
+    }
+    uint32_t pid = __atomic_load_n(&slot.pid, __ATOMIC_ACQUIRE);
+    if (pid != 0 && kill(pid, 0) == -1 && errno == ESRCH) {
+      std::cout << "Table::oldest_reader_epoch free slot of dead process:" << pid << std::endl;
+      __atomic_store_n(&slot.epoch, 0, __ATOMIC_RELEASE);
+      __atomic_store_n(&slot.pid, 0, __ATOMIC_RELEASE);
+      continue;
+    }
+    oldest = std::min(oldest, epoch);
+  }
+  return oldest;
+}
 
-    if (!page->isAllocated()) {
-      std::cerr << "ERROR SharedMemoryPage::getPageByName page not allocated" << std::endl;
-      delete page;
-      return nullptr;
+//-----------------------------------------------------
+// reclaim_retired_pages  must be called under lock
+//-----------------------------------------------------
+// retired pages no reader can see anymore: pages of cleanup() are released,
+// expired ones become rollover candidates and their memory is released after
+// MEMPAGE_REMOVE_EXPIRED_PAGES_DELAY_SEC (if they were not reused)
+template <typename ELEMENT_T>
+bool Table<ELEMENT_T>::reclaim_retired_pages(uint32_t current_time, uint16_t max_released,
+                                             uint32_t release_delay) {
+  uint32_t oldest_epoch = oldest_reader_epoch();
+  uint16_t released = 0;
+  bool left_over = false;
+  begin_index_update();
+
+  for (uint16_t idx = 0; idx < header->high_water_mark; ++idx) {
+    TablePageIndexElement& index_record = table_index->shared_elements[idx];
+    if (index_record.retired_epoch == 0 || index_record.retired_epoch >= oldest_epoch) {
+      continue;
+    }
+
+    bool expired = index_record.expire_at != 0;
+    if (expired) {
+      // writer of cleared tail page extended it, page has new records
+      if (index_record.expire_at >= current_time) {
+        index_record.retired_epoch = 0;
+        continue;
+      }
+      unpin_pinned_pages(idx);
+      set_free_page(idx);
+      if (index_record.expire_at + release_delay > current_time) {
+        continue;
+      }
+    }
+    if (released >= max_released) {
+      left_over = true;
+      continue;
+    }
+
+    if (!release_page(idx)) {
+      std::cerr << "ERROR Table::reclaim_retired_pages cannot acquire page:" << idx << std::endl;
+      continue;
     }
 
-    // close handlers when destroyed
-    opened_pages_list.push_back(page);
+    clear_index_record(index_record);
+    set_free_page(idx);
+    ++released;
   }
 
-  return page;
+  // released pages at the end are unused again
+  // [data][zero][data][zero][zero][unused]...[unused]
+  //                     ^--- high_water_mark
+  while (header->high_water_mark > 0) {
+    uint16_t last_idx = header->high_water_mark - 1;
+    const TablePageIndexElement& index_record = table_index->shared_elements[last_idx];
+    if (index_record.expire_at != 0 || index_record.retired_epoch != 0) {
+      break;
+    }
+    header->free_pages[last_idx / 64] &= ~(1ULL << (last_idx % 64));
+    header->high_water_mark--;
+  }
+  end_index_update();
+  return left_over;
 }
 
 //------------------------------------------------------------------
@@ -371,8 +2342,14 @@ SharedMemoryPage<ELEMENT_T>* Table<ELEMENT_T>::getPageByName(const std::string&
 //      ^ remove at this point will release [aaa] but not release [ab]
 //        in this case [ab] will point to unexisted page
 //        application should care about Table A & Table B consistency
+//        or keep payloads inline (TableOptions::page_extent_size)
 template <typename ELEMENT_T>
 void Table<ELEMENT_T>::release_expired_memory_pages() {
+  // done by maintenance_loop()
+  if (options.maintenance_thread) {
+    return;
+  }
+
   uint32_t current_time = timing::getTimestampSec();
 
   // check local timer
@@ -381,80 +2358,151 @@ void Table<ELEMENT_T>::release_expired_memory_pages() {
   }
   time_to_check_page_expire = current_time + MEMPAGE_CHECK_EXPIRED_PAGES_INTERVAL_SEC;
 
-  lock->enter();
+  expire_pages(*lock, current_time, MEMPAGE_REMOVE_EXPIRED_PAGES_AT_ONCE,
+               MEMPAGE_REMOVE_EXPIRED_PAGES_DELAY_SEC);
+  unmap_unlinked_pages();
+}
+
+//-----------------------------------------------------
+// expire_pages
+//-----------------------------------------------------
+template <typename ELEMENT_T>
+bool Table<ELEMENT_T>::expire_pages(locks::SharedMutex& mutex, uint32_t current_time,
+                                    uint16_t max_released, uint32_t release_delay) {
+  bool left_over = false;
+
+  mutex.enter();
   // check shared timer
   // only one process should perform maintenance
   if (table_index->shared_pageinfo->expiration_check <= current_time) {
-    uint16_t idx = 0;
-    uint16_t last_data_idx = 0;
-
     // update shared data
-    table_index->shared_pageinfo->expiration_check = time_to_check_page_expire;
-
-    // search for free space in all table pages
-    for (idx = 0; idx < table_max_pages; ++idx) {
+    table_index->shared_pageinfo->expiration_check =
+        current_time + MEMPAGE_CHECK_EXPIRED_PAGES_INTERVAL_SEC;
+
+    // expired pages are not selected by new readers, old ones may still scan them
+    // [expired][data][zero][data][expired][data][unused][unused]...[unused]
+    //     ^             ^           ^              ^--- high_water_mark
+    bool retired = false;
+    for (uint16_t idx = 0; idx < header->high_water_mark; ++idx) {
       // current page row (pointer to shared memory)
-      const TablePageIndexElement& index_record = table_index->shared_elements[idx];
-
-      // page expired -> make it empty and use it to save records
-      // [expired][expired][data][expired][data][expired][expired][expired][expired][zero][unused][unused]...[unused]
-      //                     ^              ^
-      if (index_record.expire_at > 0 &&
-          index_record.expire_at + MEMPAGE_REMOVE_EXPIRED_PAGES_DELAY_SEC > current_time) {
-        //                         ^^^ to be sure page not being used by anyone
-        last_data_idx = idx;
-      }
+      TablePageIndexElement& index_record = table_index->shared_elements[idx];
 
-      // [expired][expired][data][expired][data][expired][expired][expired][expired][zero][unused][unused]...[unused]
-      //                                                                              ^
-      if (index_record.expire_at == 0) {
-        break;
+      if (index_record.expire_at == 0 || index_record.expire_at >= current_time ||
+          index_record.retired_epoch != 0) {
+        continue;
+      }
+      retire_page(index_record);
+      // inline payloads are used by records of live pages (pairs with pin_page)
+      __atomic_thread_fence(__ATOMIC_SEQ_CST);
+      if ((uint32_t)__atomic_load_n(&index_record.payload_pins, __ATOMIC_SEQ_CST) > 0) {
+        __atomic_store_n(&index_record.retired_epoch, 0, __ATOMIC_SEQ_CST);
+        continue;
       }
+      retired = true;
+    }
+    if (retired) {
+      __atomic_add_fetch(&header->epoch, 1, __ATOMIC_SEQ_CST);
     }
 
-    uint16_t cleared_counter = 0;
-    // std::cout << "idx:" << idx << " last_data_idx:" << last_data_idx << std::endl;
-    // mark as unlinked, release this pages locally and unlink
-    // [expired][expired][data][expired][data][expired][expired][expired][expired][zero][unused][unused]...[unused]
-    //                   last_data_idx ---^     ^        ^        ^        ^        ^--- idx
-    if (idx > 0 && last_data_idx < --idx) {
-      for (; last_data_idx < idx; idx--) {
-        TablePageIndexElement& index_record = table_index->shared_elements[idx];
-        // std::cout << "try to CLEAR page memory:" << index_record.page_name << std::endl;
-        SharedMemoryPage<ELEMENT_T>* page = getPageByName(index_record.page_name);
-
-        if (page == nullptr) {
-          std::cerr << "ERROR Table::release_expired_memory_pages cannot acquire page:"
-                    << index_record.page_name << std::endl;
-          continue;
-        }
+    left_over = reclaim_retired_pages(current_time, max_released, release_delay);
+    // rest is released by next round of any process
+    if (left_over) {
+      table_index->shared_pageinfo->expiration_check = current_time;
+    }
+  }
+
+  mutex.exit();
+  return left_over;
+}
 
-        page->shared_pageinfo->unlinked = true;
-        SharedMemoryPage<ELEMENT_T>::unlink(page->page_name);
+//-----------------------------------------------------
+// unmap_unlinked_pages
+//-----------------------------------------------------
+// release unlinked pages mappings
+// all processes must do that
+template <typename ELEMENT_T>
+void Table<ELEMENT_T>::unmap_unlinked_pages() {
+  std::lock_guard<std::mutex> guard(page_handles_mutex);
+  free_detached_pages();
 
-        clear_index_record(index_record);
-        // clear only certain portion per time;
-        if (MEMPAGE_REMOVE_EXPIRED_PAGES_AT_ONCE <= ++cleared_counter) {
-          break;
-        }
-      }
+  // arena pages are views, nothing to unmap
+  if (arena != nullptr) {
+    return;
+  }
+
+  for (auto& page : page_handles) {
+    if (page != nullptr && page->shared_pageinfo->unlinked) {
+      std::cout << "RELEASING unlinked page:" << page->page_name << std::endl;
+      drop_page_handle(page);
     }
   }
+}
 
-  lock->exit();
+//-----------------------------------------------------
+// drop_page_handle  page_handles_mutex must be held
+//-----------------------------------------------------
+// readers which start after epoch is incremented can't get the handle anymore
+template <typename ELEMENT_T>
+void Table<ELEMENT_T>::drop_page_handle(SharedMemoryPage<ELEMENT_T>*& page) {
+  SharedMemoryPage<ELEMENT_T>* detached = page;
+  __atomic_store_n(&page, nullptr, __ATOMIC_SEQ_CST);
+  uint32_t epoch = __atomic_add_fetch(&header->epoch, 1, __ATOMIC_SEQ_CST);
+  detached_pages.push_back({detached, epoch});
+}
 
-  // clear opened_pages_list from unlinked items
-  // all processes must do that
-  std::vector<SharedMemoryPage<ELEMENT_T>*> new_pages_list;
-  for (auto page : opened_pages_list) {
-    if (page->shared_pageinfo->unlinked) {
-      std::cout << "RELEASING unlinked page:" << page->page_name << std::endl;
-      delete page;
+//-----------------------------------------------------
+// free_detached_pages  page_handles_mutex must be held
+//-----------------------------------------------------
+template <typename ELEMENT_T>
+void Table<ELEMENT_T>::free_detached_pages() {
+  if (detached_pages.empty()) {
+    return;
+  }
+
+  uint32_t oldest_epoch = oldest_reader_epoch();
+  size_t kept = 0;
+  for (auto& detached : detached_pages) {
+    if (detached.epoch < oldest_epoch) {
+      delete detached.page;
     } else {
-      new_pages_list.push_back(page);
+      detached_pages[kept++] = detached;
     }
   }
-  opened_pages_list = std::move(new_pages_list);
+  detached_pages.resize(kept);
+}
+
+//-----------------------------------------------------
+// maintenance_loop     background thread routine
+//-----------------------------------------------------
+// release_expired_memory_pages() of all Table calls. pages left over after burst of
+// expiration are released at doubled rate every busy interval, low memory releases
+// expired pages without waiting MEMPAGE_REMOVE_EXPIRED_PAGES_DELAY_SEC for reuse
+template <typename ELEMENT_T>
+void Table<ELEMENT_T>::maintenance_loop() {
+  // own lock instance, SharedMutex is used by one thread
+  locks::SharedMutex maintainer_lock(&header->lock, table_index->page_name,
+                                     [this]() { repair_after_owner_death(); });
+  uint16_t max_released = MEMPAGE_REMOVE_EXPIRED_PAGES_AT_ONCE;
+  std::unique_lock<std::mutex> guard(maintainer_mutex);
+
+  while (!maintainer_stop) {
+    guard.unlock();
+
+    bool low_memory = sharedMemFreePercent() <= LOWMEM_WARNING_PERCENT;
+    bool left_over = expire_pages(
+        maintainer_lock, timing::getTimestampSec(),
+        low_memory ? MEMPAGE_MAINTENANCE_MAX_PAGES_AT_ONCE : max_released,
+        low_memory ? 0 : MEMPAGE_REMOVE_EXPIRED_PAGES_DELAY_SEC);
+    max_released = left_over ? std::min(max_released * 2, MEMPAGE_MAINTENANCE_MAX_PAGES_AT_ONCE)
+                             : MEMPAGE_REMOVE_EXPIRED_PAGES_AT_ONCE;
+    unmap_unlinked_pages();
+
+    guard.lock();
+    uint32_t interval_ms = left_over ? MEMPAGE_MAINTENANCE_BUSY_INTERVAL_MSEC
+                                     : MEMPAGE_CHECK_EXPIRED_PAGES_INTERVAL_SEC * 1000;
+    maintainer_wakeup.wait_for(guard, std::chrono::milliseconds(interval_ms),
+                               [this] { return maintainer_stop; });
+  }
 }
 
 /*-----------------------------------------------------------------
@@ -465,24 +2513,16 @@ void Table<ELEMENT_T>::release_expired_memory_pages() {
 // SharedMemoryPage Constructor
 //------------------------------------------------------------
 template <typename ELEMENT_T>
-SharedMemoryPage<ELEMENT_T>::SharedMemoryPage(std::string page_name, uint32_t elements)
+SharedMemoryPage<ELEMENT_T>::SharedMemoryPage(std::string page_name, uint32_t elements,
+                                              bool huge_pages)
     : page_name(page_name), shared_memory(nullptr) {
   if (!page_name.length()) {
     std::cout << "ERROR SharedMemoryPage::SharedMemoryPage page_name empty" << std::endl;
     return;
   }
 
-  // two processes could try to open the same page in a same time
-  // first will create page, but not truncate yet, second will open it
-  // compare size and remove page because it has wrong(zero) size
-  locks::CriticalSection lock(page_name);
-  lock.enter();
-  //   ^^^^^ will auto exited on class destruction, if exited before lock.exit()
-
   bool new_memory_allocated = false;
-  page_memory_size = sizeof(Page_information) + sizeof(ELEMENT_T) * elements;
-  uint32_t aligned_pages = page_memory_size / sysconf(_SC_PAGE_SIZE);
-  page_memory_size = (aligned_pages + 1) * sysconf(_SC_PAGE_SIZE);
+  page_memory_size = memory_size(elements, huge_pages);
 
   // try to create page
   int fd = shm_open(page_name.c_str(), O_RDWR | O_CREAT | O_EXCL, (mode_t)0666);
@@ -519,10 +2559,10 @@ SharedMemoryPage<ELEMENT_T>::SharedMemoryPage(std::string page_name, uint32_t el
     std::cout << "CREATE:" << page_name << " size:" << page_memory_size << std::endl;
   }
 
-  // read page size
-  struct stat buf;
-  fstat(fd, &buf);
-  int size = buf.st_size;
+  // two processes could try to open the same page in a same time
+  // first will create page, but not truncate yet, second will open it
+  // and wait for size. page with wrong size is removed
+  uint64_t size = sharedMemSize(fd);
 
   if (size != page_memory_size) {
     std::cerr << "ERROR SharedMemoryPage::SharedMemoryPage size != page_memory_size (" << page_name
@@ -532,9 +2572,6 @@ SharedMemoryPage<ELEMENT_T>::SharedMemoryPage(std::string page_name, uint32_t el
     return;
   }
 
-  // page well allocated, let other processes work with this page.
-  lock.exit();
-
   // map page to process local memory
   void* map = mmap(nullptr, page_memory_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
 
@@ -549,9 +2586,14 @@ SharedMemoryPage<ELEMENT_T>::SharedMemoryPage(std::string page_name, uint32_t el
     return;
   }
 
+  // must be advised before first touch
+  if (huge_pages) {
+    adviseHugePages(map, page_memory_size);
+  }
+
   shared_memory = map;
   shared_pageinfo = (Page_information*)shared_memory;
-  shared_elements = (ELEMENT_T*)((uint8_t*)shared_memory + sizeof(Page_information));
+  shared_elements = (ELEMENT_T*)((uint8_t*)shared_memory + elements_offset());
 
   if (new_memory_allocated) {
     // cleanup info structure & first element
@@ -562,6 +2604,32 @@ SharedMemoryPage<ELEMENT_T>::SharedMemoryPage(std::string page_name, uint32_t el
   // std::cout << "MAKE PAGE: " << page_name <<  "(" << page_memory_size << ") " << std::endl;
 };
 
+//------------------------------------------------------------
+// SharedMemoryPage Constructor (view)
+//------------------------------------------------------------
+template <typename ELEMENT_T>
+SharedMemoryPage<ELEMENT_T>::SharedMemoryPage(std::string page_name, void* memory,
+                                              uint32_t page_memory_size)
+    : page_name(page_name), page_memory_size(page_memory_size), shared_memory(memory),
+      owns_memory(false) {
+  shared_pageinfo = (Page_information*)shared_memory;
+  shared_elements = (ELEMENT_T*)((uint8_t*)shared_memory + elements_offset());
+}
+
+//------------------------------------------------------------
+// SharedMemoryPage memory_size
+//------------------------------------------------------------
+template <typename ELEMENT_T>
+uint32_t SharedMemoryPage<ELEMENT_T>::memory_size(uint32_t elements, bool huge_pages) {
+  uint32_t size = elements_offset() + sizeof(ELEMENT_T) * elements;
+  if (huge_pages) {
+    return (size + MEMPAGE_HUGE_PAGE_SIZE - 1) / MEMPAGE_HUGE_PAGE_SIZE * MEMPAGE_HUGE_PAGE_SIZE;
+  }
+
+  uint32_t aligned_pages = size / sysconf(_SC_PAGE_SIZE);
+  return (aligned_pages + 1) * sysconf(_SC_PAGE_SIZE);
+}
+
 //------------------------------------------------------------
 // SharedMemoryPage Destructor
 //------------------------------------------------------------
@@ -572,7 +2640,7 @@ SharedMemoryPage<ELEMENT_T>::~SharedMemoryPage() {
   // generate invalid memory references. The region is also automatically
   // unmapped when the process is terminated. On the other hand, closing the
   // file descriptor does not unmap the region.
-  if (shared_memory != nullptr) {
+  if (shared_memory != nullptr && owns_memory) {
     std::cout << "FREE " << page_name << " (" << page_memory_size << ") ";
     int res_unmap = munmap(shared_memory, page_memory_size);
     std::cout << (res_unmap == 0 ? "OK " : "FAIL ") << std::endl;
@@ -613,7 +2681,13 @@ ELEMENT_T* ElementPointer<ELEMENT_T>::get_data() {
     return nullptr;
   }
 
-  SharedMemoryPage<ELEMENT_T>* page = table.getPageByName(page_name);
+  // there is no solid element in memory to point to
+  if (table.options.page_format != PageFormat::ROWS) {
+    std::cerr << "ERROR ElementPointer::get_data not a PageFormat::ROWS table" << std::endl;
+    return nullptr;
+  }
+
+  SharedMemoryPage<ELEMENT_T>* page = table.getPage(page_id);
   if (page == nullptr) {
     std::cerr << "ERROR ElementPointer::get_data" << std::endl;
     return nullptr;
@@ -621,4 +2695,69 @@ ELEMENT_T* ElementPointer<ELEMENT_T>::get_data() {
 
   return page->getElements() + index;
 }
+
+/*-----------------------------------------------------------------
+* TableProcessor process_page     (default: element by element)
+*-----------------------------------------------------------------*/
+template <typename ELEMENT_T>
+void TableProcessor<ELEMENT_T>::process_page(const PageView<ELEMENT_T>& page) {
+  if (!page.is_columnar()) {
+    for (uint32_t idx = 0; idx < page.size; ++idx) {
+      if (page.is_live(idx)) {
+        process_element(page.row(idx));
+      }
+    }
+    return;
+  }
+
+  ELEMENT_T element;
+  for (uint32_t idx = 0; idx < page.size; ++idx) {
+    if (!page.is_live(idx)) {
+      continue;
+    }
+    page.get(idx, element);
+    process_element(element);
+  }
+}
+
+/*-----------------------------------------------------------------
+* PageView
+*-----------------------------------------------------------------*/
+template <typename ELEMENT_T>
+bool PageView<ELEMENT_T>::is_columnar() const {
+  return table.options.page_format == PageFormat::COLUMNS;
+}
+
+template <typename ELEMENT_T>
+bool PageView<ELEMENT_T>::is_live(uint32_t idx) const {
+  return dead == nullptr ||
+         !(__atomic_load_n(&dead[idx / 64], __ATOMIC_RELAXED) & (1ULL << (idx % 64)));
+}
+
+template <typename ELEMENT_T>
+const ELEMENT_T& PageView<ELEMENT_T>::row(uint32_t idx) const {
+  return elements[idx];
+}
+
+template <typename ELEMENT_T>
+template <typename T>
+const T* PageView<ELEMENT_T>::column(uint16_t column_idx) const {
+  return (const T*)((const uint8_t*)elements + table.column_offsets[column_idx]);
+}
+
+template <typename ELEMENT_T>
+void PageView<ELEMENT_T>::get(uint32_t idx, ELEMENT_T& element) const {
+  if (!is_columnar()) {
+    element = elements[idx];
+    return;
+  }
+
+  // gather element from columns
+  const uint8_t* page_memory = (const uint8_t*)elements;
+  for (uint16_t column_idx = 0; column_idx < table.options.columns.size(); ++column_idx) {
+    const ColumnInfo& column = table.options.columns[column_idx];
+    std::memcpy((uint8_t*)&element + column.offset,
+                page_memory + table.column_offsets[column_idx] + idx * column.size, column.size);
+  }
+}
 }  // namespace shared_mem
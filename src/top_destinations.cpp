@@ -12,10 +12,14 @@ namespace top {
 //
 // -----------------------------------------------------------------
 TopDstDatabase::TopDstDatabase() {
+  shared_mem::TableOptions options;
+  options.tail_shards = TOPDST_TAIL_SHARDS;
+  options.maintenance_thread = TOPDST_MAINTENANCE_THREAD;
+
   // 1k pages x 10k elements per page, 10m records total, expire 60 seconds
   db_index = new shared_mem::Table<i::DstInfo>(TOPDST_TABLENAME, TOPDST_PAGES /* pages */,
                                                TOPDST_ELEMENTS /* elements in page */,
-                                               TOPDST_EXPIRES /* page expire */);
+                                               TOPDST_EXPIRES /* page expire */, options);
 }
 
 // -----------------------------------------------------------------
@@ -32,22 +36,34 @@ void TopDstDatabase::truncate() {
   db_index->cleanup();
 }
 
+// -----------------------------------------------------------------
+//
+// -----------------------------------------------------------------
+std::string TopDstDatabase::lockStats() {
+  return db_index->lockStats();
+}
+
+// -----------------------------------------------------------------
+//
+// -----------------------------------------------------------------
+bool TopDstDatabase::saveSnapshot(const std::string& directory) {
+  return db_index->saveSnapshot(directory + "/" TOPDST_TABLENAME ".snapshot");
+}
+
+bool TopDstDatabase::loadSnapshot(const std::string& directory) {
+  return db_index->loadSnapshot(directory + "/" TOPDST_TABLENAME ".snapshot");
+}
+
 // -----------------------------------------------------------------
 //
 // -----------------------------------------------------------------
 bool TopDstDatabase::addDestination(std::string locale, std::string destination,
                                     std::string departure_date) {
-  uint32_t departure_date_int = query::date_to_int(departure_date);
-  if (departure_date_int == 0) {
-    std::cout << "addDestination() wrong departure date:" << departure_date << std::endl;
+  i::DstInfo info;
+  if (!make_dst_info(locale, destination, departure_date, info)) {
     return false;
   }
 
-  i::DstInfo info;
-  info.locale = query::locale_to_code(locale);
-  info.destination = query::origin_to_code(destination);
-  info.departure_date = departure_date_int;
-
   // Secondly add deal to index, include data position information
   auto di_result = db_index->addRecord(&info);
   if (di_result.error != shared_mem::ErrorCode::NO_ERROR) {
@@ -58,6 +74,57 @@ bool TopDstDatabase::addDestination(std::string locale, std::string destination,
   return true;
 }
 
+// -----------------------------------------------------------------
+// addDestinations
+// -----------------------------------------------------------------
+// bad records are skipped, the rest are added
+bool TopDstDatabase::addDestinations(const std::vector<DstRecord>& records) {
+  std::vector<i::DstInfo> infos(records.size());
+  std::vector<shared_mem::RecordsBatchItem<i::DstInfo>> batch;
+  batch.reserve(records.size());
+
+  bool good = true;
+  for (size_t idx = 0; idx < records.size(); ++idx) {
+    const DstRecord& record = records[idx];
+    if (!make_dst_info(record.locale, record.destination, record.departure_date, infos[idx])) {
+      good = false;
+      continue;
+    }
+    batch.push_back({&infos[idx], 1});
+  }
+
+  for (const auto& di_result : db_index->addRecords(batch)) {
+    if (di_result.error != shared_mem::ErrorCode::NO_ERROR) {
+      std::cout << "ERROR addDestinations():" << (int)di_result.error << std::endl;
+      good = false;
+    }
+  }
+  return good;
+}
+
+// -----------------------------------------------------------------
+// make_dst_info
+// -----------------------------------------------------------------
+bool TopDstDatabase::make_dst_info(const std::string& locale, const std::string& destination,
+                                   const std::string& departure_date, i::DstInfo& info) {
+  uint16_t departure_days = query::date_to_days(departure_date);
+  if (departure_days == 0) {
+    std::cout << "addDestination() wrong departure date:" << departure_date << std::endl;
+    return false;
+  }
+
+  uint16_t destination_code = query::origin_to_code(destination);
+  if (destination_code == 0) {
+    std::cout << "addDestination() wrong destination:" << destination << std::endl;
+    return false;
+  }
+
+  info.locale = query::locale_to_code(locale);
+  info.destination = destination_code;
+  info.departure_date = departure_days;
+  return true;
+}
+
 // -----------------------------------------------------------------
 //
 // -----------------------------------------------------------------
@@ -192,7 +259,7 @@ namespace utils {
 void print(const i::DstInfo& deal) {
   std::cout << "i::DEAL: " << query::code_to_locale(deal.locale) << " "
             << query::code_to_origin(deal.destination) << " "
-            << query::int_to_date(deal.departure_date) << std::endl;
+            << query::days_to_date(deal.departure_date) << std::endl;
 }
 
 void print(const DstInfo& deal) {
@@ -13,22 +13,32 @@ namespace top {
 #define TOPDST_TABLENAME "TopDst"
 #define TOPDST_PAGES 5000
 #define TOPDST_ELEMENTS 10000
+// see DEALINFO_TAIL_SHARDS
+#define TOPDST_TAIL_SHARDS 8
+#define TOPDST_MAINTENANCE_THREAD true
 
 void unit_test();
 
 namespace i {
 struct DstInfo {
   uint16_t locale;
-  uint32_t destination;
-  uint32_t departure_date;
+  uint16_t destination;
+  uint16_t departure_date;  // days since 1970-01-01
 };
 }  // namespace i
 
 struct DstInfo {
-  uint32_t destination;
+  uint16_t destination;
   uint32_t counter;
 };
 
+// TopDstDatabase::addDestinations entry
+struct DstRecord {
+  std::string locale;
+  std::string destination;
+  std::string departure_date;
+};
+
 namespace utils {
 void print(const i::DstInfo& deal);
 void print(const DstInfo& deal);
@@ -43,6 +53,8 @@ class TopDstDatabase {
   ~TopDstDatabase();
 
   bool addDestination(std::string locale, std::string destination, std::string departure_date);
+  // all records are added with one lock acquisition, false if any was not added
+  bool addDestinations(const std::vector<DstRecord>& records);
   std::vector<DstInfo> getLocaleTop(std::string locale, std::string departure_date_from,
                                     std::string departure_date_to, uint16_t limit);
 
@@ -51,8 +63,17 @@ class TopDstDatabase {
 
   void saveResultToCache(std::string locale, std::vector<DstInfo>& result);
   void truncate();  // clear database
+  // see shared_mem::Table::lockStats
+  std::string lockStats();
+
+  // see shared_mem::Table::saveSnapshot
+  bool saveSnapshot(const std::string& directory);
+  bool loadSnapshot(const std::string& directory);
  private:
   using CachedResult = cache::Cache<std::vector<DstInfo>>;
+  bool make_dst_info(const std::string& locale, const std::string& destination,
+                     const std::string& departure_date, i::DstInfo& info);
+
   shared_mem::Table<i::DstInfo>* db_index;
   std::unordered_map<std::string, CachedResult> result_cache_by_locale;
 
@@ -78,7 +99,7 @@ class TopDstSearchQuery : public shared_mem::TableProcessor<i::DstInfo>, public
 
  private:
   shared_mem::Table<i::DstInfo>& table;
-  std::unordered_map<uint32_t, uint32_t> grouped_destinations;
+  std::unordered_map<uint16_t, uint32_t> grouped_destinations;
 };
 }  // namespace top
 
@@ -0,0 +1,227 @@
+#include <cassert>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "shared_memory.hpp"
+#include "timing.hpp"
+#include "write_ahead_log.hpp"
+
+namespace wal {
+
+//------------------------------------------------------------
+// WriteAheadLog Constructor
+//------------------------------------------------------------
+WriteAheadLog::WriteAheadLog(std::string file_name) : file_name(file_name) {
+  fd = open(file_name.c_str(), O_RDWR | O_APPEND | O_CREAT, (mode_t)0644);
+  if (fd == -1) {
+    std::cerr << "ERROR WriteAheadLog::WriteAheadLog cannot open:" << file_name
+              << " errno:" << errno << std::endl;
+    return;
+  }
+  scan(nullptr);
+}
+
+//------------------------------------------------------------
+// WriteAheadLog Destructor
+//------------------------------------------------------------
+WriteAheadLog::~WriteAheadLog() {
+  if (fd != -1) {
+    commit();
+    close(fd);
+  }
+}
+
+//------------------------------------------------------------
+// WriteAheadLog isOpen
+//------------------------------------------------------------
+bool WriteAheadLog::isOpen() {
+  return fd != -1;
+}
+
+//------------------------------------------------------------
+// WriteAheadLog append
+//------------------------------------------------------------
+void WriteAheadLog::append(const std::string& record) {
+  if (fd == -1) {
+    return;
+  }
+
+  if (pending.empty()) {
+    first_pending_ms = timing::getTimestampMs();
+  }
+
+  uint32_t size = record.size();
+  uint32_t checksum = shared_mem::contentHash(record.data(), record.size());
+  pending.append((const char*)&size, sizeof(size));
+  pending.append((const char*)&checksum, sizeof(checksum));
+  pending.append(record);
+
+  if (pending.size() >= WAL_COMMIT_BYTES) {
+    commit();
+  }
+}
+
+//------------------------------------------------------------
+// WriteAheadLog commit
+//------------------------------------------------------------
+bool WriteAheadLog::commit() {
+  if (fd == -1 || pending.empty()) {
+    return true;
+  }
+
+  // O_APPEND: partial write leaves torn record at the end, replay cuts it off
+  uint64_t offset = lseek(fd, 0, SEEK_END);
+  if (!shared_mem::writeFileBlock(fd, pending.data(), pending.size(), offset) ||
+      fdatasync(fd) != 0) {
+    std::cerr << "ERROR WriteAheadLog::commit failed:" << file_name << " errno:" << errno
+              << std::endl;
+    first_pending_ms = timing::getTimestampMs();
+    return false;
+  }
+
+  pending.clear();
+  return true;
+}
+
+//------------------------------------------------------------
+// WriteAheadLog tick
+//------------------------------------------------------------
+void WriteAheadLog::tick() {
+  if (!pending.empty() && timing::getTimestampMs() - first_pending_ms >= WAL_COMMIT_INTERVAL_MS) {
+    commit();
+  }
+}
+
+//------------------------------------------------------------
+// WriteAheadLog truncate
+//------------------------------------------------------------
+bool WriteAheadLog::truncate() {
+  if (fd == -1) {
+    return false;
+  }
+
+  pending.clear();
+  if (ftruncate(fd, 0) != 0 || fdatasync(fd) != 0) {
+    std::cerr << "ERROR WriteAheadLog::truncate failed:" << file_name << " errno:" << errno
+              << std::endl;
+    return false;
+  }
+  return true;
+}
+
+//------------------------------------------------------------
+// WriteAheadLog replay
+//------------------------------------------------------------
+uint64_t WriteAheadLog::replay(std::function<void(const std::string&)> apply) {
+  if (fd == -1) {
+    return 0;
+  }
+
+  uint64_t records = scan(apply);
+  std::cout << "WriteAheadLog::replay " << file_name << " records:" << records << std::endl;
+  return records;
+}
+
+//------------------------------------------------------------
+// WriteAheadLog scan
+//------------------------------------------------------------
+uint64_t WriteAheadLog::scan(std::function<void(const std::string&)> apply) {
+  uint64_t file_size = lseek(fd, 0, SEEK_END);
+  uint64_t offset = 0;
+  uint64_t records = 0;
+  std::string record;
+
+  while (offset + WAL_FRAME_HEADER_SIZE <= file_size) {
+    uint32_t frame[2];
+    if (!shared_mem::readFileBlock(fd, frame, sizeof(frame), offset)) {
+      break;
+    }
+    uint32_t size = frame[0];
+    if (size > WAL_MAX_RECORD_SIZE || offset + WAL_FRAME_HEADER_SIZE + size > file_size) {
+      break;
+    }
+
+    record.resize(size);
+    if (!shared_mem::readFileBlock(fd, &record[0], size, offset + WAL_FRAME_HEADER_SIZE) ||
+        (uint32_t)shared_mem::contentHash(record.data(), size) != frame[1]) {
+      break;
+    }
+
+    if (apply) {
+      apply(record);
+    }
+    offset += WAL_FRAME_HEADER_SIZE + size;
+    ++records;
+  }
+
+  // new records must follow the last good one
+  if (offset < file_size) {
+    std::cout << "WARNING WriteAheadLog::scan torn tail cut off:" << file_name
+              << " bytes:" << file_size - offset << std::endl;
+    if (ftruncate(fd, offset) != 0) {
+      std::cerr << "ERROR WriteAheadLog::scan ftruncate errno:" << errno << std::endl;
+    }
+  }
+
+  return records;
+}
+
+//------------------------------------------------------------
+// unit_test
+//------------------------------------------------------------
+void unit_test() {
+  std::string file_name = "/tmp/wal_test.log";
+  unlink(file_name.c_str());
+
+  std::vector<std::string> replayed;
+  auto collect = [&replayed](const std::string& record) { replayed.push_back(record); };
+
+  {
+    WriteAheadLog log(file_name);
+    assert(log.isOpen());
+    log.append("first");
+    log.append("");
+    log.append(std::string(1000, 'x'));
+    // not committed yet
+    WriteAheadLog reader(file_name);
+    assert(reader.replay(collect) == 0);
+    assert(log.commit());
+  }
+
+  {
+    WriteAheadLog log(file_name);
+    assert(log.replay(collect) == 3);
+    assert(replayed[0] == "first" && replayed[1] == "" && replayed[2] == std::string(1000, 'x'));
+    log.append("last");  // committed by destructor
+  }
+
+  // torn tail is cut off, appends go after the last good record
+  int fd = open(file_name.c_str(), O_WRONLY | O_APPEND);
+  ssize_t written = write(fd, "\x10\0\0\0garbage", 11);
+  close(fd);
+  assert(written == 11);
+
+  // cut off on open, replay is not needed for that
+  {
+    WriteAheadLog log(file_name);
+    log.append("after tail");
+  }
+
+  replayed.clear();
+  {
+    WriteAheadLog log(file_name);
+    assert(log.replay(collect) == 5 && replayed[4] == "after tail");
+    assert(log.truncate());
+    assert(log.replay(collect) == 0);
+  }
+
+  unlink(file_name.c_str());
+  std::cout << "WriteAheadLog... OK" << std::endl;
+}
+
+}  // namespace wal
@@ -0,0 +1,58 @@
+#ifndef SRC_WRITE_AHEAD_LOG_HPP
+#define SRC_WRITE_AHEAD_LOG_HPP
+
+#include <cinttypes>
+#include <functional>
+#include <string>
+
+namespace wal {
+
+// pending records are written and synced at once (group commit):
+// after WAL_COMMIT_INTERVAL_MS since the first of them or WAL_COMMIT_BYTES collected.
+// appended records are not durable until then: a crash loses records of last
+// WAL_COMMIT_INTERVAL_MS plus time to next tick() call (up to POLL_TIMEOUT_MS for
+// idle DealsServer), even if clients already got their answers
+#define WAL_COMMIT_INTERVAL_MS 100
+#define WAL_COMMIT_BYTES (1 << 20)
+// record frame: [size:4][checksum:4][bytes]
+#define WAL_FRAME_HEADER_SIZE 8
+#define WAL_MAX_RECORD_SIZE (1 << 26)
+
+void unit_test();
+
+//------------------------------------------------------------
+// WriteAheadLog
+//------------------------------------------------------------
+// append only file of records of one process. not thread safe
+class WriteAheadLog {
+ public:
+  // torn tail of last commit is cut off, so new records follow the last good one
+  WriteAheadLog(std::string file_name);
+  // pending records are committed
+  ~WriteAheadLog();
+
+  bool isOpen();
+  void append(const std::string& record);
+  // write and sync pending records, false on io error (records are kept pending)
+  bool commit();
+  // commit if pending records waited long enough, call it from event loop
+  void tick();
+  // all records are saved somewhere else (snapshot) or not needed anymore
+  bool truncate();
+  // call apply for every record in file, returns records count
+  uint64_t replay(std::function<void(const std::string&)> apply);
+
+  const std::string file_name;
+
+ private:
+  // apply (if any) for every good record, cuts off everything after them
+  uint64_t scan(std::function<void(const std::string&)> apply);
+
+  int fd = -1;
+  std::string pending;
+  long long first_pending_ms = 0;
+};
+
+}  // namespace wal
+
+#endif